@@ -3,6 +3,8 @@
 #include <SoyAssert.h>
 #include <SoyDebug.h>
 #include <HeapArray.hpp>
+#include <chrono>
+#include "TJobArena.h"
 
 
 const Soy::Matrix4x4 gWorldToCalibration(
@@ -131,6 +133,57 @@ bool GetCalibrationVectors(std::vector<std::vector<cv::Point3f> >& WorldPointsAr
 }
 
 
+bool IsPlanarRig(const std::vector<cv::Point3f>& WorldPoints)
+{
+	//	calibration space has the rig on z=0 when it's flat on the world floor
+	static float PlanarTolerance = 0.0001f;
+	for ( auto& Point : WorldPoints )
+	{
+		if ( fabsf( Point.z ) > PlanarTolerance )
+			return false;
+	}
+	return true;
+}
+
+
+//	deterministic starting point for the LM solve. Either the known camera scaled to this image size,
+//	Zhang's homography based estimate for planar rigs, or a generic focal length of the larger image dimension.
+void GetInitialCameraMatrix(cv::Mat& CameraMatrix,cv::Mat& DistortionCoeffs,const Opencv::TCalibrateCameraParams& Params,const std::vector<std::vector<cv::Point3f>>& WorldPointsArray,const std::vector<std::vector<cv::Point2f>>& ViewPointsArray)
+{
+	auto& ImageScalar = Params.mCameraImageSize;
+	
+	//	fx/fy ratio is fixed by CV_CALIB_FIX_ASPECT_RATIO, so it's whatever we set here
+	double AspectRatio = Params.mForceImageAspectRatio ? 1.0 : 0.0;
+	
+	auto& Known = Params.mKnownCamera.mSolve;
+	if ( Params.mUseKnownCamera && Known.IsValid() )
+	{
+		CameraMatrix = cv::Mat::eye( 3, 3, CV_64F );
+		Known.GetScaledIntrinsics( ImageScalar.x, ImageScalar.y, CameraMatrix.at<double>(0,0), CameraMatrix.at<double>(1,1), CameraMatrix.at<double>(0,2), CameraMatrix.at<double>(1,2) );
+		
+		for ( int i=0;	i<5;	i++ )
+			DistortionCoeffs.at<double>(i,0) = Known.GetDistortion()[i];
+	}
+	else if ( IsPlanarRig( WorldPointsArray[0] ) )
+	{
+		cv::Size ImageSize( ImageScalar.x, ImageScalar.y );
+		CameraMatrix = cv::initCameraMatrix2D( WorldPointsArray, ViewPointsArray, ImageSize, AspectRatio );
+	}
+	else
+	{
+		double Focal = std::max( ImageScalar.x, ImageScalar.y );
+		CameraMatrix = cv::Mat::eye( 3, 3, CV_64F );
+		CameraMatrix.at<double>(0,0) = Focal;
+		CameraMatrix.at<double>(1,1) = Focal;
+		CameraMatrix.at<double>(0,2) = ImageScalar.x * 0.5;
+		CameraMatrix.at<double>(1,2) = ImageScalar.y * 0.5;
+	}
+	
+	if ( Params.mForceImageAspectRatio )
+		CameraMatrix.at<double>(0,0) = CameraMatrix.at<double>(1,1);
+}
+
+
 std::tuple<vec3f,vec3f> Soy::TCamera::ScreenToWorldRay(vec2f Screen)
 {
 	//	gr: old code started at -1 for near!?
@@ -168,7 +221,7 @@ vec3f Soy::TCamera::ScreenToWorldY(vec2f Screen,float ViewDepth)
 
 
 
-bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,const ArrayBridge<vec3f>&& WorldPoints,const ArrayBridge<vec2f>&& ViewPoints)
+bool CalibrateCameraViews(Soy::TCamera& Camera,const Opencv::TCalibrateCameraParams& Params,std::vector<std::vector<cv::Point3f>>& WorldPointsArray,std::vector<std::vector<cv::Point2f>>& ViewPointsArray,int ExtrinsicView)
 {
 	auto ImageScalar = Params.mCameraImageSize;
 	if ( ImageScalar.x < 1 || ImageScalar.y < 1 )
@@ -189,33 +242,22 @@ bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,
 	//			results are always better, and it affects FOV x/y and we only use Y
 	Flags |= CV_CALIB_FIX_ASPECT_RATIO;
 	
-	//	fix for
+	//	we always supply a real initial camera matrix (see GetInitialCameraMatrix) which also avoids
 	//	error: (-5) For non-planar calibration rigs the initial intrinsic matrix must be specified
-	//	although I'm sure it is a planar calibration rig... this flag means "we already have intrinsics"
-	if ( !Params.mCalculateIntrinsic )
-		Flags |= CV_CALIB_USE_INTRINSIC_GUESS;
+	Flags |= CV_CALIB_USE_INTRINSIC_GUESS;
+	
+	//	intrinsics from a known camera are kept, only the pose is solved
+	if ( !Params.mCalculateIntrinsic && Params.mUseKnownCamera )
+		Flags |= CV_CALIB_FIX_FOCAL_LENGTH | CV_CALIB_FIX_PRINCIPAL_POINT;
 	
 	//Flags |= CV_CALIB_FIX_K4|CV_CALIB_FIX_K5;
 	
 	//	"corners of chessboard"
 	//	gr: define the plane of an object (z=0)... so I guess this is the 3D image (complete with units)
 	//	worldpoints is objectPoints in the examples. "in the calibration pattern coordinate space" so, world space
-	std::vector<std::vector<cv::Point3f> > WorldPointsArray;
-	std::vector<std::vector<cv::Point2f> > ViewPointsArray;
-	
-	if( !GetCalibrationVectors( WorldPointsArray, ViewPointsArray, WorldPoints, ViewPoints, ImageScalar ) )
-		return false;
 	
 	//	matrix we're calculating. 3x3 matrix, 64bit floats (doubles)
-	//	1000 0100 0010 0001
-	cv::Mat cameraMatrix = cv::Mat::eye( 4, 3, CV_64F );
-	
-	if ( Params.mForceImageAspectRatio )
-	{
-		float InitialRatio = ImageScalar.x / ImageScalar.y;
-		cameraMatrix.at<double>(0,0) = InitialRatio;
-		cameraMatrix.at<double>(1,1) = InitialRatio;
-	}
+	cv::Mat cameraMatrix;
 	
 	//	distortion coefficients;
 	//	tangent h/v, fov etc... work out these!
@@ -229,11 +271,16 @@ bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,
 	std::vector<cv::Mat> ObjectRotations;
 	std::vector<cv::Mat> ObjectTranslations;	//	note; will need converting; CalibrationToWorld
 	
+	double AverageErrord = 0;
 	float AverageError = 0.f;
 	
+	cv::TermCriteria Criteria( cv::TermCriteria::COUNT + cv::TermCriteria::EPS, Params.mMaxIterations, Params.mEpsilon );
+	auto StartTime = std::chrono::steady_clock::now();
+	
 	try
 	{
-		double AverageErrord = cv::calibrateCamera( WorldPointsArray, ViewPointsArray, ImageSize, cameraMatrix, distortionCoeffs, ObjectRotations, ObjectTranslations, Flags );
+		GetInitialCameraMatrix( cameraMatrix, distortionCoeffs, Params, WorldPointsArray, ViewPointsArray );
+		AverageErrord = cv::calibrateCamera( WorldPointsArray, ViewPointsArray, ImageSize, cameraMatrix, distortionCoeffs, ObjectRotations, ObjectTranslations, Flags, Criteria );
 		Soy::Assert( Soy::IsValidFloat(Soy::IsValidFloat(AverageErrord)), "Calibration gave invalid error value" );
 		AverageError = static_cast<float>( AverageErrord );
 	}
@@ -258,8 +305,30 @@ bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,
 	}
 	
 
+	//	keep the unrounded solve
+	auto& Solve = Camera.mSolve;
+	Solve.GetCalibrationError() = AverageErrord;
+	Solve.GetImageWidth() = ImageScalar.x;
+	Solve.GetImageHeight() = ImageScalar.y;
+	Solve.GetFocalX() = cameraMatrix.at<double>(0,0);
+	Solve.GetFocalY() = cameraMatrix.at<double>(1,1);
+	Solve.GetPrincipalX() = cameraMatrix.at<double>(0,2);
+	Solve.GetPrincipalY() = cameraMatrix.at<double>(1,2);
+	for ( int i=0;	i<5;	i++ )
+		Solve.GetDistortion()[i] = Params.mZeroRadialDistortion ? 0 : distortionCoeffs.at<double>(i,0);
+	if ( ExtrinsicView < ObjectRotations.size() && ExtrinsicView < ObjectTranslations.size() )
+	{
+		for ( int i=0;	i<3;	i++ )
+		{
+			Solve.GetRotation()[i] = ObjectRotations[ExtrinsicView].at<double>(i);
+			Solve.GetTranslation()[i] = ObjectTranslations[ExtrinsicView].at<double>(i);
+		}
+	}
+	
 	//	save error
 	Camera.mCalibrationError = AverageError;
+	Camera.mCalibrationIterationLimit = Params.mMaxIterations;
+	Camera.mCalibrationTimeMs = std::chrono::duration<float,std::milli>( std::chrono::steady_clock::now() - StartTime ).count();
 	
 	//	pull out lens info
 	if ( Params.mCalculateIntrinsic )
@@ -300,24 +369,12 @@ bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,
 			
 			//	get the distortion values
 			//	k1,k2,p1,p2,k3,k4,k5,k6
-			BufferArray<float,5> DistortionParams(5);
-			if ( Params.mZeroRadialDistortion )
-			{
-				DistortionParams.SetAll( 0.f );
-			}
-			else
-			{
-				DistortionParams[0] = distortionCoeffs.at<double>(0,0);
-				DistortionParams[1] = distortionCoeffs.at<double>(1,0);
-				DistortionParams[2] = distortionCoeffs.at<double>(2,0);
-				DistortionParams[3] = distortionCoeffs.at<double>(3,0);
-				DistortionParams[4] = distortionCoeffs.at<double>(4,0);
-			}
-			
-			Projection.mRadialDistortion.x = fabsf(DistortionParams[0]);	//	k1
-			Projection.mRadialDistortion.y = fabsf(DistortionParams[1]);	//	k2
-			Projection.mTangentialDistortion.x = fabsf(DistortionParams[2]);	//	p1
-			Projection.mTangentialDistortion.y = fabsf(DistortionParams[3]);	//	p1
+			//	keep the sign, undistorting needs it (barrel vs pincushion)
+			auto* DistortionParams = Solve.GetDistortion();
+			Projection.mRadialDistortion.x = DistortionParams[0];	//	k1
+			Projection.mRadialDistortion.y = DistortionParams[1];	//	k2
+			Projection.mTangentialDistortion.x = DistortionParams[2];	//	p1
+			Projection.mTangentialDistortion.y = DistortionParams[3];	//	p2
 			Projection.mDistortionK5 = DistortionParams[4];
 		}
 		
@@ -400,8 +457,8 @@ bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,
 	//	rot and trans output...
 	if ( Params.mCalculateExtrinsic )
 	{
-		cv::Mat& RotationVector = ObjectRotations[0];
-		cv::Mat& TranslationVector = ObjectTranslations[0];
+		cv::Mat& RotationVector = ObjectRotations[ExtrinsicView];
+		cv::Mat& TranslationVector = ObjectTranslations[ExtrinsicView];
 		
 		//	for debug-peeking
 		vec3f tran3( TranslationVector.at<double>(0), TranslationVector.at<double>(1), TranslationVector.at<double>(2) );
@@ -519,6 +576,43 @@ bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,
 }
 
 
+bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,const ArrayBridge<vec3f>&& WorldPoints,const ArrayBridge<vec2f>&& ViewPoints)
+{
+	std::vector<std::vector<cv::Point3f> > WorldPointsArray;
+	std::vector<std::vector<cv::Point2f> > ViewPointsArray;
+	if( !GetCalibrationVectors( WorldPointsArray, ViewPointsArray, WorldPoints, ViewPoints, Params.mCameraImageSize ) )
+		return false;
+	
+	return CalibrateCameraViews( Camera, Params, WorldPointsArray, ViewPointsArray, 0 );
+}
+
+
+bool Opencv::CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,const std::vector<TCalibrationView>& Views)
+{
+	std::vector<std::vector<cv::Point3f> > WorldPointsArray;
+	std::vector<std::vector<cv::Point2f> > ViewPointsArray;
+	auto& ImageScalar = Params.mCameraImageSize;
+	for ( auto& View : Views )
+	{
+		if ( View.mWorldPoints.GetSize() != View.mViewPoints.GetSize() || View.mWorldPoints.IsEmpty() )
+			return false;
+		
+		WorldPointsArray.resize( WorldPointsArray.size()+1 );
+		ViewPointsArray.resize( ViewPointsArray.size()+1 );
+		for ( int p=0;	p<View.mWorldPoints.GetSize();	p++ )
+		{
+			auto& View2 = View.mViewPoints[p];
+			WorldPointsArray.back().push_back( WorldToCalibration( View.mWorldPoints[p] ) );
+			ViewPointsArray.back().push_back( cv::Point2f( View2.x * ImageScalar.x, View2.y * ImageScalar.y ) );
+		}
+	}
+	if ( WorldPointsArray.empty() )
+		return false;
+	
+	//	the newest view is the rig's current pose
+	int ExtrinsicView = static_cast<int>( WorldPointsArray.size() ) - 1;
+	return CalibrateCameraViews( Camera, Params, WorldPointsArray, ViewPointsArray, ExtrinsicView );
+}
 
 
 bool Opencv::GetHomography(Soy::Matrix3x3& HomographyMtx, Opencv::TGetHomographyParams Params, const ArrayBridge<vec2f> &&Points2D, const ArrayBridge<vec2f> &&PointsUv)
@@ -537,10 +631,19 @@ bool Opencv::GetHomography(Soy::Matrix3x3& HomographyMtx, Opencv::TGetHomography
 	if ( !Soy::Assert( PointsUv.GetSize() == Points2D.GetSize(), "point count mis match" ) )
 		return false;
 	
-	std::vector<cv::Point2f> SrcPoints;
-	Points2D.ForEach( [&SrcPoints,&ImageScalar](const vec2f& p)	{ SrcPoints.push_back(VectorToPoint(p*ImageScalar));	return true;	} );
-	std::vector<cv::Point2f> DestinationPoints;
-	PointsUv.ForEach( [&DestinationPoints,&ImageScalar](const vec2f& p)	{ DestinationPoints.push_back(VectorToPoint(p*ImageScalar));	return true;	} );
+	//	points go straight into job-arena memory wrapped by mat headers, rather than growing vectors
+	TJobArenaScope ArenaScope;
+	auto& Arena = TJobArenaScope::GetArena();
+	int PointCount = static_cast<int>( Points2D.GetSize() );
+	auto* SrcPointsData = Arena.AllocArray<cv::Point2f>( PointCount );
+	auto* DestinationPointsData = Arena.AllocArray<cv::Point2f>( PointCount );
+	for ( int i=0;	i<PointCount;	i++ )
+	{
+		SrcPointsData[i] = VectorToPoint( Points2D[i] * ImageScalar );
+		DestinationPointsData[i] = VectorToPoint( PointsUv[i] * ImageScalar );
+	}
+	cv::Mat SrcPoints( PointCount, 1, CV_32FC2, SrcPointsData );
+	cv::Mat DestinationPoints( PointCount, 1, CV_32FC2, DestinationPointsData );
 	
 	cv::Mat Homography = cv::findHomography( SrcPoints, DestinationPoints );
 
@@ -548,3 +651,70 @@ bool Opencv::GetHomography(Soy::Matrix3x3& HomographyMtx, Opencv::TGetHomography
 	
 	return true;
 }
+
+
+
+//	header to reject foreign/old data. Doubles are written in host byte order, which is little endian on every platform we run on
+static const char	CameraSolveMagic[4] = { 'P', 'C', 'A', 'M' };
+static const uint32	CameraSolveVersion = 1;
+static const size_t	CameraSolveHeaderSize = sizeof(CameraSolveMagic) + sizeof(CameraSolveVersion);
+
+
+void Opencv::EncodeCameraSolve(ArrayBridge<char>&& Data,const Soy::TCameraSolve& Solve)
+{
+	auto DataSize = sizeof(double) * Soy::TCameraSolve::DoubleCount;
+	auto* Header = Data.PushBlock( CameraSolveHeaderSize + DataSize );
+	memcpy( Header, CameraSolveMagic, sizeof(CameraSolveMagic) );
+	memcpy( Header + sizeof(CameraSolveMagic), &CameraSolveVersion, sizeof(CameraSolveVersion) );
+	memcpy( Header + CameraSolveHeaderSize, Solve.GetDoubles(), DataSize );
+}
+
+
+bool Opencv::DecodeCameraSolve(Soy::TCameraSolve& Solve,const ArrayBridge<char>&& Data)
+{
+	auto DataSize = sizeof(double) * Soy::TCameraSolve::DoubleCount;
+	if ( Data.GetDataSize() != CameraSolveHeaderSize + DataSize )
+		return false;
+	
+	auto* Header = Data.GetArray();
+	if ( memcmp( Header, CameraSolveMagic, sizeof(CameraSolveMagic) ) != 0 )
+		return false;
+	uint32 Version = 0;
+	memcpy( &Version, Header + sizeof(CameraSolveMagic), sizeof(Version) );
+	if ( Version != CameraSolveVersion )
+		return false;
+	
+	memcpy( Solve.GetDoubles(), Header + CameraSolveHeaderSize, DataSize );
+	return true;
+}
+
+
+std::string Opencv::CameraSolveToString(const Soy::TCameraSolve& Solve)
+{
+	std::stringstream String;
+	String.precision( std::numeric_limits<double>::max_digits10 );
+	auto* Doubles = Solve.GetDoubles();
+	for ( int i=0;	i<Soy::TCameraSolve::DoubleCount;	i++ )
+	{
+		if ( i > 0 )
+			String << ',';
+		String << Doubles[i];
+	}
+	return String.str();
+}
+
+
+bool Opencv::StringToCameraSolve(Soy::TCameraSolve& Solve,const std::string& String)
+{
+	std::stringstream Stream( String );
+	auto* Doubles = Solve.GetDoubles();
+	for ( int i=0;	i<Soy::TCameraSolve::DoubleCount;	i++ )
+	{
+		if ( i > 0 && Stream.get() != ',' )
+			return false;
+		Stream >> Doubles[i];
+		if ( Stream.fail() )
+			return false;
+	}
+	return true;
+}
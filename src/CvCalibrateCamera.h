@@ -2,10 +2,14 @@
 
 #include <array.hpp>
 #include <SoyMath.h>
+#include <limits>
+#include <string>
+#include <vector>
 
 namespace Soy
 {
 	class TCamera;
+	class TCameraSolve;
 };
 
 
@@ -13,10 +17,86 @@ namespace Opencv
 {
 	class TCalibrateCameraParams;
 	class TGetHomographyParams;
+	class TCalibrationView;
 
 	//	view points should be normalised
 	bool	CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,const ArrayBridge<vec3f>&& WorldPoints,const ArrayBridge<vec2f>&& ViewPoints);
+	//	one solve over several views of the rig. Extrinsics are the last view's
+	bool	CalibrateCamera(Soy::TCamera& Camera,TCalibrateCameraParams Params,const std::vector<TCalibrationView>& Views);
 	bool	GetHomography(Soy::Matrix3x3& Homography,TGetHomographyParams Params,const ArrayBridge<vec2f>&& Points2D,const ArrayBridge<vec2f>&& PointsUv);
+	
+	//	exact binary round trip of a solve, for replies & warm starts
+	void	EncodeCameraSolve(ArrayBridge<char>&& Data,const Soy::TCameraSolve& Solve);
+	bool	DecodeCameraSolve(Soy::TCameraSolve& Solve,const ArrayBridge<char>&& Data);
+	//	comma separated, printed with enough digits to round trip
+	std::string	CameraSolveToString(const Soy::TCameraSolve& Solve);
+	bool	StringToCameraSolve(Soy::TCameraSolve& Solve,const std::string& String);
+};
+
+
+
+//	full precision output of cv::calibrateCamera. The float members of TCamera are derived from this
+class Soy::TCameraSolve
+{
+public:
+	//	layout of mValues, which is also the binary/string encoding order
+	static const int	CalibrationErrorIndex = 0;
+	static const int	ImageWidthIndex = 1;		//	pixel size the camera matrix was solved at
+	static const int	ImageHeightIndex = 2;
+	static const int	FocalXIndex = 3;			//	camera matrix, in pixels
+	static const int	FocalYIndex = 4;
+	static const int	PrincipalXIndex = 5;
+	static const int	PrincipalYIndex = 6;
+	static const int	DistortionIndex = 7;		//	k1,k2,p1,p2,k3
+	static const int	RotationIndex = 12;			//	rodrigues vector, calibration space
+	static const int	TranslationIndex = 15;		//	calibration space
+	static const int	DoubleCount = 18;
+	
+public:
+	TCameraSolve()
+	{
+		for ( int i=0;	i<DoubleCount;	i++ )
+			mValues[i] = 0;
+	}
+	
+	bool			IsValid() const		{	return GetImageWidth() >= 1 && GetImageHeight() >= 1;	}
+	double*			GetDoubles()		{	return mValues;	}
+	const double*	GetDoubles() const	{	return mValues;	}
+	
+	double&			GetCalibrationError()			{	return mValues[CalibrationErrorIndex];	}
+	double			GetCalibrationError() const		{	return mValues[CalibrationErrorIndex];	}
+	double&			GetImageWidth()					{	return mValues[ImageWidthIndex];	}
+	double			GetImageWidth() const			{	return mValues[ImageWidthIndex];	}
+	double&			GetImageHeight()				{	return mValues[ImageHeightIndex];	}
+	double			GetImageHeight() const			{	return mValues[ImageHeightIndex];	}
+	double&			GetFocalX()						{	return mValues[FocalXIndex];	}
+	double			GetFocalX() const				{	return mValues[FocalXIndex];	}
+	double&			GetFocalY()						{	return mValues[FocalYIndex];	}
+	double			GetFocalY() const				{	return mValues[FocalYIndex];	}
+	double&			GetPrincipalX()					{	return mValues[PrincipalXIndex];	}
+	double			GetPrincipalX() const			{	return mValues[PrincipalXIndex];	}
+	double&			GetPrincipalY()					{	return mValues[PrincipalYIndex];	}
+	double			GetPrincipalY() const			{	return mValues[PrincipalYIndex];	}
+	double*			GetDistortion()					{	return &mValues[DistortionIndex];	}
+	const double*	GetDistortion() const			{	return &mValues[DistortionIndex];	}
+	double*			GetRotation()					{	return &mValues[RotationIndex];	}
+	const double*	GetRotation() const				{	return &mValues[RotationIndex];	}
+	double*			GetTranslation()				{	return &mValues[TranslationIndex];	}
+	const double*	GetTranslation() const			{	return &mValues[TranslationIndex];	}
+	
+	//	intrinsics scaled to another image size
+	void			GetScaledIntrinsics(double Width,double Height,double& fx,double& fy,double& cx,double& cy) const
+	{
+		double ScaleX = Width / GetImageWidth();
+		double ScaleY = Height / GetImageHeight();
+		fx = GetFocalX() * ScaleX;
+		fy = GetFocalY() * ScaleY;
+		cx = GetPrincipalX() * ScaleX;
+		cy = GetPrincipalY() * ScaleY;
+	}
+	
+private:
+	double	mValues[DoubleCount];
 };
 
 
@@ -26,6 +106,8 @@ class Soy::TCamera
 public:
 	TCamera() :
 		mCalibrationError		( 0.f ),
+		mCalibrationIterationLimit	( 0 ),
+		mCalibrationTimeMs		( 0.f ),
 		mFocalLength			( 1.f ),
 		mDistortionK5			( 0 ),
 		mFov					( 40.f, 40.f ),
@@ -35,6 +117,9 @@ public:
 	
 public:
 	float		mCalibrationError;
+	int			mCalibrationIterationLimit;	//	LM iteration cap the solve ran with
+	float		mCalibrationTimeMs;
+	TCameraSolve	mSolve;		//	unrounded solve, used for undistort maps & warm starts
 	float4x4	mMatrix;			//	extrinsic matrix. Modelview?
 	float4x4	mIntrinsicMatrix;	//	projection?
 	vec3f		mCameraWorldPosition;
@@ -71,11 +156,21 @@ public:
 		mCalculateIntrinsic		( true ),
 		mForceImageAspectRatio	( true ),
 		mCalculateExtrinsic		( true ),
-		mZeroRadialDistortion	( false )
+		mZeroRadialDistortion	( false ),
+		mUseKnownCamera			( false ),
+		mMaxIterations			( 30 ),
+		mEpsilon				( std::numeric_limits<double>::epsilon() )
 	{
 	}
 	
-	//	Soy::TCamera	mKnownCamera;
+	//	warm start from a previously solved camera instead of estimating the intrinsics
+	Soy::TCamera	mKnownCamera;
+	bool	mUseKnownCamera;
+	
+	//	LM termination (same defaults as cv::calibrateCamera)
+	int		mMaxIterations;
+	double	mEpsilon;
+	
 	bool	mForceImageAspectRatio;
 	bool	mCalculateIntrinsic;
 	bool	mCalculateExtrinsic;
@@ -85,6 +180,16 @@ public:
 
 
 
+//	correspondences from one frame
+class Opencv::TCalibrationView
+{
+public:
+	Array<vec3f>	mWorldPoints;
+	Array<vec2f>	mViewPoints;	//	normalised
+};
+
+
+
 class Opencv::TGetHomographyParams
 {
 public:
@@ -0,0 +1,222 @@
+#include "CvDetector.h"
+#include "CvPixels.h"
+#include <opencv2/features2d/features2d.hpp>
+#include <SoyString.h>
+#include <algorithm>
+#include <mutex>
+
+
+
+//	FAST over a stripe of rows. Stripes overlap by the circle radius plus a row for non-max suppression
+//	and each keeps only the keypoints in its own rows, so together they're the same as a whole-image FAST
+class TFastStripes : public cv::ParallelLoopBody
+{
+public:
+	TFastStripes(const cv::Mat& Luma,int Threshold,int RowsPerStripe,std::vector<std::vector<cv::KeyPoint>>& StripeKeypoints) :
+		mLuma				( Luma ),
+		mThreshold			( Threshold ),
+		mRowsPerStripe		( RowsPerStripe ),
+		mStripeKeypoints	( StripeKeypoints )
+	{
+	}
+
+	virtual void operator()(const cv::Range& Stripes) const override
+	{
+		static const int Overlap = 4;
+		std::vector<cv::KeyPoint> Keypoints;
+		for ( int s=Stripes.start;	s<Stripes.end;	s++ )
+		{
+			int First = s * mRowsPerStripe;
+			int Last = std::min( mLuma.rows, First + mRowsPerStripe );
+			int Top = std::max( 0, First - Overlap );
+			int Bottom = std::min( mLuma.rows, Last + Overlap );
+
+			Keypoints.clear();
+			cv::FAST( mLuma.rowRange( Top, Bottom ), Keypoints, mThreshold, true );
+			auto& StripeKeypoints = mStripeKeypoints[s];
+			for ( auto& Keypoint : Keypoints )
+			{
+				Keypoint.pt.y += Top;
+				if ( Keypoint.pt.y >= First && Keypoint.pt.y < Last )
+					StripeKeypoints.push_back( Keypoint );
+			}
+		}
+	}
+
+public:
+	const cv::Mat&								mLuma;
+	int											mThreshold;
+	int											mRowsPerStripe;
+	std::vector<std::vector<cv::KeyPoint>>&		mStripeKeypoints;
+};
+
+
+//	our descriptor at each keypoint, which is where the time goes
+class TExtractKeypointFeatures : public cv::ParallelLoopBody
+{
+public:
+	TExtractKeypointFeatures(const SoyPixels& Image,const TFeatureBinRingParams& Params,std::vector<TFeatureMatch>& Features,std::vector<uint8>& Valid) :
+		mImage		( Image ),
+		mParams		( Params ),
+		mFeatures	( Features ),
+		mValid		( Valid )
+	{
+	}
+
+	virtual void operator()(const cv::Range& Range) const override
+	{
+		std::stringstream Error;
+		for ( int i=Range.start;	i<Range.end;	i++ )
+		{
+			auto& Feature = mFeatures[i];
+			TFeatureExtractor::GetFeature( Feature.mFeature, mImage, Feature.mCoord.x, Feature.mCoord.y, mParams, Error );
+			mValid[i] = Error.tellp() == 0;
+			if ( mValid[i] )
+				continue;
+
+			std::lock_guard<std::mutex> Lock( mErrorLock );
+			if ( mError.empty() )
+				mError = Error.str();
+			Error.str( std::string() );
+			Error.clear();
+		}
+	}
+
+public:
+	const SoyPixels&				mImage;
+	const TFeatureBinRingParams&	mParams;
+	std::vector<TFeatureMatch>&		mFeatures;
+	std::vector<uint8>&				mValid;
+	mutable std::mutex				mErrorLock;
+	mutable std::string				mError;		//	first failure
+};
+
+
+bool Opencv::ToDetector(Detector::Type& Detector,const std::string& Name)
+{
+	if ( Name.empty() || Name == "grid" )
+		Detector = Detector::Grid;
+	else if ( Name == "fast" )
+		Detector = Detector::Fast;
+	else if ( Name == "orb" )
+		Detector = Detector::Orb;
+	else if ( Name == "agast" )
+		Detector = Detector::Fast;	//	agast isn't in opencv 2.4; fast is the nearest
+	else
+		return false;
+	return true;
+}
+
+
+std::string Opencv::ToString(Detector::Type Detector)
+{
+	switch ( Detector )
+	{
+		case Detector::Fast:	return "fast";
+		case Detector::Orb:		return "orb";
+		default:				return "grid";
+	}
+}
+
+
+bool Opencv::DetectFeatures(ArrayBridge<TFeatureMatch>&& Features,cv::Mat& OrbDescriptors,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TDetectorParams& DetectorParams,const FeatureSearch::TRegion& Region,std::stringstream& Error)
+{
+	cv::Mat Luma;
+	GetLuma( Luma, Image );
+	int Width = Image.GetWidth();
+	int Height = Image.GetHeight();
+
+	std::vector<cv::KeyPoint> Keypoints;
+	cv::Mat Descriptors;
+	try
+	{
+		if ( DetectorParams.mDetector == Detector::Orb )
+		{
+			//	orb is multi-scale and keeps the best N over the whole frame, so it isn't split into stripes
+			cv::Mat Mask;
+			if ( !Region.IsWholeImage() )
+			{
+				Mask = cv::Mat( Height, Width, CV_8UC1 );
+				for ( int y=0;	y<Height;	y++ )
+				{
+					auto* Row = Mask.ptr<uint8>(y);
+					for ( int x=0;	x<Width;	x++ )
+						Row[x] = Region.Contains( x, y, Width, Height ) ? 255 : 0;
+				}
+			}
+			cv::ORB Orb( DetectorParams.mOrbFeatures );
+			Orb( Luma, Mask, Keypoints, Descriptors );
+		}
+		else
+		{
+			static int RowsPerStripe = 64;
+			int StripeCount = std::max( 1, ( Luma.rows + RowsPerStripe - 1 ) / RowsPerStripe );
+			std::vector<std::vector<cv::KeyPoint>> StripeKeypoints( StripeCount );
+			TFastStripes Fast( Luma, DetectorParams.mFastThreshold, RowsPerStripe, StripeKeypoints );
+			cv::parallel_for_( cv::Range( 0, StripeCount ), Fast );
+
+			for ( auto& Stripe : StripeKeypoints )
+			{
+				for ( auto& Keypoint : Stripe )
+				{
+					int x = static_cast<int>( Keypoint.pt.x + 0.5f );
+					int y = static_cast<int>( Keypoint.pt.y + 0.5f );
+					if ( Region.IsWholeImage() || Region.Contains( x, y, Width, Height ) )
+						Keypoints.push_back( Keypoint );
+				}
+			}
+		}
+	}
+	catch ( cv::Exception& Exception )
+	{
+		Error << ToString( DetectorParams.mDetector ) << " detector exception: " << Exception.what();
+		return false;
+	}
+
+	//	suppress before extracting descriptors. The keypoint index rides along in the unused source coord
+	float MaxResponse = 0.f;
+	for ( auto& Keypoint : Keypoints )
+		MaxResponse = std::max( MaxResponse, Keypoint.response );
+	Array<TFeatureMatch> Candidates;
+	for ( int k=0;	k<Keypoints.size();	k++ )
+	{
+		auto& Keypoint = Keypoints[k];
+		auto& Candidate = Candidates.PushBack();
+		Candidate.mCoord.x = std::min( Width-1, static_cast<int>( Keypoint.pt.x + 0.5f ) );
+		Candidate.mCoord.y = std::min( Height-1, static_cast<int>( Keypoint.pt.y + 0.5f ) );
+		Candidate.mScore = MaxResponse > 0.f ? Keypoint.response / MaxResponse : 1.f;
+		Candidate.mSourceCoord = vec2x<int>( k, -1 );
+	}
+	FeatureSearch::SuppressNonMaxima( GetArrayBridge( Candidates ), DetectorParams.mNmsRadius, DetectorParams.mMaxFeatures );
+
+	OrbDescriptors.release();
+	if ( Candidates.GetSize() == 0 )
+		return true;
+	
+	std::vector<TFeatureMatch> Extracted( Candidates.GetSize() );
+	std::vector<uint8> Valid( Candidates.GetSize(), 0 );
+	for ( int c=0;	c<Candidates.GetSize();	c++ )
+		Extracted[c] = Candidates[c];
+	TExtractKeypointFeatures Extract( Image, Params, Extracted, Valid );
+	static int FeaturesPerStripe = 64;
+	cv::parallel_for_( cv::Range( 0, static_cast<int>( Extracted.size() ) ), Extract, Extracted.size() / static_cast<double>(FeaturesPerStripe) );
+	if ( !Extract.mError.empty() )
+		Error << Extract.mError;
+
+	int ValidCount = static_cast<int>( std::count( Valid.begin(), Valid.end(), 1 ) );
+	if ( !Descriptors.empty() )
+		OrbDescriptors.create( ValidCount, Descriptors.cols, Descriptors.type() );
+	int DescriptorRow = 0;
+	for ( int c=0;	c<Extracted.size();	c++ )
+	{
+		if ( !Valid[c] )
+			continue;
+		auto& Feature = Extracted[c];
+		int KeypointIndex = Feature.mSourceCoord.x;
+		if ( !Descriptors.empty() )
+			Descriptors.row( KeypointIndex ).copyTo( OrbDescriptors.row( DescriptorRow++ ) );
+		Feature.mSourceCoord = vec2x<int>(-1,-1);
+		Features.PushBack( Feature );
+	}
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <SoyPixels.h>
+#include <TFeatureBinRing.h>
+#include "FeatureSearch.h"
+
+
+namespace Opencv
+{
+	namespace Detector
+	{
+		enum Type
+		{
+			Grid,		//	our own dense grid, not an opencv detector
+			Fast,
+			Orb,
+		};
+	}
+
+	class TDetectorParams;
+
+	//	false for unknown names. agast is accepted, but isn't in opencv 2.4 so is Fast
+	bool			ToDetector(Detector::Type& Detector,const std::string& Name);
+	std::string		ToString(Detector::Type Detector);
+
+	//	keypoints inside the region, as matches with a TFeatureBinRing at each so replies, findfeature and the
+	//	databases work as they do with the grid. Score is the detector response relative to the strongest keypoint.
+	//	Orb also fills OrbDescriptors, one 32 byte row per feature, in the same order
+	bool			DetectFeatures(ArrayBridge<TFeatureMatch>&& Features,cv::Mat& OrbDescriptors,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TDetectorParams& DetectorParams,const FeatureSearch::TRegion& Region,std::stringstream& Error);
+};
+
+
+class Opencv::TDetectorParams
+{
+public:
+	TDetectorParams() :
+		mDetector		( Detector::Grid ),
+		mFastThreshold	( 20 ),
+		mOrbFeatures	( 500 ),
+		mNmsRadius		( 0 ),
+		mMaxFeatures	( 0 )
+	{
+	}
+
+public:
+	Detector::Type	mDetector;
+	int				mFastThreshold;
+	int				mOrbFeatures;
+	int				mNmsRadius;		//	applied to keypoints before descriptors are extracted
+	int				mMaxFeatures;
+};
@@ -0,0 +1,48 @@
+#include "CvOpticalFlow.h"
+#include "CvPixels.h"
+#include <opencv2/video/tracking.hpp>
+#include <algorithm>
+
+
+
+bool Opencv::BuildFlowPyramid(TFlowPyramid& Pyramid,const SoyPixels& Image,const TOpticalFlowParams& Params,std::stringstream& Error)
+{
+	cv::Mat Luma;
+	GetLuma( Luma, Image );
+	try
+	{
+		//	pyramid keeps its own copy of level 0, the luma may share the image's pixels
+		cv::Size WindowSize( Params.mWindowSize, Params.mWindowSize );
+		Pyramid.mLevels.clear();
+		int Levels = cv::buildOpticalFlowPyramid( Luma, Pyramid.mLevels, WindowSize, Params.mMaxLevel, true, cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false );
+		Pyramid.mWindowSize = Params.mWindowSize;
+		Pyramid.mMaxLevel = Levels;
+	}
+	catch ( cv::Exception& Exception )
+	{
+		Error << "Failed to build flow pyramid: " << Exception.what();
+		return false;
+	}
+	return true;
+}
+
+
+bool Opencv::CalcOpticalFlow(std::vector<cv::Point2f>& NewPoints,std::vector<uint8>& Status,std::vector<float>& Errors,const TFlowPyramid& Previous,const TFlowPyramid& Next,const std::vector<cv::Point2f>& Points,const TOpticalFlowParams& Params,std::stringstream& Error)
+{
+	if ( Points.empty() )
+		return true;
+
+	try
+	{
+		cv::Size WindowSize( Params.mWindowSize, Params.mWindowSize );
+		cv::TermCriteria Criteria( cv::TermCriteria::COUNT | cv::TermCriteria::EPS, Params.mMaxIterations, Params.mEpsilon );
+		int MaxLevel = std::min( Params.mMaxLevel, std::min( Previous.mMaxLevel, Next.mMaxLevel ) );
+		cv::calcOpticalFlowPyrLK( Previous.mLevels, Next.mLevels, Points, NewPoints, Status, Errors, WindowSize, MaxLevel, Criteria );
+	}
+	catch ( cv::Exception& Exception )
+	{
+		Error << "Optical flow failed: " << Exception.what();
+		return false;
+	}
+	return true;
+}
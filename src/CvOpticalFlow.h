@@ -0,0 +1,80 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <SoyPixels.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+
+namespace Opencv
+{
+	class TOpticalFlowParams;
+	class TFlowPyramid;
+	class TFlowStream;
+
+	bool	BuildFlowPyramid(TFlowPyramid& Pyramid,const SoyPixels& Image,const TOpticalFlowParams& Params,std::stringstream& Error);
+
+	//	sparse pyramidal lucas-kanade from Previous to Next. Status is 1 where the point was tracked
+	bool	CalcOpticalFlow(std::vector<cv::Point2f>& NewPoints,std::vector<uint8>& Status,std::vector<float>& Errors,const TFlowPyramid& Previous,const TFlowPyramid& Next,const std::vector<cv::Point2f>& Points,const TOpticalFlowParams& Params,std::stringstream& Error);
+};
+
+
+//	windowsize= maxlevel= iterations= epsilon=
+class Opencv::TOpticalFlowParams
+{
+public:
+	TOpticalFlowParams() :
+		mWindowSize		( 21 ),
+		mMaxLevel		( 3 ),
+		mMaxIterations	( 30 ),
+		mEpsilon		( 0.01 )
+	{
+	}
+
+public:
+	int		mWindowSize;
+	int		mMaxLevel;
+	int		mMaxIterations;
+	double	mEpsilon;
+};
+
+
+//	luma pyramid (with derivatives) of one frame, built once and given to calcOpticalFlowPyrLK
+class Opencv::TFlowPyramid
+{
+public:
+	TFlowPyramid() :
+		mFrame		( -1 ),
+		mWindowSize	( 0 ),
+		mMaxLevel	( 0 )
+	{
+	}
+
+	//	the window size is baked into the pyramid's borders
+	bool	IsCompatible(const TOpticalFlowParams& Params) const	{	return mWindowSize == Params.mWindowSize;	}
+
+public:
+	std::vector<cv::Mat>	mLevels;
+	int64					mFrame;
+	int						mWindowSize;
+	int						mMaxLevel;		//	levels built; fewer than asked for on small frames
+};
+
+
+//	the last two frames of a named stream, so a chain of calls builds each frame's pyramid once; as the
+//	current frame, then again as the previous one. Calls for the same frame id reuse both
+class Opencv::TFlowStream
+{
+public:
+	//	a call for the current frame reuses both pyramids (so can't change the window size), anything else is a new frame
+	bool		IsCurrentFrame(int64 Frame) const	{	return Frame >= 0 && mCurrent && mCurrent->mFrame == Frame;	}
+	//	what a new frame will flow from. A changed window size restarts the stream, the old borders don't fit
+	std::shared_ptr<TFlowPyramid>	GetNewFramePrevious(const TOpticalFlowParams& Params) const	{	return ( mCurrent && mCurrent->IsCompatible( Params ) ) ? mCurrent : nullptr;	}
+
+public:
+	std::mutex						mLock;
+	std::shared_ptr<TFlowPyramid>	mPrevious;
+	std::shared_ptr<TFlowPyramid>	mCurrent;
+};
@@ -0,0 +1,68 @@
+#include "CvPixels.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <SoyAssert.h>
+
+
+
+SoyPixelsFormat::Type GetFormatFromChannels(int Channels)
+{
+	switch ( Channels )
+	{
+		case 1:	return SoyPixelsFormat::Greyscale;
+		case 3:	return SoyPixelsFormat::RGB;
+		case 4:	return SoyPixelsFormat::RGBA;
+		default:
+			return SoyPixelsFormat::Invalid;
+	}
+}
+
+
+cv::Mat Opencv::GetMat(SoyPixels& Pixels)
+{
+	auto& PixelsArray = Pixels.GetPixelsArray();
+	int Type = CV_MAKETYPE( CV_8U, Pixels.GetChannels() );
+	return cv::Mat( Pixels.GetHeight(), Pixels.GetWidth(), Type, PixelsArray.GetArray() );
+}
+
+cv::Mat Opencv::GetMat(const SoyPixels& Pixels)
+{
+	//	cv::Mat has no const-ness, caller is trusted not to write
+	return GetMat( const_cast<SoyPixels&>( Pixels ) );
+}
+
+
+bool Opencv::GetPixels(SoyPixels& Pixels,const cv::Mat& Mat)
+{
+	if ( !Soy::Assert( Mat.depth() == CV_8U, "Expected 8 bit mat" ) )
+		return false;
+	
+	auto Format = GetFormatFromChannels( Mat.channels() );
+	if ( !Soy::Assert( Format != SoyPixelsFormat::Invalid, "Unsupported mat channel count" ) )
+		return false;
+
+	if ( Pixels.GetWidth() != Mat.cols || Pixels.GetHeight() != Mat.rows || Pixels.GetFormat() != Format )
+	{
+		if ( !Pixels.Init( Mat.cols, Mat.rows, Format ) )
+			return false;
+	}
+
+	//	copy via a header so a non-continuous (roi) mat is handled
+	cv::Mat Dest = GetMat( Pixels );
+	Mat.copyTo( Dest );
+	return true;
+}
+
+
+void Opencv::GetLuma(cv::Mat& Luma,const SoyPixels& Pixels)
+{
+	cv::Mat Image = GetMat( Pixels );
+	switch ( Image.channels() )
+	{
+		case 1:	Luma = Image;	break;
+		case 3:	cv::cvtColor( Image, Luma, CV_RGB2GRAY );	break;
+		case 4:	cv::cvtColor( Image, Luma, CV_RGBA2GRAY );	break;
+		default:
+			throw Soy::AssertException("Unsupported pixel format for luma");
+	}
+}
+
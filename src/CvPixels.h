@@ -0,0 +1,19 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <SoyPixels.h>
+
+
+namespace Opencv
+{
+	//	wrap pixels in a mat header without copying. The mat is only valid whilst the pixels aren't re-allocated
+	cv::Mat	GetMat(SoyPixels& Pixels);
+	cv::Mat	GetMat(const SoyPixels& Pixels);
+	
+	//	copy a mat (8 bit, 1/3/4 channels) into pixels, re-allocating if the size/format differs
+	bool	GetPixels(SoyPixels& Pixels,const cv::Mat& Mat);
+	
+	//	single channel 8 bit version of the image. Shares the pixel buffer if it's already greyscale
+	void	GetLuma(cv::Mat& Luma,const SoyPixels& Pixels);
+};
+
@@ -0,0 +1,128 @@
+#include "CvUndistort.h"
+#include "CvPixels.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <SoyAssert.h>
+#include <algorithm>
+#include <sstream>
+
+
+
+//	remap a stripe of rows. Maps hold absolute source coords so each stripe only needs its own rows of the maps
+class TRemapRows : public cv::ParallelLoopBody
+{
+public:
+	TRemapRows(const cv::Mat& Source,cv::Mat& Destination,const Opencv::TUndistortMap& Map) :
+		mSource			( Source ),
+		mDestination	( Destination ),
+		mMap			( Map )
+	{
+	}
+	
+	virtual void operator()(const cv::Range& Rows) const override
+	{
+		cv::Rect Stripe( 0, Rows.start, mDestination.cols, Rows.end - Rows.start );
+		cv::Mat DestinationStripe = mDestination( Stripe );
+		cv::remap( mSource, DestinationStripe, mMap.mMapXy( Stripe ), mMap.mMapInterp( Stripe ), cv::INTER_LINEAR, cv::BORDER_CONSTANT );
+	}
+	
+public:
+	const cv::Mat&					mSource;
+	cv::Mat&						mDestination;
+	const Opencv::TUndistortMap&	mMap;
+};
+
+
+
+Opencv::TUndistortMap::TUndistortMap(const Soy::TCamera& Camera,int Width,int Height)
+{
+	Soy::Assert( Width > 0 && Height > 0, "Invalid undistort map size" );
+	auto& Solve = Camera.mSolve;
+	Soy::Assert( Solve.IsValid(), "Camera has no calibration solve" );
+
+	//	intrinsics were solved at the calibration resolution, scale to this one
+	cv::Mat CameraMatrix = cv::Mat::eye( 3, 3, CV_64F );
+	Solve.GetScaledIntrinsics( Width, Height, CameraMatrix.at<double>(0,0), CameraMatrix.at<double>(1,1), CameraMatrix.at<double>(0,2), CameraMatrix.at<double>(1,2) );
+	
+	//	k1,k2,p1,p2,k3
+	cv::Mat DistortionCoeffs( 5, 1, CV_64F );
+	for ( int i=0;	i<5;	i++ )
+		DistortionCoeffs.at<double>(i,0) = Solve.GetDistortion()[i];
+	
+	//	keep the same camera matrix for the output so pixels stay in the same space
+	cv::initUndistortRectifyMap( CameraMatrix, DistortionCoeffs, cv::Mat(), CameraMatrix, cv::Size( Width, Height ), CV_16SC2, mMapXy, mMapInterp );
+}
+
+
+bool Opencv::TUndistortMapCache::IsLatestGeneration(const std::string& CameraName,uint64 Generation)
+{
+	//	a job can get the new camera before it's invalidated
+	auto& Latest = mGenerations[CameraName];
+	Latest = std::max( Latest, Generation );
+	return Generation == Latest;
+}
+
+
+std::shared_ptr<Opencv::TUndistortMap> Opencv::TUndistortMapCache::GetMap(const std::string& CameraName,uint64 Generation,const Soy::TCamera& Camera,int Width,int Height)
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( IsLatestGeneration( CameraName, Generation ) )
+		{
+			auto& Map = mMaps[TKey( CameraName, Generation, Width, Height )];
+			if ( !Map )
+				Map.reset( new TUndistortMap( Camera, Width, Height ) );
+			return Map;
+		}
+	}
+	
+	//	the camera was replaced whilst this job had it
+	return std::shared_ptr<TUndistortMap>( new TUndistortMap( Camera, Width, Height ) );
+}
+
+
+void Opencv::TUndistortMapCache::Invalidate(const std::string& CameraName,uint64 Generation)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto& Latest = mGenerations[CameraName];
+	Latest = std::max( Latest, Generation );
+	for ( auto it=mMaps.begin();	it!=mMaps.end();	)
+	{
+		if ( std::get<0>( it->first ) == CameraName && std::get<1>( it->first ) < Latest )
+			it = mMaps.erase( it );
+		else
+			it++;
+	}
+}
+
+
+bool Opencv::Undistort(SoyPixels& Output,const SoyPixels& Input,const TUndistortMap& Map)
+{
+	if ( !Soy::Assert( Map.IsValid( Input.GetWidth(), Input.GetHeight() ), "Undistort map is for a different resolution" ) )
+		return false;
+	
+	if ( Output.GetWidth() != Input.GetWidth() || Output.GetHeight() != Input.GetHeight() || Output.GetFormat() != Input.GetFormat() )
+	{
+		if ( !Output.Init( Input.GetWidth(), Input.GetHeight(), Input.GetFormat() ) )
+			return false;
+	}
+
+	//	remap straight into the output pixels
+	cv::Mat Source = GetMat( Input );
+	cv::Mat Destination = GetMat( Output );
+	
+	try
+	{
+		TRemapRows Remap( Source, Destination, Map );
+		static int RowsPerStripe = 32;
+		cv::parallel_for_( cv::Range( 0, Destination.rows ), Remap, Destination.rows / static_cast<double>(RowsPerStripe) );
+	}
+	catch ( cv::Exception& Exception )
+	{
+		std::stringstream Error;
+		Error << "Undistort exception: " << Exception.what();
+		throw Soy::AssertException( Error.str() );
+	}
+	
+	return true;
+}
+
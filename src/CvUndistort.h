@@ -0,0 +1,56 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <SoyPixels.h>
+#include <mutex>
+#include <map>
+#include <tuple>
+#include "CvCalibrateCamera.h"
+
+
+namespace Opencv
+{
+	class TUndistortMap;
+	class TUndistortMapCache;
+
+	//	Output is re-allocated to match Input if needed
+	bool	Undistort(SoyPixels& Output,const SoyPixels& Input,const TUndistortMap& Map);
+};
+
+
+//	remap tables for one camera at one resolution. Built once with initUndistortRectifyMap
+//	and stored in fixed-point form so each frame is just a remap
+class Opencv::TUndistortMap
+{
+public:
+	TUndistortMap(const Soy::TCamera& Camera,int Width,int Height);
+	
+	bool		IsValid(int Width,int Height) const	{	return mMapXy.cols == Width && mMapXy.rows == Height;	}
+	
+public:
+	cv::Mat		mMapXy;			//	CV_16SC2 integer source coords
+	cv::Mat		mMapInterp;		//	CV_16UC1 sub-pixel interpolation table indexes
+};
+
+
+//	maps are keyed by camera name, the camera's generation (bumped each time it's registered) & resolution.
+//	Re-registering a camera must Invalidate it. A job still holding an older camera gets a map built from it,
+//	but that isn't cached, so it can't be returned for the new camera
+class Opencv::TUndistortMapCache
+{
+public:
+	std::shared_ptr<TUndistortMap>	GetMap(const std::string& CameraName,uint64 Generation,const Soy::TCamera& Camera,int Width,int Height);
+	void							Invalidate(const std::string& CameraName,uint64 Generation);
+	
+private:
+	typedef std::tuple<std::string,uint64,int,int>	TKey;
+	
+	//	newest generation seen of each camera. Call with mLock held
+	bool							IsLatestGeneration(const std::string& CameraName,uint64 Generation);
+	
+public:
+	std::mutex													mLock;
+	std::map<TKey,std::shared_ptr<TUndistortMap>>				mMaps;
+	std::map<std::string,uint64>								mGenerations;
+};
+
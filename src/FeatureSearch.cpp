@@ -0,0 +1,508 @@
+#include "FeatureSearch.h"
+#include "TFeatureBits.h"
+#include <SoyString.h>
+#include <algorithm>
+#include <unordered_map>
+
+
+
+namespace FeatureSearch
+{
+	//	first grid line at or after Min. The grid stays aligned to the image origin so
+	//	a region returns the same coords as a whole-image search would
+	int		GetGridStart(int Min,int Step);
+	
+	//	region bounds within Clip. False if there's nothing to search
+	bool	GetClippedBounds(TRect& Bounds,const TRegion& Region,const TRect& Clip,int ImageWidth,int ImageHeight);
+}
+
+
+int FeatureSearch::GetGridStart(int Min,int Step)
+{
+	return ( (Min + Step - 1) / Step ) * Step;
+}
+
+
+bool FeatureSearch::GetClippedBounds(TRect& Bounds,const TRegion& Region,const TRect& Clip,int ImageWidth,int ImageHeight)
+{
+	if ( !Region.GetBounds( Bounds, ImageWidth, ImageHeight ) )
+		return false;
+	
+	int MinX = std::max( Bounds.x, Clip.x );
+	int MinY = std::max( Bounds.y, Clip.y );
+	int MaxX = std::min( Bounds.x + Bounds.w, Clip.x + Clip.w );
+	int MaxY = std::min( Bounds.y + Bounds.h, Clip.y + Clip.h );
+	if ( MaxX <= MinX || MaxY <= MinY )
+		return false;
+	Bounds = TRect( MinX, MinY, MaxX-MinX, MaxY-MinY );
+	return true;
+}
+
+
+bool FeatureSearch::TMask::IsSet(int x,int y,int ImageWidth,int ImageHeight) const
+{
+	if ( !IsValid() || x < 0 || y < 0 || x >= ImageWidth || y >= ImageHeight )
+		return false;
+	
+	int mx = static_cast<int>( (static_cast<int64>(x) * mWidth) / ImageWidth );
+	int my = static_cast<int>( (static_cast<int64>(y) * mHeight) / ImageHeight );
+	return mPixels[ my*mWidth + mx ] != 0;
+}
+
+
+void FeatureSearch::TMaskCache::Set(const std::string& Id,std::shared_ptr<TMask> Mask)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Existing = mIndex.find( Id );
+	if ( Existing != mIndex.end() )
+	{
+		mMasks.erase( Existing->second );
+		mIndex.erase( Existing );
+	}
+	
+	mMasks.push_front( std::make_pair( Id, Mask ) );
+	mIndex[Id] = mMasks.begin();
+	while ( mMasks.size() > mMaxMasks )
+	{
+		mIndex.erase( mMasks.back().first );
+		mMasks.pop_back();
+	}
+}
+
+
+std::shared_ptr<FeatureSearch::TMask> FeatureSearch::TMaskCache::Get(const std::string& Id)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Existing = mIndex.find( Id );
+	if ( Existing == mIndex.end() )
+		return nullptr;
+	
+	//	move to the front
+	mMasks.splice( mMasks.begin(), mMasks, Existing->second );
+	return Existing->second->second;
+}
+
+
+bool FeatureSearch::TRegion::Contains(int x,int y,int ImageWidth,int ImageHeight) const
+{
+	if ( x < 0 || y < 0 || x >= ImageWidth || y >= ImageHeight )
+		return false;
+	
+	if ( !mRects.empty() )
+	{
+		bool InRect = false;
+		for ( auto& Rect : mRects )
+			InRect |= Rect.Contains( x, y );
+		if ( !InRect )
+			return false;
+	}
+	
+	if ( mMask && !mMask->IsSet( x, y, ImageWidth, ImageHeight ) )
+		return false;
+	
+	return true;
+}
+
+
+bool FeatureSearch::TRegion::GetBounds(TRect& Bounds,int ImageWidth,int ImageHeight) const
+{
+	if ( mRects.empty() )
+	{
+		Bounds = TRect( 0, 0, ImageWidth, ImageHeight );
+		return ImageWidth > 0 && ImageHeight > 0;
+	}
+	
+	int MinX = ImageWidth;
+	int MinY = ImageHeight;
+	int MaxX = 0;
+	int MaxY = 0;
+	for ( auto& Rect : mRects )
+	{
+		MinX = std::min( MinX, std::max( 0, Rect.x ) );
+		MinY = std::min( MinY, std::max( 0, Rect.y ) );
+		MaxX = std::max( MaxX, std::min( ImageWidth, Rect.x + Rect.w ) );
+		MaxY = std::max( MaxY, std::min( ImageHeight, Rect.y + Rect.h ) );
+	}
+	Bounds = TRect( MinX, MinY, MaxX-MinX, MaxY-MinY );
+	return Bounds.w > 0 && Bounds.h > 0;
+}
+
+
+void FeatureSearch::GetGridFeatures(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TRegion& Region,std::stringstream& Error)
+{
+	TRect Clip( 0, 0, Image.GetWidth(), Image.GetHeight() );
+	GetGridFeatures( std::move(Features), Image, Params, Region, Clip, Error );
+}
+
+
+void FeatureSearch::GetGridFeatures(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TRegion& Region,const TRect& Clip,std::stringstream& Error)
+{
+	TRect Bounds;
+	if ( !GetClippedBounds( Bounds, Region, Clip, Image.GetWidth(), Image.GetHeight() ) )
+		return;
+	
+	Features.Reserve( (Bounds.h/Params.mMatchStepY + 1) * (Bounds.w/Params.mMatchStepX + 1) );
+	for ( int y=GetGridStart(Bounds.y,Params.mMatchStepY);	y<Bounds.y+Bounds.h;	y+=Params.mMatchStepY )
+	{
+		for ( int x=GetGridStart(Bounds.x,Params.mMatchStepX);	x<Bounds.x+Bounds.w;	x+=Params.mMatchStepX )
+		{
+			if ( !Region.IsWholeImage() && !Region.Contains( x, y, Image.GetWidth(), Image.GetHeight() ) )
+				continue;
+			
+			TFeatureBinRing Feature;
+			TFeatureExtractor::GetFeature( Feature, Image, x, y, Params, Error );
+			//	tellp rather than str() which copies the buffer every sample
+			if ( Error.tellp() > 0 )
+				return;
+			auto& Match = Features.PushBack();
+			Match.mSourceCoord = vec2x<int>(-1,-1);
+			Match.mCoord.x = x;
+			Match.mCoord.y = y;
+			Match.mFeature = Feature;
+			Match.mScore = 0.f;	//	make interesting score
+		}
+	}
+}
+
+
+void FeatureSearch::GetGridFeatures(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TRegion& Region,std::chrono::steady_clock::time_point Deadline,std::chrono::nanoseconds ReservePerFeature,float& Coverage,std::stringstream& Error)
+{
+	Coverage = 0.f;
+	TRect Bounds;
+	if ( !Region.GetBounds( Bounds, Image.GetWidth(), Image.GetHeight() ) )
+		return;
+	
+	//	work in grid cells so each pass is a stride over the same lattice as the exhaustive search
+	int StepX = Params.mMatchStepX;
+	int StepY = Params.mMatchStepY;
+	int CellX0 = GetGridStart( Bounds.x, StepX ) / StepX;
+	int CellY0 = GetGridStart( Bounds.y, StepY ) / StepY;
+	int CellsWide = std::max( 0, (Bounds.x + Bounds.w - 1) / StepX - CellX0 + 1 );
+	int CellsHigh = std::max( 0, (Bounds.y + Bounds.h - 1) / StepY - CellY0 + 1 );
+	auto InRegion = [&](int cx,int cy)
+	{
+		return Region.IsWholeImage() || Region.Contains( (CellX0+cx)*StepX, (CellY0+cy)*StepY, Image.GetWidth(), Image.GetHeight() );
+	};
+	
+	int TotalCells = 0;
+	if ( Region.IsWholeImage() )
+	{
+		TotalCells = CellsWide * CellsHigh;
+	}
+	else
+	{
+		for ( int cy=0;	cy<CellsHigh;	cy++ )
+			for ( int cx=0;	cx<CellsWide;	cx++ )
+				TotalCells += InRegion( cx, cy ) ? 1 : 0;
+	}
+	if ( TotalCells == 0 )
+		return;
+	
+	//	coarsest pass is every 8th cell, then each finer pass only visits the cells the previous passes skipped
+	static int CoarsestStride = 8;
+	static int DeadlineCheckInterval = 16;
+	int Extracted = 0;
+	int SinceCheck = 0;
+	bool Expired = false;
+	Features.Reserve( TotalCells );
+	for ( int Stride=CoarsestStride;	Stride>=1 && !Expired;	Stride/=2 )
+	{
+		for ( int cy=0;	cy<CellsHigh && !Expired;	cy+=Stride )
+		{
+			for ( int cx=0;	cx<CellsWide;	cx+=Stride )
+			{
+				bool DoneInCoarserPass = Stride < CoarsestStride && (cx % (Stride*2)) == 0 && (cy % (Stride*2)) == 0;
+				if ( DoneInCoarserPass || !InRegion( cx, cy ) )
+					continue;
+				
+				if ( ++SinceCheck >= DeadlineCheckInterval )
+				{
+					SinceCheck = 0;
+					if ( std::chrono::steady_clock::now() + ReservePerFeature * Extracted >= Deadline )
+					{
+						Expired = true;
+						break;
+					}
+				}
+				
+				int x = (CellX0+cx) * StepX;
+				int y = (CellY0+cy) * StepY;
+				TFeatureBinRing Feature;
+				TFeatureExtractor::GetFeature( Feature, Image, x, y, Params, Error );
+				if ( Error.tellp() > 0 )
+					return;
+				auto& Match = Features.PushBack();
+				Match.mSourceCoord = vec2x<int>(-1,-1);
+				Match.mCoord.x = x;
+				Match.mCoord.y = y;
+				Match.mFeature = Feature;
+				Match.mScore = 0.f;	//	make interesting score
+				Extracted++;
+			}
+		}
+	}
+	Coverage = Extracted / static_cast<float>( TotalCells );
+}
+
+
+void FeatureSearch::FindFeatureMatches(std::vector<Array<TFeatureMatch>>& Matches,const SoyPixels& Image,const ArrayBridge<TFeatureBinRing>& Features,const TFeatureBinRingParams& Params,float MinScore,const TRegion& Region,std::stringstream& Error)
+{
+	TRect Clip( 0, 0, Image.GetWidth(), Image.GetHeight() );
+	FindFeatureMatches( Matches, Image, Features, Params, MinScore, Region, Clip, Error );
+}
+
+
+void FeatureSearch::FindFeatureMatches(std::vector<Array<TFeatureMatch>>& Matches,const SoyPixels& Image,const ArrayBridge<TFeatureBinRing>& Features,const TFeatureBinRingParams& Params,float MinScore,const TRegion& Region,const TRect& Clip,std::stringstream& Error)
+{
+	Matches.clear();
+	Matches.resize( Features.GetSize() );
+	
+	//	pack the descriptors we're searching for once, into one contiguous buffer for the matching kernel
+	TFeatureBitsBuffer FeatureBits;
+	for ( int f=0;	f<Features.GetSize();	f++ )
+	{
+		TFeatureBits Bits;
+		if ( !FeatureBits::Pack( Bits, Features[f] ) )
+		{
+			Error << "Failed to pack feature " << f;
+			return;
+		}
+		FeatureBits.PushBack( Bits );
+	}
+	std::vector<int> Distances( FeatureBits.GetSize() );
+	
+	TRect Bounds;
+	if ( !GetClippedBounds( Bounds, Region, Clip, Image.GetWidth(), Image.GetHeight() ) )
+		return;
+	
+	for ( int y=GetGridStart(Bounds.y,Params.mMatchStepY);	y<Bounds.y+Bounds.h;	y+=Params.mMatchStepY )
+	{
+		for ( int x=GetGridStart(Bounds.x,Params.mMatchStepX);	x<Bounds.x+Bounds.w;	x+=Params.mMatchStepX )
+		{
+			if ( !Region.IsWholeImage() && !Region.Contains( x, y, Image.GetWidth(), Image.GetHeight() ) )
+				continue;
+			
+			TFeatureBinRing Feature;
+			TFeatureExtractor::GetFeature( Feature, Image, x, y, Params, Error );
+			if ( Error.tellp() > 0 )
+				return;
+			
+			TFeatureBits Bits;
+			if ( !FeatureBits::Pack( Bits, Feature ) )
+				continue;
+			
+			FeatureBits::GetHammingDistances( Distances.data(), Bits, FeatureBits );
+			for ( int f=0;	f<Distances.size();	f++ )
+			{
+				float Score = FeatureBits::GetMatchScore( Distances[f], Bits.mBitCount, FeatureBits.mBitCounts[f] );
+				if ( Score < MinScore )
+					continue;
+				
+				auto& Match = Matches[f].PushBack();
+				Match.mSourceCoord = vec2x<int>(-1,-1);
+				Match.mSourceFeature = Features[f];
+				Match.mCoord.x = x;
+				Match.mCoord.y = y;
+				Match.mFeature = Feature;
+				Match.mScore = Score;
+			}
+		}
+	}
+}
+
+
+void FeatureSearch::GetTiles(std::vector<TRect>& Tiles,const TRegion& Region,int TileSize,int ImageWidth,int ImageHeight)
+{
+	TRect Bounds;
+	if ( TileSize <= 0 || !Region.GetBounds( Bounds, ImageWidth, ImageHeight ) )
+		return;
+	
+	//	tiles are aligned to the image, not the region, so the same region always gives the same tiles
+	for ( int y=(Bounds.y/TileSize)*TileSize;	y<Bounds.y+Bounds.h;	y+=TileSize )
+	{
+		for ( int x=(Bounds.x/TileSize)*TileSize;	x<Bounds.x+Bounds.w;	x+=TileSize )
+		{
+			TRect Tile( x, y, std::min( TileSize, ImageWidth-x ), std::min( TileSize, ImageHeight-y ) );
+			
+			//	skip the gaps between rects
+			bool Overlaps = Region.mRects.empty();
+			for ( auto& Rect : Region.mRects )
+				Overlaps |= Rect.x < Tile.x+Tile.w && Tile.x < Rect.x+Rect.w && Rect.y < Tile.y+Tile.h && Tile.y < Rect.y+Rect.h;
+			if ( Overlaps )
+				Tiles.push_back( Tile );
+		}
+	}
+}
+
+
+void FeatureSearch::SuppressNonMaxima(ArrayBridge<TFeatureMatch>&& Features,int NmsRadius,int MaxFeatures)
+{
+	auto Count = static_cast<int>( Features.GetSize() );
+	if ( Count == 0 )
+		return;
+	
+	//	higher score wins, ties go to the earlier feature so results are deterministic
+	auto Better = [&Features](int a,int b)
+	{
+		auto ScoreA = Features[a].mScore;
+		auto ScoreB = Features[b].mScore;
+		return ScoreA > ScoreB || ( ScoreA == ScoreB && a < b );
+	};
+	
+	//	best first
+	std::vector<int> Kept;
+	Kept.reserve( Count );
+	
+	if ( NmsRadius > 0 )
+	{
+		std::vector<int> Order( Count );
+		for ( int f=0;	f<Count;	f++ )
+			Order[f] = f;
+		std::sort( Order.begin(), Order.end(), Better );
+		
+		//	greedy; a feature survives if no better survivor is within the radius. Survivors are bucketed into
+		//	radius sized cells so only the 3x3 cells around a feature need checking. Hashed, so memory is
+		//	by feature count however small the radius or big the image
+		auto GetCell = [NmsRadius](int x)
+		{
+			return ( x >= 0 ) ? x / NmsRadius : -( (-x + NmsRadius - 1) / NmsRadius );
+		};
+		auto GetCellKey = [](int cx,int cy)
+		{
+			return ( static_cast<int64>( cy ) << 32 ) ^ static_cast<uint32>( cx );
+		};
+		std::unordered_map<int64,std::vector<int>> Cells;
+		Cells.reserve( Count );
+		int RadiusSq = NmsRadius * NmsRadius;
+		for ( auto f : Order )
+		{
+			auto& Coord = Features[f].mCoord;
+			int cx = GetCell( Coord.x );
+			int cy = GetCell( Coord.y );
+			bool Suppressed = false;
+			for ( int ny=cy-1;	ny<=cy+1 && !Suppressed;	ny++ )
+			{
+				for ( int nx=cx-1;	nx<=cx+1 && !Suppressed;	nx++ )
+				{
+					auto Cell = Cells.find( GetCellKey( nx, ny ) );
+					if ( Cell == Cells.end() )
+						continue;
+					for ( auto n : Cell->second )
+					{
+						auto& NeighbourCoord = Features[n].mCoord;
+						int dx = NeighbourCoord.x - Coord.x;
+						int dy = NeighbourCoord.y - Coord.y;
+						if ( dx*dx + dy*dy <= RadiusSq )
+						{
+							Suppressed = true;
+							break;
+						}
+					}
+				}
+			}
+			if ( Suppressed )
+				continue;
+			Cells[ GetCellKey( cx, cy ) ].push_back( f );
+			Kept.push_back( f );
+		}
+		
+		//	already best first
+		if ( MaxFeatures > 0 && Kept.size() > MaxFeatures )
+			Kept.resize( MaxFeatures );
+	}
+	else
+	{
+		for ( int f=0;	f<Count;	f++ )
+			Kept.push_back( f );
+		
+		//	partial selection of the best, no full sort
+		if ( MaxFeatures > 0 && Kept.size() > MaxFeatures )
+		{
+			std::nth_element( Kept.begin(), Kept.begin() + MaxFeatures, Kept.end(), Better );
+			Kept.resize( MaxFeatures );
+		}
+	}
+	
+	if ( Kept.size() == Count )
+		return;
+	
+	//	keep scan order
+	std::sort( Kept.begin(), Kept.end() );
+	std::vector<TFeatureMatch> Survivors;
+	Survivors.reserve( Kept.size() );
+	for ( auto f : Kept )
+		Survivors.push_back( Features[f] );
+	
+	Features.Clear(false);
+	for ( auto& Survivor : Survivors )
+		Features.PushBack( Survivor );
+}
+
+
+bool FeatureSearch::ParseFeatures(ArrayBridge<TFeatureBinRing>&& Features,const std::string& FeaturesString,std::stringstream& Error)
+{
+	std::stringstream ParseError;
+	auto AppendFeature = [&ParseError,&Features](const std::string& FeatureString)
+	{
+		TFeatureBinRing Feature;
+		if ( !Soy::StringToType( Feature, FeatureString ) )
+		{
+			ParseError << "Failed to parse \"" << FeatureString << "\" to feature";
+			return false;
+		}
+		Features.PushBack( Feature );
+		return true;
+	};
+	if ( !Soy::StringSplitByMatches( AppendFeature, FeaturesString, ",", false ) )
+	{
+		Error << "failed to parse features; " << ParseError.str() << Soy::lf;
+		return false;
+	}
+	if ( Features.IsEmpty() )
+	{
+		Error << "no features" << Soy::lf;
+		return false;
+	}
+	return true;
+}
+
+
+
+bool FeatureSearch::ParseRects(TRegion& Region,const std::string& RectsString,std::stringstream& Error)
+{
+	std::vector<int> Values;
+	std::stringstream ParseError;
+	auto AppendValue = [&ParseError,&Values](const std::string& ValueString)
+	{
+		int Value;
+		if ( !Soy::StringToType( Value, ValueString ) )
+		{
+			ParseError << "Failed to parse \"" << ValueString << "\" to int";
+			return false;
+		}
+		Values.push_back( Value );
+		return true;
+	};
+	if ( !Soy::StringSplitByMatches( AppendValue, RectsString, ",", false ) )
+	{
+		Error << "failed to parse roi; " << ParseError.str() << Soy::lf;
+		return false;
+	}
+	if ( Values.empty() || Values.size() % 4 != 0 )
+	{
+		Error << "roi expects x,y,w,h for each rect, got " << Values.size() << " values" << Soy::lf;
+		return false;
+	}
+	
+	for ( int i=0;	i<Values.size();	i+=4 )
+	{
+		TRect Rect( Values[i+0], Values[i+1], Values[i+2], Values[i+3] );
+		if ( Rect.w <= 0 || Rect.h <= 0 )
+		{
+			Error << "roi rect " << (i/4) << " has no area" << Soy::lf;
+			return false;
+		}
+		Region.mRects.push_back( Rect );
+	}
+	return true;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <SoyPixels.h>
+#include <TFeatureBinRing.h>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+namespace FeatureSearch
+{
+	class TRect;
+	class TMask;
+	class TMaskCache;
+	class TRegion;
+	
+	//	a feature at every step of the grid inside the region. Scores are zero, coords are in image space
+	void	GetGridFeatures(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TRegion& Region,std::stringstream& Error);
+	
+	//	as GetGridFeatures, but only the grid positions inside Clip
+	void	GetGridFeatures(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TRegion& Region,const TRect& Clip,std::stringstream& Error);
+	
+	//	as GetGridFeatures, but coarse-to-fine; a sparse grid first, then the interleaved positions between,
+	//	stopping when what's left until the deadline is only enough for the caller's ReservePerFeature for each
+	//	feature extracted so far. Coverage is the fraction of grid positions in the region that were extracted
+	void	GetGridFeatures(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const TRegion& Region,std::chrono::steady_clock::time_point Deadline,std::chrono::nanoseconds ReservePerFeature,float& Coverage,std::stringstream& Error);
+	
+	//	extract a feature once at each grid position inside the region and test it against every descriptor.
+	//	Matches[n] are the matches for Features[n]. Scored with FeatureBits::GetMatchScore, so scores (and what
+	//	passes MinScore) differ from TFeatureExtractor::FindFeatureMatches for the same descriptor
+	void	FindFeatureMatches(std::vector<Array<TFeatureMatch>>& Matches,const SoyPixels& Image,const ArrayBridge<TFeatureBinRing>& Features,const TFeatureBinRingParams& Params,float MinScore,const TRegion& Region,std::stringstream& Error);
+	
+	//	as FindFeatureMatches, but only the grid positions inside Clip
+	void	FindFeatureMatches(std::vector<Array<TFeatureMatch>>& Matches,const SoyPixels& Image,const ArrayBridge<TFeatureBinRing>& Features,const TFeatureBinRingParams& Params,float MinScore,const TRegion& Region,const TRect& Clip,std::stringstream& Error);
+	
+	//	square tiles covering the region, row by row, for processing a frame a piece at a time
+	void	GetTiles(std::vector<TRect>& Tiles,const TRegion& Region,int TileSize,int ImageWidth,int ImageHeight);
+	
+	//	keep only features with no better scoring feature within NmsRadius, then the best MaxFeatures of those.
+	//	Order of the survivors is preserved. Zero disables either step
+	void	SuppressNonMaxima(ArrayBridge<TFeatureMatch>&& Features,int NmsRadius,int MaxFeatures);
+	
+	//	comma separated list of features
+	bool	ParseFeatures(ArrayBridge<TFeatureBinRing>&& Features,const std::string& FeaturesString,std::stringstream& Error);
+	
+	//	x,y,w,h[,x,y,w,h...] rectangles, appended to the region
+	bool	ParseRects(TRegion& Region,const std::string& RectsString,std::stringstream& Error);
+};
+
+
+class FeatureSearch::TRect
+{
+public:
+	TRect(int x=0,int y=0,int w=0,int h=0) :
+		x	( x ),
+		y	( y ),
+		w	( w ),
+		h	( h )
+	{
+	}
+	
+	bool	Contains(int px,int py) const	{	return px >= x && py >= y && px < x+w && py < y+h;	}
+	
+public:
+	int		x;
+	int		y;
+	int		w;
+	int		h;
+};
+
+
+//	8 bit mask, non-zero is searched. Sampled in normalised image space, so the mask
+//	can be lower resolution than the frames it's applied to
+class FeatureSearch::TMask
+{
+public:
+	TMask() :
+		mWidth	( 0 ),
+		mHeight	( 0 )
+	{
+	}
+	
+	bool	IsValid() const	{	return mWidth > 0 && mHeight > 0;	}
+	bool	IsSet(int x,int y,int ImageWidth,int ImageHeight) const;
+	
+public:
+	int					mWidth;
+	int					mHeight;
+	std::vector<uint8>	mPixels;
+};
+
+
+//	the parts of a frame to process; the union of the rects (or the whole frame if none) and'd with the mask
+class FeatureSearch::TRegion
+{
+public:
+	bool	IsWholeImage() const	{	return mRects.empty() && !mMask;	}
+	bool	Contains(int x,int y,int ImageWidth,int ImageHeight) const;
+	
+	//	inclusive-exclusive bounding box of the rects, clipped to the image. False if nothing is inside the image
+	bool	GetBounds(TRect& Bounds,int ImageWidth,int ImageHeight) const;
+	
+public:
+	std::vector<TRect>			mRects;
+	std::shared_ptr<TMask>		mMask;
+};
+
+
+//	masks sent once with maskid= and re-used by id. Least recently used masks are dropped past mMaxMasks so
+//	clients making a new id per frame can't grow it forever
+class FeatureSearch::TMaskCache
+{
+public:
+	TMaskCache(size_t MaxMasks=32) :
+		mMaxMasks	( MaxMasks )
+	{
+	}
+	
+	void					Set(const std::string& Id,std::shared_ptr<TMask> Mask);
+	//	null if it was never sent or has been dropped
+	std::shared_ptr<TMask>	Get(const std::string& Id);
+	
+private:
+	typedef std::list<std::pair<std::string,std::shared_ptr<TMask>>>	TMaskList;
+	
+	size_t									mMaxMasks;
+	std::mutex								mLock;
+	TMaskList								mMasks;		//	most recently used first
+	std::map<std::string,TMaskList::iterator>	mIndex;
+};
@@ -11,50 +11,128 @@
 #include <TFeatureBinRing.h>
 #include <SortArray.h>
 #include <TChannelFile.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <sys/stat.h>
 #include "CvCalibrateCamera.h"
+#include "CvUndistort.h"
+#include "TJobArena.h"
+#include "FeatureSearch.h"
+#include "CvPixels.h"
 
 
 
 
 TPopOpencv::TPopOpencv() :
-	TJobHandler		( static_cast<TChannelManager&>(*this) ),
-	TPopJobHandler	( static_cast<TJobHandler&>(*this) )
+	TJobHandler			( static_cast<TChannelManager&>(*this) ),
+	TPopJobHandler		( static_cast<TJobHandler&>(*this) ),
+	mScoreNsPerFeature	( 2000 )
 {
-	AddJobHandler("exit", TParameterTraits(), *this, &TPopOpencv::OnExit );
+	AddJob( "exit", TParameterTraits(), &TPopOpencv::OnExit );
 	
-	AddJobHandler("newframe", TParameterTraits(), *this, &TPopOpencv::OnNewFrame );
-	AddJobHandler("re:getframe", TParameterTraits(), *this, &TPopOpencv::OnNewFrame );
+	AddJob( "newframe", TParameterTraits(), &TPopOpencv::OnNewFrame );
+	AddJob( "re:getframe", TParameterTraits(), &TPopOpencv::OnNewFrame );
 	
 	TParameterTraits GetFeatureTraits;
 	GetFeatureTraits.mAssumedKeys.PushBack("x");
 	GetFeatureTraits.mAssumedKeys.PushBack("y");
 	GetFeatureTraits.mRequiredKeys.PushBack("image");
-	AddJobHandler("getfeature", GetFeatureTraits, *this, &TPopOpencv::OnGetFeature );
+	AddJob( "getfeature", GetFeatureTraits, &TPopOpencv::OnGetFeature );
 
 	TParameterTraits FindFeatureTraits;
 	FindFeatureTraits.mAssumedKeys.PushBack("feature");
 	FindFeatureTraits.mRequiredKeys.PushBack("image");
-	AddJobHandler("findfeature", FindFeatureTraits, *this, &TPopOpencv::OnFindFeature );
+	AddJob( "findfeature", FindFeatureTraits, &TPopOpencv::OnFindFeature );
 	
 	TParameterTraits TrackFeaturesTraits;
 	TrackFeaturesTraits.mAssumedKeys.PushBack("sourcefeatures");
 	//TrackFeaturesTraits.mRequiredKeys.PushBack("image");
-	AddJobHandler("trackfeatures", TrackFeaturesTraits, *this, &TPopOpencv::OnTrackFeatures );
+	AddJob( "trackfeatures", TrackFeaturesTraits, &TPopOpencv::OnTrackFeatures );
 	
 	TParameterTraits FindInterestingFeaturesTraits;
 	//FindInterestingFeaturesTraits.mRequiredKeys.PushBack("image");
-	AddJobHandler("findinterestingfeatures", FindInterestingFeaturesTraits, *this, &TPopOpencv::OnFindInterestingFeatures );
+	AddJob( "findinterestingfeatures", FindInterestingFeaturesTraits, &TPopOpencv::OnFindInterestingFeatures );
 
 	
 	TParameterTraits CalibrateCameraTraits;
 	CalibrateCameraTraits.mRequiredKeys.PushBack("points2D");
 	CalibrateCameraTraits.mRequiredKeys.PushBack("points3D");
-	AddJobHandler("calibratecamera", CalibrateCameraTraits, *this, &TPopOpencv::OnCalibrateCamera );
+	AddJob( "calibratecamera", CalibrateCameraTraits, &TPopOpencv::OnCalibrateCamera );
 	
 	TParameterTraits GetHomographyTraits;
 	GetHomographyTraits.mRequiredKeys.PushBack("points2D");
 	GetHomographyTraits.mRequiredKeys.PushBack("pointsuv");
-	AddJobHandler("gethomography", GetHomographyTraits, *this, &TPopOpencv::OnGetHomography );
+	AddJob( "gethomography", GetHomographyTraits, &TPopOpencv::OnGetHomography );
+	
+	TParameterTraits UndistortFrameTraits;
+	UndistortFrameTraits.mRequiredKeys.PushBack("image");
+	UndistortFrameTraits.mRequiredKeys.PushBack("camera");
+	AddJob( "undistortframe", UndistortFrameTraits, &TPopOpencv::OnUndistortFrame );
+	
+	TParameterTraits AddFeaturesTraits;
+	AddFeaturesTraits.mRequiredKeys.PushBack("database");
+	AddFeaturesTraits.mRequiredKeys.PushBack("features");
+	AddJob( "addfeatures", AddFeaturesTraits, &TPopOpencv::OnAddFeatures );
+	
+	TParameterTraits MatchDatabaseTraits;
+	MatchDatabaseTraits.mRequiredKeys.PushBack("database");
+	AddJob( "matchdatabase", MatchDatabaseTraits, &TPopOpencv::OnMatchDatabase );
+	
+	TParameterTraits SaveDatabaseTraits;
+	SaveDatabaseTraits.mRequiredKeys.PushBack("database");
+	SaveDatabaseTraits.mRequiredKeys.PushBack("filename");
+	AddJob( "savedatabase", SaveDatabaseTraits, &TPopOpencv::OnSaveDatabase );
+	
+	TParameterTraits LoadDatabaseTraits;
+	LoadDatabaseTraits.mRequiredKeys.PushBack("database");
+	LoadDatabaseTraits.mRequiredKeys.PushBack("filename");
+	AddJob( "loaddatabase", LoadDatabaseTraits, &TPopOpencv::OnLoadDatabase );
+	
+	TParameterTraits ProcessSequenceTraits;
+	ProcessSequenceTraits.mRequiredKeys.PushBack("input");
+	ProcessSequenceTraits.mRequiredKeys.PushBack("output");
+	AddJob( "processsequence", ProcessSequenceTraits, &TPopOpencv::OnProcessSequence );
+	
+	AddJob( "record", TParameterTraits(), &TPopOpencv::OnRecord );
+	
+	TParameterTraits ReplayTraits;
+	ReplayTraits.mRequiredKeys.PushBack("filename");
+	AddJob( "replay", ReplayTraits, &TPopOpencv::OnReplay );
+	
+	
+	AddJob( "opticalflow", TParameterTraits(), &TPopOpencv::OnOpticalFlow );
+	
+	TParameterTraits PipelineTraits;
+	PipelineTraits.mRequiredKeys.PushBack("stages");
+	AddJob( "pipeline", PipelineTraits, &TPopOpencv::OnPipeline );
+	mPipelineStages["findfeature"] = &TPopOpencv::PipelineFindFeature;
+	mPipelineStages["findinterestingfeatures"] = &TPopOpencv::PipelineFindInterestingFeatures;
+	mPipelineStages["opticalflow"] = &TPopOpencv::PipelineOpticalFlow;
+	mPipelineStages["gethomography"] = &TPopOpencv::PipelineGetHomography;
+	
+	TParameterTraits BatchTraits;
+	BatchTraits.mRequiredKeys.PushBack("jobs");
+	AddJob( "batch", BatchTraits, &TPopOpencv::OnBatch );
+	
+	AddJob( "storeframe", TParameterTraits(), &TPopOpencv::OnStoreFrame );
+	
+	TParameterTraits AddCalibrationViewTraits;
+	AddCalibrationViewTraits.mRequiredKeys.PushBack("session");
+	AddCalibrationViewTraits.mRequiredKeys.PushBack("points2D");
+	AddCalibrationViewTraits.mRequiredKeys.PushBack("points3D");
+	AddJob( "addcalibrationview", AddCalibrationViewTraits, &TPopOpencv::OnAddCalibrationView );
+	
+	TParameterTraits GetCalibrationTraits;
+	GetCalibrationTraits.mRequiredKeys.PushBack("session");
+	AddJob( "getcalibration", GetCalibrationTraits, &TPopOpencv::OnGetCalibration );
+	AddJob( "endcalibration", GetCalibrationTraits, &TPopOpencv::OnEndCalibration );
+}
+
+void TPopOpencv::AddJob(const std::string& Name,const TParameterTraits& Traits,TJobHandlerFunc Handler)
+{
+	AddJobHandler( Name, Traits, *this, Handler );
+	mJobHandlers[Name] = Handler;
 }
 
 bool TPopOpencv::AddChannel(std::shared_ptr<TChannel> Channel)
@@ -62,9 +140,35 @@ bool TPopOpencv::AddChannel(std::shared_ptr<TChannel> Channel)
 	if ( !TChannelManager::AddChannel( Channel ) )
 		return false;
 	TJobHandler::BindToChannel( *Channel );
+	
+	//	jobs from every channel are recorded when the recorder is on
+	auto RecordJob = [this](TJobAndChannel& JobAndChannel)
+	{
+		mJobRecorder.OnJob( JobAndChannel.GetJob() );
+	};
+	Channel->mOnJobRecieved.AddListener( RecordJob );
 	return true;
 }
 
+void TPopOpencv::SetSingleReplyChannel(TChannel& Channel)
+{
+	std::lock_guard<std::mutex> Lock( mSingleReplyChannelsLock );
+	mSingleReplyChannels.insert( &Channel );
+}
+
+void TPopOpencv::SendReply(TJobAndChannel& JobAndChannel,TJobReply& Reply)
+{
+	auto* Capture = TJobReplyCapture::Get();
+	if ( Capture )
+	{
+		Capture->OnReply( Reply );
+		return;
+	}
+	
+	TChannel& Channel = JobAndChannel;
+	Channel.OnJobCompleted( Reply );
+}
+
 
 void TPopOpencv::OnExit(TJobAndChannel& JobAndChannel)
 {
@@ -73,8 +177,7 @@ void TPopOpencv::OnExit(TJobAndChannel& JobAndChannel)
 	//	should probably still send a reply
 	TJobReply Reply( JobAndChannel );
 	Reply.mParams.AddDefaultParam(std::string("exiting..."));
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	SendReply( JobAndChannel, Reply );
 }
 
 
@@ -95,22 +198,21 @@ void TPopOpencv::OnGetFeature(TJobAndChannel& JobAndChannel)
 		TJobReply Reply( JobAndChannel );
 		Reply.mParams.AddErrorParam( Error.str() );
 		
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted( Reply );
+		SendReply( JobAndChannel, Reply );
 		return;
 	}
 	*/
 	
 	SoyPixels Image;
-	if ( !Job.mParams.GetParamAs("image",Image) )
+	std::stringstream ImageError;
+	if ( !GetImageParam( Image, Job.mParams, "image", ImageError ) )
 	{
 		std::stringstream Error;
-		Error << "Failed to decode image param";
+		Error << "Failed to decode image param: " << ImageError.str();
 		TJobReply Reply( JobAndChannel );
 		Reply.mParams.AddErrorParam( Error.str() );
 		
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted( Reply );
+		SendReply( JobAndChannel, Reply );
 		return;
 	}
 	
@@ -125,7 +227,14 @@ void TPopOpencv::OnGetFeature(TJobAndChannel& JobAndChannel)
 	std::stringstream Error;
 	TFeatureBinRingParams Params( Job.mParams );
 	TFeatureBinRing Feature;
-	TFeatureExtractor::GetFeature( Feature, Image, x, y, Params, Error );
+	FeatureSearch::TRegion Region;
+	if ( GetFeatureRegion( Region, Job.mParams, Error ) )
+	{
+		if ( Region.IsWholeImage() || Region.Contains( x, y, Image.GetWidth(), Image.GetHeight() ) )
+			TFeatureExtractor::GetFeature( Feature, Image, x, y, Params, Error );
+		else
+			Error << x << "," << y << " is outside the roi/mask";
+	}
 	
 	TJobReply Reply( JobAndChannel );
 	
@@ -137,34 +246,42 @@ void TPopOpencv::OnGetFeature(TJobAndChannel& JobAndChannel)
 	Reply.mParams.AddParam( PixelxParam );
 	Reply.mParams.AddParam( PixelyParam );
 	
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	
+	SendReply( JobAndChannel, Reply );
 }
 
 
 void ScoreInterestingFeatures(ArrayBridge<TFeatureMatch>&& Features,float MinScore)
 {
-	std::map<std::string,int> FeatureHistogram;		//	build a histogram to work out how unique the features are
+	//	histogram nodes and each feature's bucket live in the job arena
+	TJobArenaScope ArenaScope;
+	typedef std::map<std::string,int,std::less<std::string>,TJobArenaAllocator<std::pair<const std::string,int>>> THistogram;
+	THistogram FeatureHistogram;		//	build a histogram to work out how unique the features are
 	int HistogramMaxima = 0;
+	auto FeatureCount = Features.GetSize();
+	auto** FeatureBuckets = TJobArenaScope::GetArena().AllocArray<int*>( FeatureCount );
 
-	for ( int f=0;	f<Features.GetSize();	f++ )
+	//	one stream re-used for every feature
+	std::stringstream FeatureString;
+	for ( int f=0;	f<FeatureCount;	f++ )
 	{
 		auto& Feature = Features[f];
-		std::stringstream FeatureString;
+		FeatureString.str( std::string() );
 		FeatureString << Feature.mFeature;
-		auto& FeatureCount = FeatureHistogram[FeatureString.str()];
-		FeatureCount++;
-		HistogramMaxima = std::max( HistogramMaxima, FeatureCount );
+		auto& Count = FeatureHistogram[FeatureString.str()];
+		Count++;
+		HistogramMaxima = std::max( HistogramMaxima, Count );
+		FeatureBuckets[f] = &Count;
 	}
 	
 	//	now re-apply the feature's score based on their uniqueness in the histogram
-	for ( ssize_t f=Features.GetSize()-1;	f>=0;	f-- )
+	for ( ssize_t f=FeatureCount-1;	f>=0;	f-- )
 	{
 		auto& Feature = Features[f];
 		auto& Score = Feature.mScore;
-		std::stringstream FeatureString;
-		FeatureString << Feature.mFeature;
-		auto Occurrance = FeatureHistogram[FeatureString.str()];
+		auto Occurrance = *FeatureBuckets[f];
 		Score = 1.f - (Occurrance / static_cast<float>(HistogramMaxima));
 		
 		//	cull if score is too low
@@ -175,23 +292,38 @@ void ScoreInterestingFeatures(ArrayBridge<TFeatureMatch>&& Features,float MinSco
 	}
 }
 
+//	score by uniqueness, cull the uninteresting, then bound to one per neighbourhood and the best N overall
+void FilterInterestingFeatures(ArrayBridge<TFeatureMatch>&& Features,const TFeatureBinRingParams& Params,int NmsRadius,int MaxFeatures)
+{
+	//	do initial scoring to remove low-interest features
+	ScoreInterestingFeatures( std::move(Features), Params.mMinInterestingScore );
+	
+	//	re-score to normalise the score. (could probably do this faster, but this is simpler)
+	ScoreInterestingFeatures( std::move(Features), 0.f );
+	
+	FeatureSearch::SuppressNonMaxima( std::move(Features), NmsRadius, MaxFeatures );
+}
+
+
 void TPopOpencv::OnFindInterestingFeatures(TJobAndChannel& JobAndChannel)
 {
+	//	transient allocations are released when the job is done
+	TJobArenaScope ArenaScope;
+	auto JobStart = std::chrono::steady_clock::now();
 	auto& Job = JobAndChannel.GetJob();
 	
 	//	decode image now into a param so we can send back the one we used
 	std::shared_ptr<SoyData_Stack<SoyPixels>> ImageData( new SoyData_Stack<SoyPixels>() );
 	auto& Image = ImageData->mValue;
-	auto ImageParam = Job.mParams.GetParam( TJobParam::Param_Default );
-	if ( !ImageParam.Decode( *ImageData ) )
+	std::stringstream ImageError;
+	if ( !GetImageParam( Image, Job.mParams, TJobParam::Param_Default, ImageError ) )
 	{
 		std::stringstream Error;
-		Error << "Failed to decode image param (" << Image.GetFormat() << ")";
+		Error << "Failed to decode image param: " << ImageError.str();
 		TJobReply Reply( JobAndChannel );
 		Reply.mParams.AddErrorParam( Error.str() );
 		
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted( Reply );
+		SendReply( JobAndChannel, Reply );
 		return;
 	}
 	
@@ -201,49 +333,154 @@ void TPopOpencv::OnFindInterestingFeatures(TJobAndChannel& JobAndChannel)
 //	static int NewHeight = 200;
 //	Image.ResizeFastSample(NewWidth,NewHeight);
 
+	Opencv::TDetectorParams DetectorParams;
+	auto DetectorName = Job.mParams.GetParamAsWithDefault<std::string>("detector", std::string() );
+	if ( !Opencv::ToDetector( DetectorParams.mDetector, DetectorName ) )
+	{
+		std::stringstream Error;
+		Error << "Unknown detector \"" << DetectorName << "\"; expected grid, fast, orb or agast";
+		TJobReply Reply( JobAndChannel );
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
 	//	grab a feature at each point on a grid on the image
 	TFeatureBinRingParams Params( Job.mParams );
 	Array<TFeatureMatch> FeatureMatches;
-	FeatureMatches.Reserve( (Image.GetHeight()/Params.mMatchStepY) * (Image.GetWidth()/Params.mMatchStepX) );
 	std::stringstream Error;
-	for ( int y=0;	y<Image.GetHeight();	y+=Params.mMatchStepY )
+	FeatureSearch::TRegion Region;
+	int BudgetMs = Job.mParams.GetParamAsWithDefault("budgetms", 0 );
+	float Coverage = 1.f;
+	auto StreamName = Job.mParams.GetParamAsWithDefault<std::string>("stream", std::string() );
+	int StreamTileCount = 0;
+	int StreamTilesChanged = 0;
+	//	only the plain grid search is tiled; detectors, streams and budgets ignore progressive=, and then the reply
+	//	doesn't claim to be the end of a sequence of partials
+	bool Progressive = DetectorParams.mDetector == Opencv::Detector::Grid && StreamName.empty() && BudgetMs <= 0 && IsProgressive( JobAndChannel );
+	int PartialCount = 0;
+	int MaxFeatures = Job.mParams.GetParamAsWithDefault("maxfeatures", 0 );
+	int NmsRadius = Job.mParams.GetParamAsWithDefault("nmsradius", 0 );
+	cv::Mat OrbDescriptors;
+	if ( GetFeatureRegion( Region, Job.mParams, Error ) )
 	{
-		for ( int x=0;	x<Image.GetWidth();	x+=Params.mMatchStepX )
+		if ( DetectorParams.mDetector != Opencv::Detector::Grid )
 		{
-			TFeatureBinRing Feature;
-			TFeatureExtractor::GetFeature( Feature, Image, x, y, Params, Error );
-			if ( !Error.str().empty() )
-				break;
-			auto& Match = FeatureMatches.PushBack();
-			Match.mSourceCoord = vec2x<int>(-1,-1);
-			Match.mCoord.x = x;
-			Match.mCoord.y = y;
-			Match.mFeature = Feature;
-			Match.mScore = 0.f;	//	make interesting score
+			//	keypoints come scored by their corner response and already suppressed
+			DetectorParams.mFastThreshold = Job.mParams.GetParamAsWithDefault("fastthreshold", DetectorParams.mFastThreshold );
+			DetectorParams.mOrbFeatures = Job.mParams.GetParamAsWithDefault("orbfeatures", DetectorParams.mOrbFeatures );
+			DetectorParams.mNmsRadius = NmsRadius;
+			DetectorParams.mMaxFeatures = MaxFeatures;
+			Opencv::DetectFeatures( GetArrayBridge( FeatureMatches ), OrbDescriptors, Image, Params, DetectorParams, Region, Error );
+		}
+		else if ( !StreamName.empty() )
+		{
+			//	only tiles that changed since the stream's last frame are re-extracted. Streams are always complete, so no budget
+			auto Stream = GetFeatureStream( StreamName );
+			std::lock_guard<std::mutex> Lock( Stream->mLock );
+			if ( Job.mParams.GetParamAsWithDefault("reset", false ) )
+				Stream->Reset();
+			Stream->mTileSize = Job.mParams.GetParamAsWithDefault("tilesize", Stream->mTileSize );
+			Stream->mChangeThreshold = Job.mParams.GetParamAsWithDefault("tilethreshold", Stream->mChangeThreshold );
+			Stream->Update( GetArrayBridge( FeatureMatches ), Image, Params, Region, Error );
+			StreamTileCount = Stream->GetTileCount();
+			StreamTilesChanged = Stream->GetTilesChanged();
+			BudgetMs = 0;
+		}
+		else if ( BudgetMs > 0 )
+		{
+			//	budget is from when the job started, less a little for encoding the reply. Scoring is over every feature so
+			//	can't stop part way; extraction stops early enough to leave time to score what it found, at the cost per
+			//	feature scoring has taken on previous jobs
+			static float ScoredBudgetFraction = 0.9f;
+			auto Deadline = JobStart + std::chrono::microseconds( static_cast<int64>( BudgetMs * 1000 * ScoredBudgetFraction ) );
+			auto ScoreCost = std::chrono::nanoseconds( mScoreNsPerFeature.load() );
+			FeatureSearch::GetGridFeatures( GetArrayBridge( FeatureMatches ), Image, Params, Region, Deadline, ScoreCost, Coverage, Error );
+		}
+		else if ( Progressive )
+		{
+			//	interest is uniqueness across the frame, which we don't know yet, so partials are scored within their tile.
+			//	The final reply is scored over the whole frame as usual
+			std::vector<FeatureSearch::TRect> Tiles;
+			FeatureSearch::GetTiles( Tiles, Region, GetProgressiveTileSize( Job.mParams ), Image.GetWidth(), Image.GetHeight() );
+			Array<TFeatureMatch> TileMatches;
+			for ( auto& Tile : Tiles )
+			{
+				TileMatches.Clear(false);
+				FeatureSearch::GetGridFeatures( GetArrayBridge( TileMatches ), Image, Params, Region, Tile, Error );
+				if ( Error.tellp() > 0 )
+					break;
+				for ( int m=0;	m<TileMatches.GetSize();	m++ )
+					FeatureMatches.PushBack( TileMatches[m] );
+				
+				FilterInterestingFeatures( GetArrayBridge( TileMatches ), Params, NmsRadius, 0 );
+				TJobReply PartialReply( JobAndChannel );
+				AddFeatureMatchesParam( PartialReply, std::string(), TileMatches, false, JobAndChannel );
+				SendPartialReply( JobAndChannel, PartialReply, PartialCount++, Tile );
+			}
+		}
+		else
+		{
+			FeatureSearch::GetGridFeatures( GetArrayBridge( FeatureMatches ), Image, Params, Region, Error );
 		}
 	}
 	
-	//	do initial scoring to remove low-interest features
-	ScoreInterestingFeatures( GetArrayBridge( FeatureMatches ), Params.mMinInterestingScore );
-
-	//	re-score to normalise the score. (could probably do this faster, but this is simpler)
-	ScoreInterestingFeatures( GetArrayBridge( FeatureMatches ), 0.f );
+	if ( DetectorParams.mDetector == Opencv::Detector::Grid )
+	{
+		auto ScoreStart = std::chrono::steady_clock::now();
+		auto ScoredCount = static_cast<int>( FeatureMatches.GetSize() );
+		FilterInterestingFeatures( GetArrayBridge( FeatureMatches ), Params, NmsRadius, MaxFeatures );
+		
+		//	a moving average for budgeted jobs to reserve; small sets are mostly overhead so don't count
+		static int MinScoredForCost = 256;
+		if ( ScoredCount >= MinScoredForCost )
+		{
+			auto ScoreNs = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - ScoreStart ).count();
+			auto NsPerFeature = static_cast<int>( ScoreNs / ScoredCount );
+			mScoreNsPerFeature.store( ( mScoreNsPerFeature.load() * 3 + NsPerFeature ) / 4 );
+		}
+	}
 	
 	//	some some params back with the reply
 	TJobReply Reply( JobAndChannel );
 	
+	if ( DetectorParams.mDetector != Opencv::Detector::Grid )
+	{
+		Reply.mParams.AddParam("detector", Opencv::ToString( DetectorParams.mDetector ) );
+		
+		//	a row of descriptor bytes per feature, in the same order
+		if ( !OrbDescriptors.empty() )
+		{
+			std::shared_ptr<SoyData_Stack<Array<char>>> DescriptorData( new SoyData_Stack<Array<char>>() );
+			auto DescriptorSize = OrbDescriptors.total() * OrbDescriptors.elemSize();
+			memcpy( DescriptorData->mValue.PushBlock( DescriptorSize ), OrbDescriptors.data, DescriptorSize );
+			Reply.mParams.AddParam("orbdescriptors", CompressPayload( Reply, "orbdescriptors", DescriptorData, JobAndChannel ) );
+		}
+	}
+	
 	//	gr: repalce with desired format/container
+	bool AsDictionary = Job.mParams.GetParamAsWithDefault("asdictionary", false );
 	bool AsJson = Job.mParams.GetParamAsWithDefault("asjson", false );
 	bool AsBinary = Job.mParams.GetParamAsWithDefault("asbinary", false );
 	
+	if ( AsDictionary )
+	{
+		auto DictionaryData = mReplyBuffers.GetBuffer();
+		if ( FeatureDictionary::Encode( GetArrayBridge( DictionaryData->mValue ), FeatureMatches, false, Error ) )
+		{
+			Reply.mParams.AddDefaultParam( CompressPayload( Reply, std::string(), DictionaryData, JobAndChannel ) );
+			AsJson = false;
+			AsBinary = false;
+		}
+	}
+	
 	if ( AsJson )
 	{
 		//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
 		std::shared_ptr<SoyData_Impl<json::Object>> FeatureMatchesJsonData( new SoyData_Stack<json::Object>() );
 		if ( FeatureMatchesJsonData->EncodeRaw( FeatureMatches ) )
 		{
-			std::shared_ptr<SoyData> FeatureMatchesJsonDataGen( FeatureMatchesJsonData );
-			Reply.mParams.AddDefaultParam( FeatureMatchesJsonDataGen );
+			Reply.mParams.AddDefaultParam( CompressPayload( Reply, std::string(), FeatureMatchesJsonData, JobAndChannel ) );
 		}
 	}
 	
@@ -260,19 +497,19 @@ void TPopOpencv::OnFindInterestingFeatures(TJobAndChannel& JobAndChannel)
 			MaI.mImage = Image;
 			
 			//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
-			std::shared_ptr<SoyData_Impl<Array<char>>> MaiBinary( new SoyData_Stack<Array<char>>() );
+			auto MaiBinary = mReplyBuffers.GetBuffer();
 			if ( MaiBinary->EncodeRaw( MaI ) )
 			{
-				Reply.mParams.AddDefaultParam( MaiBinary );
+				Reply.mParams.AddDefaultParam( CompressPayload( Reply, std::string(), MaiBinary, JobAndChannel ) );
 			}
 		}
 		else
 		{
 			//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
-			std::shared_ptr<SoyData_Impl<Array<char>>> FeatureMatchesJsonData( new SoyData_Stack<Array<char>>() );
-			if ( FeatureMatchesJsonData->EncodeRaw( FeatureMatches ) )
+			auto FeatureMatchesBinaryData = mReplyBuffers.GetBuffer();
+			if ( FeatureMatchesBinaryData->EncodeRaw( FeatureMatches ) )
 			{
-				Reply.mParams.AddDefaultParam( FeatureMatchesJsonData );
+				Reply.mParams.AddDefaultParam( CompressPayload( Reply, std::string(), FeatureMatchesBinaryData, JobAndChannel ) );
 			}
 		}
 	}
@@ -287,6 +524,25 @@ void TPopOpencv::OnFindInterestingFeatures(TJobAndChannel& JobAndChannel)
 	//	gr: need to work out a good way to automatically send back token/meta params (all the ones we didn't read?)
 	auto SerialParam = Job.mParams.GetParam("serial");
 	Reply.mParams.AddParam( SerialParam );
+	
+	if ( BudgetMs > 0 )
+	{
+		auto ElapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - JobStart ).count();
+		Reply.mParams.AddParam("coverage", Coverage );
+		Reply.mParams.AddParam("elapsedms", static_cast<int>( ElapsedMs ) );
+	}
+	
+	if ( !StreamName.empty() )
+	{
+		Reply.mParams.AddParam("tiles", StreamTileCount );
+		Reply.mParams.AddParam("tileschanged", StreamTilesChanged );
+	}
+	
+	if ( Progressive )
+	{
+		Reply.mParams.AddParam("sequence", PartialCount );
+		Reply.mParams.AddParam("partials", PartialCount );
+	}
 
 	//	gr: this sends a big payload... and a MASSIVE image as a string param!, but maybe need it at some point
 	static bool SendBackImageImage = false;
@@ -296,76 +552,335 @@ void TPopOpencv::OnFindInterestingFeatures(TJobAndChannel& JobAndChannel)
 		Reply.mParams.AddParam("image",ImageData);
 	}
 	
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	SendReply( JobAndChannel, Reply );
+}
+
+void TPopOpencv::AddFeatureMatchesParam(TJobReply& Reply,const std::string& ParamName,const Array<TFeatureMatch>& FeatureMatches,bool HasSource,TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	auto AddParam = [&Reply,&ParamName](std::shared_ptr<SoyData> Data)
+	{
+		if ( ParamName.empty() )
+			Reply.mParams.AddDefaultParam( Data );
+		else
+			Reply.mParams.AddParam( ParamName, Data );
+	};
+	
+	//	gr: repalce with desired format/container
+	bool AsDictionary = Job.mParams.GetParamAsWithDefault("asdictionary", false );
+	bool AsJson = Job.mParams.GetParamAsWithDefault("asjson", false );
+	bool AsBinary = Job.mParams.GetParamAsWithDefault("asbinary", false );
+	
+	if ( AsDictionary )
+	{
+		//	descriptors that can't be packed fall back to the other encodings
+		auto DictionaryData = mReplyBuffers.GetBuffer();
+		std::stringstream Error;
+		if ( FeatureDictionary::Encode( GetArrayBridge( DictionaryData->mValue ), FeatureMatches, HasSource, Error ) )
+		{
+			AddParam( CompressPayload( Reply, ParamName, DictionaryData, JobAndChannel ) );
+			return;
+		}
+	}
+	
+	if ( AsJson )
+	{
+		//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
+		std::shared_ptr<SoyData_Impl<json::Object>> FeatureMatchesJsonData( new SoyData_Stack<json::Object>() );
+		if ( FeatureMatchesJsonData->EncodeRaw( FeatureMatches ) )
+		{
+			AddParam( CompressPayload( Reply, ParamName, FeatureMatchesJsonData, JobAndChannel ) );
+			return;
+		}
+	}
+	
+	if ( AsBinary )
+	{
+		//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
+		auto FeatureMatchesBinaryData = mReplyBuffers.GetBuffer();
+		if ( FeatureMatchesBinaryData->EncodeRaw( FeatureMatches ) )
+		{
+			AddParam( CompressPayload( Reply, ParamName, FeatureMatchesBinaryData, JobAndChannel ) );
+			return;
+		}
+	}
+	
+	//	add as generic
+	if ( ParamName.empty() )
+		Reply.mParams.AddDefaultParam( FeatureMatches );
+	else
+		Reply.mParams.AddParam( ParamName, FeatureMatches );
 }
 
+
+TReplyCompressionParams TPopOpencv::GetReplyCompression(TJobAndChannel& JobAndChannel)
+{
+	return TReplyCompressionParams( JobAndChannel.GetJob().mParams );
+}
+
+
+std::shared_ptr<SoyData> TPopOpencv::CompressPayload(TJobReply& Reply,const std::string& ParamName,std::shared_ptr<SoyData_Stack<Array<char>>> Payload,TJobAndChannel& JobAndChannel)
+{
+	auto Params = GetReplyCompression( JobAndChannel );
+	auto& Data = Payload->mValue;
+	if ( !Params.IsEnabled( Data.GetDataSize() ) )
+		return Payload;
+	
+	//	metadata for a named payload is prefixed with its name
+	std::string Prefix = ParamName.empty() ? std::string() : ParamName + ".";
+	if ( !ReplyCompression::IsSupported( Params.mCodec ) )
+	{
+		Reply.mParams.AddParam( Prefix + "compression", ReplyCompression::ToString( ReplyCompression::Codec::None ) );
+		return Payload;
+	}
+	
+	auto Start = std::chrono::steady_clock::now();
+	std::shared_ptr<SoyData_Stack<Array<char>>> Compressed( new SoyData_Stack<Array<char>>() );
+	std::stringstream Error;
+	if ( !ReplyCompression::Compress( GetArrayBridge( Compressed->mValue ), Data.GetArray(), Data.GetDataSize(), Params.mCodec, Params.mLevel, Error ) )
+	{
+		Reply.mParams.AddParam( Prefix + "compression", ReplyCompression::ToString( ReplyCompression::Codec::None ) );
+		Reply.mParams.AddParam( Prefix + "compressionerror", Error.str() );
+		return Payload;
+	}
+	auto CompressMs = std::chrono::duration<float,std::milli>( std::chrono::steady_clock::now() - Start ).count();
+	
+	auto UncompressedSize = Data.GetDataSize();
+	auto CompressedSize = Compressed->mValue.GetDataSize();
+	Reply.mParams.AddParam( Prefix + "compression", ReplyCompression::ToString( Params.mCodec ) );
+	Reply.mParams.AddParam( Prefix + "uncompressedsize", static_cast<int>( UncompressedSize ) );
+	Reply.mParams.AddParam( Prefix + "compressedsize", static_cast<int>( CompressedSize ) );
+	Reply.mParams.AddParam( Prefix + "compressionratio", CompressedSize ? UncompressedSize / static_cast<float>( CompressedSize ) : 0.f );
+	Reply.mParams.AddParam( Prefix + "compressionms", CompressMs );
+	return Compressed;
+}
+
+
+std::shared_ptr<SoyData> TPopOpencv::CompressPayload(TJobReply& Reply,const std::string& ParamName,std::shared_ptr<SoyData_Impl<json::Object>> Payload,TJobAndChannel& JobAndChannel)
+{
+	auto Params = GetReplyCompression( JobAndChannel );
+	if ( Params.mCodec == ReplyCompression::Codec::None )
+		return Payload;
+	
+	//	compressed json goes out as the bytes of the serialised object
+	auto Json = json::Serialize( Payload->mValue );
+	if ( !Params.IsEnabled( Json.length() ) )
+		return Payload;
+	
+	std::shared_ptr<SoyData_Stack<Array<char>>> JsonData( new SoyData_Stack<Array<char>>() );
+	auto* JsonBytes = JsonData->mValue.PushBlock( Json.length() );
+	memcpy( JsonBytes, Json.c_str(), Json.length() );
+	auto Compressed = CompressPayload( Reply, ParamName, JsonData, JobAndChannel );
+	
+	//	not compressed after all (unsupported), send the object as before
+	if ( Compressed == JsonData )
+		return Payload;
+	return Compressed;
+}
+
+
 void TPopOpencv::OnFindFeature(TJobAndChannel& JobAndChannel)
 {
+	//	transient allocations are released when the job is done
+	TJobArenaScope ArenaScope;
 	auto& Job = JobAndChannel.GetJob();
 	
 	//	pull image
-	auto Image = Job.mParams.GetParamAs<SoyPixels>("image");
-	auto Feature = Job.mParams.GetParamAs<TFeatureBinRing>("Feature");
-	
-	if ( !Image.IsValid() )
+	SoyPixels Image;
+	std::stringstream ImageError;
+	if ( !GetImageParam( Image, Job.mParams, "image", ImageError ) )
 	{
 		std::stringstream Error;
-		Error << "Failed to decode image param";
+		Error << "Failed to decode image param: " << ImageError.str();
 		TJobReply Reply( JobAndChannel );
 		Reply.mParams.AddErrorParam( Error.str() );
 		
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted( Reply );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	FeatureSearch::TRegion Region;
+	std::stringstream RegionError;
+	if ( !GetFeatureRegion( Region, Job.mParams, RegionError ) )
+	{
+		TJobReply Reply( JobAndChannel );
+		Reply.mParams.AddErrorParam( RegionError.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	//	many features are searched for in one pass over the image
+	auto FeaturesString = Job.mParams.GetParamAsWithDefault<std::string>("features", std::string() );
+	if ( !FeaturesString.empty() )
+	{
+		OnFindFeatures( JobAndChannel, Image, FeaturesString, Region );
 		return;
 	}
 
+	auto Feature = Job.mParams.GetParamAs<TFeatureBinRing>("Feature");
+
 	//	run a search
 	TFeatureBinRingParams Params( Job.mParams );
 	Array<TFeatureMatch> FeatureMatches;
 	std::stringstream Error;
-	TFeatureExtractor::FindFeatureMatches( GetArrayBridge(FeatureMatches), Image, Feature, Params, Error );
+	//	always the grid search, so a match scores the same with or without a roi/mask; the extractor's own whole frame
+	//	search scores differently (see FeatureSearch::FindFeatureMatches)
+	static float DefaultMinScore = 0.8f;
+	float MinScore = Job.mParams.GetParamAsWithDefault("minscore", DefaultMinScore );
+	bool Progressive = IsProgressive( JobAndChannel );
+	int PartialCount = 0;
+	{
+		Array<TFeatureBinRing> Features;
+		Features.PushBack( Feature );
+		std::vector<Array<TFeatureMatch>> Matches;
+		if ( Progressive )
+			PartialCount = FindFeatureMatchesProgressive( Matches, Image, GetArrayBridge(Features), Params, MinScore, Region, false, JobAndChannel, Error );
+		else
+			FeatureSearch::FindFeatureMatches( Matches, Image, GetArrayBridge(Features), Params, MinScore, Region, Error );
+		if ( !Matches.empty() )
+			FeatureMatches = Matches[0];
+	}
 	
 	//	some some params back with the reply
 	TJobReply Reply( JobAndChannel );
 	Reply.mParams.AddParam( Job.mParams.GetParam("Feature") );
+	if ( Progressive )
+	{
+		Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+		Reply.mParams.AddParam("sequence", PartialCount );
+		Reply.mParams.AddParam("partials", PartialCount );
+	}
 	
+	AddFeatureMatchesParam( Reply, std::string(), FeatureMatches, true, JobAndChannel );
 	
-	//	gr: repalce with desired format/container
-	bool AsJson = Job.mParams.GetParamAsWithDefault("asjson", false );
-	bool AsBinary = Job.mParams.GetParamAsWithDefault("asbinary", false );
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
 	
-	if ( AsJson )
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnFindFeatures(TJobAndChannel& JobAndChannel,const SoyPixels& Image,const std::string& FeaturesString,const FeatureSearch::TRegion& Region)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	Array<TFeatureBinRing> Features;
+	if ( !FeatureSearch::ParseFeatures( GetArrayBridge(Features), FeaturesString, Error ) )
 	{
-		//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
-		std::shared_ptr<SoyData_Impl<json::Object>> FeatureMatchesJsonData( new SoyData_Stack<json::Object>() );
-		if ( FeatureMatchesJsonData->EncodeRaw( FeatureMatches ) )
-		{
-			std::shared_ptr<SoyData> FeatureMatchesJsonDataGen( FeatureMatchesJsonData );
-			Reply.mParams.AddDefaultParam( FeatureMatchesJsonDataGen );
-		}
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
 	}
-	
-	if ( AsBinary )
+
+	TFeatureBinRingParams Params( Job.mParams );
+	static float DefaultMinScore = 0.8f;
+	float MinScore = Job.mParams.GetParamAsWithDefault("minscore", DefaultMinScore );
+	std::vector<Array<TFeatureMatch>> FeatureMatches;
+	if ( IsProgressive( JobAndChannel ) )
 	{
-		//	gr: the internal SoyData system doesn't know this type, so won't auto encode :/ need to work on this!
-		std::shared_ptr<SoyData_Impl<Array<char>>> FeatureMatchesJsonData( new SoyData_Stack<Array<char>>() );
-		if ( FeatureMatchesJsonData->EncodeRaw( FeatureMatches ) )
-		{
-			std::shared_ptr<SoyData> FeatureMatchesJsonDataGen( FeatureMatchesJsonData );
-			Reply.mParams.AddDefaultParam( FeatureMatchesJsonDataGen );
-		}
+		int PartialCount = FindFeatureMatchesProgressive( FeatureMatches, Image, GetArrayBridge(Features), Params, MinScore, Region, true, JobAndChannel, Error );
+		Reply.mParams.AddParam("sequence", PartialCount );
+		Reply.mParams.AddParam("partials", PartialCount );
+	}
+	else
+	{
+		FeatureSearch::FindFeatureMatches( FeatureMatches, Image, GetArrayBridge(Features), Params, MinScore, Region, Error );
 	}
 	
-	//	add as generic
-	if ( !Reply.mParams.HasDefaultParam() )
-		Reply.mParams.AddDefaultParam( FeatureMatches );
+	//	matches for features[n] are in matchesN, default param is the match count per feature
+	std::stringstream MatchCounts;
+	for ( int f=0;	f<FeatureMatches.size();	f++ )
+	{
+		std::stringstream ParamName;
+		ParamName << "matches" << f;
+		AddFeatureMatchesParam( Reply, ParamName.str(), FeatureMatches[f], true, JobAndChannel );
+		MatchCounts << (f==0 ? "" : ",") << FeatureMatches[f].GetSize();
+	}
+	Reply.mParams.AddDefaultParam( MatchCounts.str() );
 	
 	if ( !Error.str().empty() )
 		Reply.mParams.AddErrorParam( Error.str() );
 	
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::SendPartialReply(TJobAndChannel& JobAndChannel,TJobReply& Reply,int Sequence,const FeatureSearch::TRect& Tile)
+{
+	auto& Job = JobAndChannel.GetJob();
+	std::stringstream TileString;
+	TileString << Tile.x << ',' << Tile.y << ',' << Tile.w << ',' << Tile.h;
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	Reply.mParams.AddParam("sequence", Sequence );
+	Reply.mParams.AddParam("partial", 1 );
+	Reply.mParams.AddParam("tile", TileString.str() );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+bool TPopOpencv::IsProgressive(TJobAndChannel& JobAndChannel)
+{
+	if ( !JobAndChannel.GetJob().mParams.GetParamAsWithDefault("progressive", false ) )
+		return false;
+	
+	//	captured (batch, replay) and http jobs get exactly one reply, so partials would be lost or break the protocol
+	if ( TJobReplyCapture::Get() )
+		return false;
 	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	std::lock_guard<std::mutex> Lock( mSingleReplyChannelsLock );
+	return mSingleReplyChannels.find( &Channel ) == mSingleReplyChannels.end();
+}
+
+
+int TPopOpencv::GetProgressiveTileSize(TJobParams& Params)
+{
+	//	big enough that a frame is a handful of replies, not hundreds
+	static int DefaultTileSize = 128;
+	return std::max( 16, Params.GetParamAsWithDefault("tilesize", DefaultTileSize ) );
+}
+
+
+int TPopOpencv::FindFeatureMatchesProgressive(std::vector<Array<TFeatureMatch>>& Matches,const SoyPixels& Image,const ArrayBridge<TFeatureBinRing>& Features,const TFeatureBinRingParams& Params,float MinScore,const FeatureSearch::TRegion& Region,bool Named,TJobAndChannel& JobAndChannel,std::stringstream& Error)
+{
+	Matches.clear();
+	Matches.resize( Features.GetSize() );
+	
+	std::vector<FeatureSearch::TRect> Tiles;
+	FeatureSearch::GetTiles( Tiles, Region, GetProgressiveTileSize( JobAndChannel.GetJob().mParams ), Image.GetWidth(), Image.GetHeight() );
+	
+	int PartialCount = 0;
+	std::vector<Array<TFeatureMatch>> TileMatches;
+	for ( auto& Tile : Tiles )
+	{
+		FeatureSearch::FindFeatureMatches( TileMatches, Image, Features, Params, MinScore, Region, Tile, Error );
+		if ( Error.tellp() > 0 )
+			break;
+		
+		TJobReply PartialReply( JobAndChannel );
+		std::stringstream MatchCounts;
+		for ( int f=0;	f<TileMatches.size();	f++ )
+		{
+			for ( int m=0;	m<TileMatches[f].GetSize();	m++ )
+				Matches[f].PushBack( TileMatches[f][m] );
+			
+			if ( !Named )
+			{
+				AddFeatureMatchesParam( PartialReply, std::string(), TileMatches[f], true, JobAndChannel );
+				continue;
+			}
+			std::stringstream ParamName;
+			ParamName << "matches" << f;
+			AddFeatureMatchesParam( PartialReply, ParamName.str(), TileMatches[f], true, JobAndChannel );
+			MatchCounts << (f==0 ? "" : ",") << TileMatches[f].GetSize();
+		}
+		if ( Named )
+			PartialReply.mParams.AddDefaultParam( MatchCounts.str() );
+		SendPartialReply( JobAndChannel, PartialReply, PartialCount++, Tile );
+	}
+	return PartialCount;
 }
 
 
@@ -387,8 +902,7 @@ void TPopOpencv::OnTrackFeatures(TJobAndChannel& JobAndChannel)
 		TJobReply Reply( JobAndChannel );
 		Reply.mParams.AddErrorParam( Error.str() );
 		
-		TChannel& Channel = JobAndChannel;
-		Channel.OnJobCompleted( Reply );
+		SendReply( JobAndChannel, Reply );
 		return;
 	}
 	
@@ -450,8 +964,7 @@ void TPopOpencv::OnTrackFeatures(TJobAndChannel& JobAndChannel)
 	if ( !Error.str().empty() )
 		Reply.mParams.AddErrorParam( Error.str() );
 	
-	TChannel& Channel = JobAndChannel;
-	Channel.OnJobCompleted( Reply );
+	SendReply( JobAndChannel, Reply );
  */
 }
 
@@ -474,18 +987,14 @@ void TPopOpencv::OnNewFrame(TJobAndChannel& JobAndChannel)
 }
 
 
-void TPopOpencv::OnCalibrateCamera(TJobAndChannel& JobAndChannel)
+//	points2D=XxY,... (normalised) and points3D=XxYxZ,... of a calibration job
+bool ParseCalibrationPoints(Array<vec2f>& Point2s,Array<vec3f>& Point3s,TJobParams& Params,std::stringstream& Error)
 {
-	auto& Job = JobAndChannel.GetJob();
-
 	//	read points
-	auto Point2strings = Job.mParams.GetParamAs<std::string>("points2D");
-	auto Point3strings = Job.mParams.GetParamAs<std::string>("points3D");
+	auto Point2strings = Params.GetParamAs<std::string>("points2D");
+	auto Point3strings = Params.GetParamAs<std::string>("points3D");
 	
-	std::stringstream Error;
-
 	//	extract floats
-	Array<vec2f> Point2s;
 	{
 		std::stringstream ParseError;
 		auto AppendPoints2 = [&ParseError,&Point2s](const std::string& Point2str)
@@ -505,7 +1014,6 @@ void TPopOpencv::OnCalibrateCamera(TJobAndChannel& JobAndChannel)
 		}
 	}
 	
-	Array<vec3f> Point3s;
 	{
 		std::stringstream ParseError;
 		auto AppendPoints3 = [&ParseError,&Point3s](const std::string& Point3str)
@@ -533,12 +1041,71 @@ void TPopOpencv::OnCalibrateCamera(TJobAndChannel& JobAndChannel)
 	if ( Point2s.GetSize() != Point3s.GetSize() )
 		Error << "Number of points mis matched (" << Point2s.GetSize() << " vs " << Point3s.GetSize() << ")" << Soy::lf;
 	
-	TJobReply Reply( JobAndChannel );
+	return Error.str().empty();
+}
+
+
+//	the calibratecamera reply; stats, the camera as text and optionally the binary solve
+void AddCameraParams(TJobReply& Reply,const Soy::TCamera& Camera,bool AsBinary)
+{
+	Reply.mParams.AddParam("CalibrationError", Camera.mCalibrationError );
+	Reply.mParams.AddParam("CalibrationIterationLimit", Camera.mCalibrationIterationLimit );
+	Reply.mParams.AddParam("CalibrationTimeMs", Camera.mCalibrationTimeMs );
+
+	std::stringstream CameraOutput;
+
+	CameraOutput << "cameramtx:";
+	CameraOutput << Camera.mMatrix.rows[0] << ',';
+	CameraOutput << Camera.mMatrix.rows[1] << ',';
+	CameraOutput << Camera.mMatrix.rows[2] << ',';
+	CameraOutput << Camera.mMatrix.rows[3] << Soy::lf;
+	
+	CameraOutput << "cameraprojectionmtx:";
+	CameraOutput << Camera.mIntrinsicMatrix.rows[0] << ',';
+	CameraOutput << Camera.mIntrinsicMatrix.rows[1] << ',';
+	CameraOutput << Camera.mIntrinsicMatrix.rows[2] << ',';
+	CameraOutput << Camera.mIntrinsicMatrix.rows[3] << Soy::lf;
+	
+	CameraOutput << "calibrationerror:" << Camera.mCalibrationError << Soy::lf;
+	CameraOutput << "fov:" << Camera.mFov << Soy::lf;
+	CameraOutput << "lensoffset:" << Camera.mLensOffset << Soy::lf;
+	CameraOutput << "cameraworldpos:" << Camera.mCameraWorldPosition << Soy::lf;
+	CameraOutput << "camerarotationeulardegrees:" << Camera.mCameraRotationEularDeg << Soy::lf;
+	
+	CameraOutput << "distortionradtank5:";
+	CameraOutput << Camera.mRadialDistortion << ',';
+	CameraOutput << Camera.mTangentialDistortion << ',';
+	CameraOutput << Camera.mDistortionK5 << Soy::lf;
+	
+	//	exact values to feed back as warmsolve=
+	CameraOutput << "solve:" << Opencv::CameraSolveToString( Camera.mSolve ) << Soy::lf;
+	
+	Reply.mParams.AddDefaultParam( CameraOutput.str() );
+	
+	if ( AsBinary )
+	{
+		std::shared_ptr<SoyData_Stack<Array<char>>> SolveBinary( new SoyData_Stack<Array<char>>() );
+		Opencv::EncodeCameraSolve( GetArrayBridge( SolveBinary->mValue ), Camera.mSolve );
+		Reply.mParams.AddParam("camerasolve", SolveBinary );
+	}
+}
+
+
+void TPopOpencv::OnCalibrateCamera(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	std::stringstream Error;
+
+	Array<vec2f> Point2s;
+	Array<vec3f> Point3s;
+	ParseCalibrationPoints( Point2s, Point3s, Job.mParams, Error );
+	
+	TJobReply Reply( JobAndChannel );
 
 	if ( !Error.str().empty() )
 	{
 		Reply.mParams.AddErrorParam( Error.str() );
-		JobAndChannel.GetChannel().SendJobReply( Reply );
+		SendReply( JobAndChannel, Reply );
 		return;
 	}
 
@@ -547,6 +1114,46 @@ void TPopOpencv::OnCalibrateCamera(TJobAndChannel& JobAndChannel)
 	static float imgw = 3000;
 	static float imgh = 2250;
 	Params.mCameraImageSize = vec2f( imgw, imgh );
+	Params.mMaxIterations = Job.mParams.GetParamAsWithDefault("maxiterations", Params.mMaxIterations );
+	Params.mEpsilon = Job.mParams.GetParamAsWithDefault("epsilon", Params.mEpsilon );
+	
+	//	warm start from a registered camera
+	auto WarmCameraName = Job.mParams.GetParamAsWithDefault<std::string>("warmcamera", std::string() );
+	if ( !WarmCameraName.empty() )
+	{
+		if ( !GetCamera( WarmCameraName, Params.mKnownCamera ) )
+		{
+			Error << "Unknown warm start camera \"" << WarmCameraName << "\"";
+			Reply.mParams.AddErrorParam( Error.str() );
+			SendReply( JobAndChannel, Reply );
+			return;
+		}
+		Params.mUseKnownCamera = true;
+	}
+	
+	//	warm start from a solve a client already has, either the binary reply or the solve: string
+	//	the binary is read as data rather than through a string, which could stop at or mangle NULs
+	Array<char> WarmSolveBinary;
+	Job.mParams.GetParamAs( "warmsolvebinary", WarmSolveBinary );
+	auto WarmSolveString = Job.mParams.GetParamAsWithDefault<std::string>("warmsolve", std::string() );
+	if ( !WarmSolveBinary.IsEmpty() || !WarmSolveString.empty() )
+	{
+		bool Decoded = false;
+		if ( !WarmSolveBinary.IsEmpty() )
+			Decoded = Opencv::DecodeCameraSolve( Params.mKnownCamera.mSolve, GetArrayBridge( WarmSolveBinary ) );
+		else
+			Decoded = Opencv::StringToCameraSolve( Params.mKnownCamera.mSolve, WarmSolveString );
+		
+		if ( !Decoded || !Params.mKnownCamera.mSolve.IsValid() )
+		{
+			Error << "Failed to decode warm start solve";
+			Reply.mParams.AddErrorParam( Error.str() );
+			SendReply( JobAndChannel, Reply );
+			return;
+		}
+		Params.mUseKnownCamera = true;
+	}
+	
 	try
 	{
 		if ( !Opencv::CalibrateCamera( Camera, Params, GetArrayBridge(Point3s), GetArrayBridge(Point2s) ) )
@@ -567,43 +1174,51 @@ void TPopOpencv::OnCalibrateCamera(TJobAndChannel& JobAndChannel)
 	}
 	else
 	{
-		Reply.mParams.AddParam("CalibrationError", Camera.mCalibrationError );
-	
-		std::stringstream CameraOutput;
-
-		CameraOutput << "cameramtx:";
-		CameraOutput << Camera.mMatrix.rows[0] << ',';
-		CameraOutput << Camera.mMatrix.rows[1] << ',';
-		CameraOutput << Camera.mMatrix.rows[2] << ',';
-		CameraOutput << Camera.mMatrix.rows[3] << Soy::lf;
-		
-		CameraOutput << "cameraprojectionmtx:";
-		CameraOutput << Camera.mIntrinsicMatrix.rows[0] << ',';
-		CameraOutput << Camera.mIntrinsicMatrix.rows[1] << ',';
-		CameraOutput << Camera.mIntrinsicMatrix.rows[2] << ',';
-		CameraOutput << Camera.mIntrinsicMatrix.rows[3] << Soy::lf;
-		
-		CameraOutput << "calibrationerror:" << Camera.mCalibrationError << Soy::lf;
-		CameraOutput << "fov:" << Camera.mFov << Soy::lf;
-		CameraOutput << "lensoffset:" << Camera.mLensOffset << Soy::lf;
-		CameraOutput << "cameraworldpos:" << Camera.mCameraWorldPosition << Soy::lf;
-		CameraOutput << "camerarotationeulardegrees:" << Camera.mCameraRotationEularDeg << Soy::lf;
-		
-		CameraOutput << "distortionradtank5:";
-		CameraOutput << Camera.mRadialDistortion << ',';
-		CameraOutput << Camera.mTangentialDistortion << ',';
-		CameraOutput << Camera.mDistortionK5 << Soy::lf;
+		//	register for undistortframe etc
+		auto CameraName = Job.mParams.GetParamAsWithDefault<std::string>("camera", std::string() );
+		if ( !CameraName.empty() )
+			SetCamera( CameraName, Camera );
 		
-		Reply.mParams.AddDefaultParam( CameraOutput.str() );
+		AddCameraParams( Reply, Camera, Job.mParams.GetParamAsWithDefault("asbinary", false ) );
 	}
 	
-	JobAndChannel.GetChannel().SendJobReply( Reply );
+	SendReply( JobAndChannel, Reply );
+
+}
+
 
+bool GetHomography(Soy::Matrix3x3& Homography,Array<vec2f>& Point2s,Array<vec2f>& Pointuvs,std::stringstream& Error)
+{
+	Opencv::TGetHomographyParams Params;
+	static float imgw = 3000;
+	static float imgh = 2250;
+	Params.mCameraImageSize = vec2f( imgw, imgh );
+	try
+	{
+		if ( !Opencv::GetHomography( Homography, Params, GetArrayBridge(Pointuvs), GetArrayBridge(Point2s) ) )
+		{
+			Error << "Failed to get homography";
+			return false;
+		}
+	}
+	catch ( const Soy::AssertException& e )
+	{
+		Error << e.what();
+		return false;
+	}
+	catch ( ... )
+	{
+		Error << "Unknown exception getting homography";
+		return false;
+	}
+	return true;
 }
 
 
 void TPopOpencv::OnGetHomography(TJobAndChannel& JobAndChannel)
 {
+	//	transient allocations are released when the job is done
+	TJobArenaScope ArenaScope;
 	auto& Job = JobAndChannel.GetJob();
 	
 	//	read points
@@ -666,28 +1281,12 @@ void TPopOpencv::OnGetHomography(TJobAndChannel& JobAndChannel)
 	if ( !Error.str().empty() )
 	{
 		Reply.mParams.AddErrorParam( Error.str() );
-		JobAndChannel.GetChannel().SendJobReply( Reply );
+		SendReply( JobAndChannel, Reply );
 		return;
 	}
 	
 	Soy::Matrix3x3 Homography;
-	Opencv::TGetHomographyParams Params;
-	static float imgw = 3000;
-	static float imgh = 2250;
-	Params.mCameraImageSize = vec2f( imgw, imgh );
-	try
-	{
-		if ( !Opencv::GetHomography( Homography, Params, GetArrayBridge(Pointuvs), GetArrayBridge(Point2s) ) )
-		Error << "Failed to get homography";
-	}
-	catch ( const Soy::AssertException& e )
-	{
-		Error << e.what();
-	}
-	catch ( ... )
-	{
-		Error << "Unknown exception getting homography";
-	}
+	GetHomography( Homography, Point2s, Pointuvs, Error );
 	
 	if ( !Error.str().empty() )
 	{
@@ -703,49 +1302,1516 @@ void TPopOpencv::OnGetHomography(TJobAndChannel& JobAndChannel)
 		Reply.mParams.AddDefaultParam( CameraOutput.str() );
 	}
 	
-	JobAndChannel.GetChannel().SendJobReply( Reply );
+	SendReply( JobAndChannel, Reply );
 	
 }
 
 
-TPopAppError::Type PopMain(TJobParams& Params)
+void TPopOpencv::OnUndistortFrame(TJobAndChannel& JobAndChannel)
 {
-	TPopOpencv App;
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+
+	auto CameraName = Job.mParams.GetParamAs<std::string>("camera");
+	Soy::TCamera Camera;
+	uint64 CameraGeneration = 0;
+	if ( !GetCamera( CameraName, Camera, CameraGeneration ) )
+	{
+		std::stringstream Error;
+		Error << "Unknown camera \"" << CameraName << "\"";
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
 
+	SoyPixels Image;
+	std::stringstream ImageError;
+	if ( !GetImageParam( Image, Job.mParams, "image", ImageError ) )
+	{
+		Reply.mParams.AddErrorParam( "Failed to decode image param: " + ImageError.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
 	
-	//	create stdio channel for commandline output
-	auto StdioChannel = CreateChannelFromInputString("std:", SoyRef("stdio") );
-	auto HttpChannel = CreateChannelFromInputString("http:8080-8090", SoyRef("http") );
+	std::shared_ptr<SoyData_Stack<SoyPixels>> UndistortedData( new SoyData_Stack<SoyPixels>() );
+	std::stringstream Error;
+	try
+	{
+		//	maps are only built the first time we see this camera at this resolution
+		auto Map = mUndistortMaps.GetMap( CameraName, CameraGeneration, Camera, Image.GetWidth(), Image.GetHeight() );
+		if ( !Opencv::Undistort( UndistortedData->mValue, Image, *Map ) )
+			Error << "Failed to undistort frame";
+	}
+	catch ( const Soy::AssertException& e )
+	{
+		Error << e.what();
+	}
+	catch ( ... )
+	{
+		Error << "Unknown exception undistorting frame";
+	}
 	
-	App.AddChannel( StdioChannel );
-	App.AddChannel( HttpChannel );
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	else
+		Reply.mParams.AddDefaultParam( UndistortedData );
 	
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::SetCamera(const std::string& Name,const Soy::TCamera& Camera)
+{
+	uint64 Generation = 0;
+	{
+		std::lock_guard<std::mutex> Lock( mCamerasLock );
+		mCameras[Name] = Camera;
+		Generation = ++mCameraGenerations[Name];
+	}
+	mUndistortMaps.Invalidate( Name, Generation );
+}
+
+
+bool TPopOpencv::GetCamera(const std::string& Name,Soy::TCamera& Camera)
+{
+	uint64 Generation = 0;
+	return GetCamera( Name, Camera, Generation );
+}
+
+
+bool TPopOpencv::GetCamera(const std::string& Name,Soy::TCamera& Camera,uint64& Generation)
+{
+	std::lock_guard<std::mutex> Lock( mCamerasLock );
+	auto it = mCameras.find( Name );
+	if ( it == mCameras.end() )
+		return false;
+	Camera = it->second;
+	Generation = mCameraGenerations[Name];
+	return true;
+}
+
+
+std::shared_ptr<TFeatureDatabase> TPopOpencv::GetFeatureDatabase(const std::string& Name,bool Create)
+{
+	std::lock_guard<std::mutex> Lock( mFeatureDatabasesLock );
+	auto& Database = mFeatureDatabases[Name];
+	if ( !Database && Create )
+		Database.reset( new TFeatureDatabase() );
+	if ( !Database )
+		mFeatureDatabases.erase( Name );
+	return Database;
+}
+
+
+bool TPopOpencv::GetImageParam(SoyPixels& Pixels,TJobParams& Params,const std::string& Name,std::stringstream& Error)
+{
+	if ( Params.GetParamAs( Name, Pixels ) && Pixels.IsValid() )
+		return true;
 	
-	//	bootup commands via a channel
-	std::shared_ptr<TChannel> BootupChannel( new TChan<TChannelFileRead,TProtocolCli>( SoyRef("Bootup"), "bootup.txt" ) );
+	//	only one copy, out of shared memory into the pixels
+	auto Reference = Params.GetParamAsWithDefault<std::string>( Name, std::string() );
+	if ( SharedFrameRing::IsReference( Reference ) )
+		return mSharedFrameRings.Read( Pixels, Reference, Error );
 	
-	//	display reply to stdout
-	//	when the commandline SENDs a command (a reply), send it to stdout
-	auto RelayFunc = [](TJobAndChannel& JobAndChannel)
+	if ( MappedImage::IsReference( Reference ) )
 	{
-		std::Debug << JobAndChannel.GetJob().mParams << std::endl;
-	};
-	//BootupChannel->mOnJobRecieved.AddListener( RelayFunc );
-	BootupChannel->mOnJobSent.AddListener( RelayFunc );
-	BootupChannel->mOnJobLost.AddListener( RelayFunc );
-	
-	App.AddChannel( BootupChannel );
+		int Frame = Params.GetParamAsWithDefault( Name + "frame", -1 );
+		if ( Frame < 0 && Name == "image" )
+			Frame = Params.GetParamAsWithDefault( "frame", -1 );
+		return mMappedImages.Read( Pixels, Reference, Frame, Error );
+	}
 	
+	Error << "no " << Name << " pixels";
+	return false;
+}
+
+
+std::shared_ptr<TFeatureStream> TPopOpencv::GetFeatureStream(const std::string& Name)
+{
+	return mFeatureStreams.Get( Name );
+}
+
+
+std::shared_ptr<Opencv::TFlowStream> TPopOpencv::GetFlowStream(const std::string& Name)
+{
+	return mFlowStreams.Get( Name );
+}
+
+
+bool TPopOpencv::GetFlowPyramids(std::shared_ptr<Opencv::TFlowPyramid>& Previous,std::shared_ptr<Opencv::TFlowPyramid>& Next,TJobParams& Params,const Opencv::TOpticalFlowParams& FlowParams,const SoyPixels* Image,std::stringstream& Error)
+{
+	SoyPixels DecodedImage;
+	std::stringstream ImageError;
+	if ( !Image && GetImageParam( DecodedImage, Params, "image", ImageError ) )
+		Image = &DecodedImage;
 	
+	auto StreamName = Params.GetParamAsWithDefault<std::string>("stream", std::string() );
+	if ( StreamName.empty() )
+	{
+		SoyPixels PreviousImage;
+		if ( !Image || !GetImageParam( PreviousImage, Params, "previous", ImageError ) )
+		{
+			Error << "Expected image= and previous= (or stream=); " << ImageError.str();
+			return false;
+		}
+		Previous.reset( new Opencv::TFlowPyramid() );
+		Next.reset( new Opencv::TFlowPyramid() );
+		if ( !Opencv::BuildFlowPyramid( *Previous, PreviousImage, FlowParams, Error ) || !Opencv::BuildFlowPyramid( *Next, *Image, FlowParams, Error ) )
+			return false;
+		return true;
+	}
 	
+	auto Stream = GetFlowStream( StreamName );
+	std::lock_guard<std::mutex> Lock( Stream->mLock );
+	int Frame = Params.GetParamAsWithDefault("frame", -1 );
+	if ( Stream->IsCurrentFrame( Frame ) )
+	{
+		//	rebuilding would make the frame its own previous
+		if ( !Stream->mCurrent->IsCompatible( FlowParams ) )
+		{
+			Error << "Frame " << Frame << " is the stream's current frame, built with windowsize=" << Stream->mCurrent->mWindowSize;
+			return false;
+		}
+	}
+	else
+	{
+		if ( !Image )
+		{
+			Error << "Frame " << Frame << " isn't the stream's current frame, so needs an image; " << ImageError.str();
+			return false;
+		}
+		std::shared_ptr<Opencv::TFlowPyramid> Pyramid( new Opencv::TFlowPyramid() );
+		if ( !Opencv::BuildFlowPyramid( *Pyramid, *Image, FlowParams, Error ) )
+			return false;
+		Pyramid->mFrame = Frame;
+		Stream->mPrevious = Stream->GetNewFramePrevious( FlowParams );
+		Stream->mCurrent = Pyramid;
+	}
+	Previous = Stream->mPrevious;
+	Next = Stream->mCurrent;
+	return true;
+}
 
-	
-	//	run
-	App.mConsoleApp.WaitForExit();
 
-	return TPopAppError::Success;
+const SoyPixels* TPipelineState::GetDetectImage() const
+{
+	if ( mDetectOnPrevious )
+		return mHasPreviousImage ? &mPreviousImage : nullptr;
+	return mHasImage ? &mImage : nullptr;
+}
+
+
+bool TPopOpencv::GetFeatureRegion(FeatureSearch::TRegion& Region,TJobParams& Params,std::stringstream& Error)
+{
+	auto RoiString = Params.GetParamAsWithDefault<std::string>("roi", std::string() );
+	if ( !RoiString.empty() )
+	{
+		if ( !FeatureSearch::ParseRects( Region, RoiString, Error ) )
+			return false;
+	}
+	
+	auto MaskId = Params.GetParamAsWithDefault<std::string>("maskid", std::string() );
+	SoyPixels MaskImage;
+	std::stringstream MaskError;
+	if ( GetImageParam( MaskImage, Params, "mask", MaskError ) )
+	{
+		//	keep a tight 8 bit copy, not the sent pixels
+		cv::Mat Luma;
+		try
+		{
+			Opencv::GetLuma( Luma, MaskImage );
+		}
+		catch ( const Soy::AssertException& e )
+		{
+			Error << "Bad mask; " << e.what();
+			return false;
+		}
+		catch ( const cv::Exception& e )
+		{
+			Error << "Bad mask; " << e.what();
+			return false;
+		}
+		std::shared_ptr<FeatureSearch::TMask> Mask( new FeatureSearch::TMask() );
+		Mask->mWidth = Luma.cols;
+		Mask->mHeight = Luma.rows;
+		Mask->mPixels.resize( Luma.cols * Luma.rows );
+		for ( int y=0;	y<Luma.rows;	y++ )
+			memcpy( &Mask->mPixels[y*Luma.cols], Luma.ptr<uint8>(y), Luma.cols );
+		Region.mMask = Mask;
+		
+		if ( !MaskId.empty() )
+			mMasks.Set( MaskId, Mask );
+		return true;
+	}
+	
+	//	a mask that was sent but can't be read (bad pixels, a shared frame that's gone, a missing file) is an error,
+	//	not "no mask"; searching the whole frame instead would be wrong and slow
+	if ( Params.HasParam("mask") )
+	{
+		Error << "Failed to decode mask param: " << MaskError.str();
+		return false;
+	}
+	
+	if ( !MaskId.empty() )
+	{
+		Region.mMask = mMasks.Get( MaskId );
+		if ( !Region.mMask )
+		{
+			Error << "Unknown maskid \"" << MaskId << "\"; send mask= with it (again) first";
+			return false;
+		}
+	}
+	return true;
 }
 
 
+void TPopOpencv::OnAddFeatures(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	auto DatabaseName = Job.mParams.GetParamAs<std::string>("database");
+	auto FeaturesString = Job.mParams.GetParamAs<std::string>("features");
+	auto IdsString = Job.mParams.GetParamAsWithDefault<std::string>("ids", std::string() );
+	
+	Array<TFeatureBinRing> Features;
+	FeatureSearch::ParseFeatures( GetArrayBridge(Features), FeaturesString, Error );
+	
+	//	ids are optional, default to the database index
+	Array<std::string> Ids;
+	if ( !IdsString.empty() )
+	{
+		auto AppendId = [&Ids](const std::string& Id)
+		{
+			Ids.PushBack( Id );
+			return true;
+		};
+		Soy::StringSplitByMatches( AppendId, IdsString, ",", false );
+		if ( Ids.GetSize() != Features.GetSize() )
+			Error << "Number of ids mis matched (" << Ids.GetSize() << " vs " << Features.GetSize() << ")" << Soy::lf;
+	}
+	
+	if ( !Error.str().empty() )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	auto Database = GetFeatureDatabase( DatabaseName, true );
+	std::lock_guard<TReadWriteLock> Lock( Database->mLock );
+	for ( int f=0;	f<Features.GetSize();	f++ )
+	{
+		TFeatureBits Bits;
+		FeatureBits::Pack( Bits, Features[f] );
+		std::string Id;
+		if ( Ids.IsEmpty() )
+			Id = std::to_string( Database->GetSize() );
+		else
+			Id = Ids[f];
+		Database->Add( Id, Bits, Error );
+	}
+	
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	Reply.mParams.AddDefaultParam( static_cast<int>( Database->GetSize() ) );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
 
 
+void TPopOpencv::OnMatchDatabase(TJobAndChannel& JobAndChannel)
+{
+	TJobArenaScope ArenaScope;
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	auto DatabaseName = Job.mParams.GetParamAs<std::string>("database");
+	auto Database = GetFeatureDatabase( DatabaseName, false );
+	if ( !Database )
+	{
+		Error << "Unknown feature database \"" << DatabaseName << "\"";
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	//	query with explicit features, or every grid feature of a frame
+	Array<TFeatureMatch> Queries;
+	auto FeaturesString = Job.mParams.GetParamAsWithDefault<std::string>("features", std::string() );
+	if ( !FeaturesString.empty() )
+	{
+		Array<TFeatureBinRing> Features;
+		FeatureSearch::ParseFeatures( GetArrayBridge(Features), FeaturesString, Error );
+		for ( int f=0;	f<Features.GetSize();	f++ )
+		{
+			auto& Query = Queries.PushBack();
+			Query.mCoord = vec2x<int>(-1,-1);
+			Query.mFeature = Features[f];
+		}
+	}
+	else
+	{
+		SoyPixels Image;
+		FeatureSearch::TRegion Region;
+		std::stringstream ImageError;
+		if ( !GetImageParam( Image, Job.mParams, "image", ImageError ) )
+			Error << "Expected features or image param";
+		else if ( GetFeatureRegion( Region, Job.mParams, Error ) )
+			FeatureSearch::GetGridFeatures( GetArrayBridge(Queries), Image, TFeatureBinRingParams( Job.mParams ), Region, Error );
+	}
+	
+	static int DefaultMaxDistance = 16;
+	static int DefaultMaxResults = 1;
+	int MaxDistance = Job.mParams.GetParamAsWithDefault("maxdistance", DefaultMaxDistance );
+	int MaxResults = Job.mParams.GetParamAsWithDefault("maxresults", DefaultMaxResults );
+	
+	//	one line per match; queryindex,x,y,id,distance
+	std::stringstream Output;
+	if ( Error.str().empty() )
+	{
+		//	matches only read, so run alongside each other
+		TReadLock Lock( Database->mLock );
+		Array<TFeatureDatabaseMatch> Matches;
+		for ( int q=0;	q<Queries.GetSize();	q++ )
+		{
+			auto& Query = Queries[q];
+			TFeatureBits Bits;
+			if ( !FeatureBits::Pack( Bits, Query.mFeature ) )
+				continue;
+			Matches.Clear(false);
+			Database->FindNearest( GetArrayBridge(Matches), Bits, MaxDistance, MaxResults );
+			for ( int m=0;	m<Matches.GetSize();	m++ )
+			{
+				auto& Match = Matches[m];
+				Output << q << ',' << Query.mCoord.x << ',' << Query.mCoord.y << ',' << Database->GetId( Match.mIndex ) << ',' << Match.mDistance << Soy::lf;
+			}
+		}
+	}
+	
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	else
+		Reply.mParams.AddDefaultParam( Output.str() );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnSaveDatabase(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	auto DatabaseName = Job.mParams.GetParamAs<std::string>("database");
+	auto Filename = Job.mParams.GetParamAs<std::string>("filename");
+	auto Database = GetFeatureDatabase( DatabaseName, false );
+	if ( !Database )
+	{
+		Error << "Unknown feature database \"" << DatabaseName << "\"";
+	}
+	else if ( mFileRoot.GetNewPath( Filename, Error ) )
+	{
+		TReadLock Lock( Database->mLock );
+		Database->Save( Filename, Error );
+	}
+	
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	else
+		Reply.mParams.AddDefaultParam( Filename );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnLoadDatabase(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	auto DatabaseName = Job.mParams.GetParamAs<std::string>("database");
+	auto Filename = Job.mParams.GetParamAs<std::string>("filename");
+	
+	//	loaded on the side and only registered (replacing any existing database) if it succeeds
+	std::shared_ptr<TFeatureDatabase> Database( new TFeatureDatabase() );
+	if ( mFileRoot.GetPath( Filename, Error ) && Database->Load( Filename, Error ) )
+	{
+		std::lock_guard<std::mutex> Lock( mFeatureDatabasesLock );
+		mFeatureDatabases[DatabaseName] = Database;
+	}
+	
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	else
+		Reply.mParams.AddDefaultParam( static_cast<int>( Database->GetSize() ) );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+TPopAppError::Type RunServer(const std::string& HttpChannelString,bool Stdio,std::shared_ptr<TSharedFrameRing> FrameStore,const std::string& FrameStoreName,const std::string& FileRoot)
+{
+	TPopOpencv App;
+	App.mFrameStore = FrameStore;
+	App.mFrameStoreName = FrameStoreName;
+	
+	//	image=file: params and jobs naming files are off unless a directory is given to confine them to
+	if ( !FileRoot.empty() )
+	{
+		std::stringstream Error;
+		if ( !App.mMappedImages.SetRoot( FileRoot, Error ) || !App.mFileRoot.SetRoot( FileRoot, Error ) )
+		{
+			std::Debug << Error.str() << std::endl;
+			return TPopAppError::InitError;
+		}
+	}
+
+	
+	//	create stdio channel for commandline output. Workers share the supervisor's terminal, so don't read it
+	if ( Stdio )
+	{
+		auto StdioChannel = CreateChannelFromInputString("std:", SoyRef("stdio") );
+		App.AddChannel( StdioChannel );
+	}
+	auto HttpChannel = CreateChannelFromInputString( HttpChannelString, SoyRef("http") );
+	App.AddChannel( HttpChannel );
+	App.SetSingleReplyChannel( *HttpChannel );
+	
+	
+	//	bootup commands via a channel
+	std::shared_ptr<TChannel> BootupChannel( new TChan<TChannelFileRead,TProtocolCli>( SoyRef("Bootup"), "bootup.txt" ) );
+	
+	//	display reply to stdout
+	//	when the commandline SENDs a command (a reply), send it to stdout
+	auto RelayFunc = [](TJobAndChannel& JobAndChannel)
+	{
+		std::Debug << JobAndChannel.GetJob().mParams << std::endl;
+	};
+	//BootupChannel->mOnJobRecieved.AddListener( RelayFunc );
+	BootupChannel->mOnJobSent.AddListener( RelayFunc );
+	BootupChannel->mOnJobLost.AddListener( RelayFunc );
+	
+	App.AddChannel( BootupChannel );
+	
+	
+	
+
+	
+	//	run
+	App.mConsoleApp.WaitForExit();
+
+	return TPopAppError::Success;
+}
+
+
+TPopAppError::Type PopMain(TJobParams& Params)
+{
+	//	workers=N forks a server per port from 8080 up, and restarts any that crash
+	TWorkerSupervisorParams SupervisorParams;
+	SupervisorParams.mWorkerCount = Params.GetParamAsWithDefault("workers", SupervisorParams.mWorkerCount );
+	auto FileRoot = Params.GetParamAsWithDefault<std::string>("fileroot", std::string() );
+	if ( SupervisorParams.mWorkerCount <= 0 )
+		return RunServer( "http:8080-8090", true, nullptr, std::string(), FileRoot );
+	
+	SupervisorParams.mFirstPort = Params.GetParamAsWithDefault("firstport", SupervisorParams.mFirstPort );
+	SupervisorParams.mLastPort = SupervisorParams.mFirstPort + 10;
+	SupervisorParams.mCoresPerWorker = Params.GetParamAsWithDefault("corespergroup", SupervisorParams.mCoresPerWorker );
+	
+	//	the frame store is made here so the workers inherit its writable mapping
+	std::shared_ptr<TSharedFrameRing> FrameStore;
+	auto FrameStoreName = Params.GetParamAsWithDefault<std::string>("framestore", std::string("frames") );
+	int FrameStoreSlots = Params.GetParamAsWithDefault("framestoreslots", 64 );
+	int FrameStoreSize = Params.GetParamAsWithDefault("framestoresize", 1920*1080*4 );
+	{
+		std::stringstream Error;
+		FrameStore.reset( new TSharedFrameRing() );
+		if ( !FrameStore->Create( FrameStoreName, FrameStoreSlots, FrameStoreSize, Error ) )
+		{
+			std::Debug << Error.str() << "; workers won't share frames" << std::endl;
+			FrameStore.reset();
+		}
+	}
+	
+	auto WorkerMain = [&FrameStore,&FrameStoreName,&FileRoot](int Worker,int Port)
+	{
+		std::stringstream HttpChannelString;
+		HttpChannelString << "http:" << Port;
+		auto Result = RunServer( HttpChannelString.str(), false, FrameStore, FrameStoreName, FileRoot );
+		return Result == TPopAppError::Success ? 0 : 1;
+	};
+	
+	TWorkerSupervisor Supervisor( SupervisorParams, WorkerMain );
+	std::stringstream Error;
+	if ( !Supervisor.Run( Error ) )
+	{
+		std::Debug << Error.str() << std::endl;
+		return TPopAppError::InitError;
+	}
+	return TPopAppError::Success;
+}
+
+
+
+
+
+
+void TPopOpencv::OnProcessSequence(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	//	every frame is run through the same job, with the params sent with this one
+	auto JobName = Job.mParams.GetParamAsWithDefault<std::string>("job", std::string("findinterestingfeatures") );
+	if ( JobName != "findinterestingfeatures" )
+		Error << "processsequence only supports job=findinterestingfeatures, not " << JobName;
+	
+	//	both named by the client, so both must be under fileroot=. A sequence's frames needn't exist yet, only its directory
+	auto Input = Job.mParams.GetParamAs<std::string>("input");
+	auto Output = Job.mParams.GetParamAs<std::string>("output");
+	if ( Error.str().empty() )
+	{
+		if ( TFramePattern::HasConversion( Input ) )
+			mFileRoot.GetNewPath( Input, Error );
+		else
+			mFileRoot.GetPath( Input, Error );
+	}
+	
+	//	check the output before spending time decoding frames there's nowhere to write
+	if ( Error.str().empty() && mFileRoot.GetPath( Output, Error ) )
+	{
+		struct stat Info;
+		if ( stat( Output.c_str(), &Info ) != 0 || !S_ISDIR( Info.st_mode ) )
+			Error << "output " << Output << " is not a directory";
+	}
+	
+	std::vector<std::string> Filenames;
+	if ( Error.str().empty() )
+	{
+		int First = Job.mParams.GetParamAsWithDefault("first", 0 );
+		int Count = Job.mParams.GetParamAsWithDefault("count", 0 );
+		SequenceProcessor::GetInputFilenames( Filenames, Input, First, Count, Error );
+	}
+	
+	//	a listed frame could still be a link out of the root
+	for ( int i=0;	i<Filenames.size() && Error.str().empty();	i++ )
+	{
+		auto Filename = Filenames[i];
+		mFileRoot.GetPath( Filename, Error );
+	}
+	
+	FeatureSearch::TRegion Region;
+	if ( Error.str().empty() )
+		GetFeatureRegion( Region, Job.mParams, Error );
+	
+	if ( !Error.str().empty() )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	TSequenceParams Params;
+	Params.mOutputDirectory = Output;
+	Params.mDecodeThreads = Job.mParams.GetParamAsWithDefault("decodethreads", Params.mDecodeThreads );
+	Params.mExtractThreads = Job.mParams.GetParamAsWithDefault("extractthreads", Params.mExtractThreads );
+	Params.mQueueDepth = Job.mParams.GetParamAsWithDefault("queuedepth", Params.mQueueDepth );
+	Params.mAsBinary = Job.mParams.GetParamAsWithDefault("asbinary", Params.mAsBinary );
+	
+	TFeatureBinRingParams FeatureParams( Job.mParams );
+	int MaxFeatures = Job.mParams.GetParamAsWithDefault("maxfeatures", 0 );
+	int NmsRadius = Job.mParams.GetParamAsWithDefault("nmsradius", 0 );
+	auto Extract = [&](TSequenceFrame& Frame)
+	{
+		TJobArenaScope ArenaScope;
+		FeatureSearch::GetGridFeatures( GetArrayBridge( Frame.mFeatures ), Frame.mImage, FeatureParams, Region, Frame.mError );
+		FilterInterestingFeatures( GetArrayBridge( Frame.mFeatures ), FeatureParams, NmsRadius, MaxFeatures );
+	};
+	
+	//	blocks until the whole sequence is done; a bootup file of these runs them back to back
+	auto Start = std::chrono::steady_clock::now();
+	TSequenceStats Stats;
+	SequenceProcessor::Run( Filenames, Extract, Params, Stats );
+	auto ElapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - Start ).count();
+	
+	std::stringstream Summary;
+	Summary << Stats.mFramesWritten << "/" << Filenames.size() << " frames in " << ElapsedMs << "ms. ";
+	Summary << "decode " << Stats.mDecodeUs/1000 << "ms, extract " << Stats.mExtractUs/1000 << "ms, write " << Stats.mWriteUs/1000 << "ms (summed over threads)";
+	Reply.mParams.AddDefaultParam( Summary.str() );
+	Reply.mParams.AddParam("frames", static_cast<int>( Stats.mFramesWritten ) );
+	Reply.mParams.AddParam("failed", static_cast<int>( Stats.mFramesFailed ) );
+	Reply.mParams.AddParam("elapsedms", static_cast<int>( ElapsedMs ) );
+	if ( Stats.mFramesFailed > 0 )
+		Reply.mParams.AddErrorParam( Stats.mErrors.str() );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnRecord(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	//	record filename=xxx (under fileroot=) starts a new log, record without a filename stops
+	auto Filename = Job.mParams.GetParamAsWithDefault<std::string>("filename", std::string() );
+	if ( Filename.empty() )
+	{
+		mJobRecorder.Stop();
+		std::stringstream Output;
+		Output << "Stopped recording; " << mJobRecorder.GetRecordCount() << " jobs";
+		Reply.mParams.AddDefaultParam( Output.str() );
+	}
+	else if ( mFileRoot.GetNewPath( Filename, Error ) && mJobRecorder.Start( Filename, Error ) )
+	{
+		Reply.mParams.AddDefaultParam( std::string("Recording jobs to ") + Filename );
+	}
+	else
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+	}
+	
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnReplay(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	std::stringstream Error;
+	
+	auto Filename = Job.mParams.GetParamAs<std::string>("filename");
+	std::vector<TJobRecord> Records;
+	if ( mFileRoot.GetPath( Filename, Error ) )
+		JobLog::Read( Records, Filename, Error );
+	
+	//	rate=original plays back with the recorded timing, max back to back, or a number multiplies the original rate
+	auto RateString = Job.mParams.GetParamAsWithDefault<std::string>("rate", std::string("original") );
+	float RateMultiplier = 1.f;
+	if ( RateString == "max" )
+		RateMultiplier = 0.f;
+	else if ( RateString != "original" && ( !Soy::StringToType( RateMultiplier, RateString ) || RateMultiplier <= 0.f ) )
+		Error << "rate should be original, max or a multiplier, not " << RateString;
+	
+	if ( !Error.str().empty() )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	int ThreadCount = std::max( 1, Job.mParams.GetParamAsWithDefault("threads", 1 ) );
+	//	a replay is for measuring; jobs that write files or change the server's state are skipped unless sideeffects=1
+	bool AllowSideEffects = Job.mParams.GetParamAsWithDefault("sideeffects", false );
+	TJobLatencyStats Stats;
+	std::atomic<int> NextRecord( 0 );
+	std::atomic<int> Unhandled( 0 );
+	std::atomic<int> Skipped( 0 );
+	auto ReplayStart = std::chrono::steady_clock::now();
+	auto FirstTimeUs = Records[0].mTimeUs;
+	TChannel& Channel = JobAndChannel;
+	
+	auto ReplayThread = [&]
+	{
+		for ( int r=NextRecord++;	r<Records.size();	r=NextRecord++ )
+		{
+			auto& Record = Records[r];
+			if ( !JobLog::IsReplayable( Record, AllowSideEffects ) )
+			{
+				Skipped++;
+				continue;
+			}
+			
+			//	latency is measured from when the job was due, so falling behind the schedule counts as queueing time
+			auto Due = std::chrono::steady_clock::now();
+			if ( RateMultiplier > 0.f )
+			{
+				Due = ReplayStart + std::chrono::microseconds( static_cast<int64>( (Record.mTimeUs - FirstTimeUs) / RateMultiplier ) );
+				std::this_thread::sleep_until( Due );
+			}
+			
+			auto Handler = mJobHandlers.find( Record.mCommand );
+			if ( Handler == mJobHandlers.end() )
+			{
+				Unhandled++;
+				continue;
+			}
+			
+			TJob ReplayJob;
+			JobLog::GetJob( ReplayJob, Record );
+			TJobAndChannel ReplayJobAndChannel( ReplayJob, Channel );
+			TJobReplyCapture Capture;
+			(this->*Handler->second)( ReplayJobAndChannel );
+			auto Done = Capture.mReplyCount > 0 ? Capture.mReplyTime : std::chrono::steady_clock::now();
+			Stats.Add( Record.mCommand, std::chrono::duration_cast<std::chrono::microseconds>( Done - Due ).count() / 1000.f );
+		}
+	};
+	
+	std::vector<std::thread> Threads;
+	for ( int t=0;	t<ThreadCount;	t++ )
+		Threads.push_back( std::thread( ReplayThread ) );
+	for ( auto& Thread : Threads )
+		Thread.join();
+	auto ElapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - ReplayStart ).count();
+	
+	std::stringstream Output;
+	Output << "Replayed " << Records.size() << " jobs (" << Unhandled << " unhandled, " << Skipped << " skipped) in " << ElapsedMs << "ms at rate=" << RateString << " threads=" << ThreadCount << Soy::lf;
+	Stats.GetSummary( Output, ElapsedMs / 1000.f );
+	Reply.mParams.AddDefaultParam( Output.str() );
+	Reply.mParams.AddParam("elapsedms", static_cast<int>( ElapsedMs ) );
+	Reply.mParams.AddParam("skipped", static_cast<int>( Skipped ) );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+//	XxY,XxY...
+bool ParsePoints(Array<vec2f>& Points,const std::string& PointsString,std::stringstream& Error)
+{
+	auto AppendPoint = [&Error,&Points](const std::string& PointString)
+	{
+		vec2f Point;
+		if ( !Soy::StringToType( Point, PointString ) )
+		{
+			Error << "Failed to parse \"" << PointString << "\" to XxY";
+			return false;
+		}
+		Points.PushBack( Point );
+		return true;
+	};
+	return Soy::StringSplitByMatches( AppendPoint, PointsString, ",", false );
+}
+
+
+Opencv::TOpticalFlowParams GetOpticalFlowParams(TJobParams& JobParams)
+{
+	Opencv::TOpticalFlowParams Params;
+	Params.mWindowSize = JobParams.GetParamAsWithDefault("windowsize", Params.mWindowSize );
+	Params.mMaxLevel = JobParams.GetParamAsWithDefault("maxlevel", Params.mMaxLevel );
+	Params.mMaxIterations = JobParams.GetParamAsWithDefault("iterations", Params.mMaxIterations );
+	Params.mEpsilon = JobParams.GetParamAsWithDefault("epsilon", Params.mEpsilon );
+	return Params;
+}
+
+
+bool TPopOpencv::GetFlowPreviousImage(SoyPixels& Image,bool& HasImage,TJobParams& Params,std::stringstream& Error)
+{
+	HasImage = false;
+	auto StreamName = Params.GetParamAsWithDefault<std::string>("stream", std::string() );
+	if ( StreamName.empty() )
+	{
+		std::stringstream ImageError;
+		if ( !GetImageParam( Image, Params, "previous", ImageError ) )
+		{
+			Error << "Expected previous= to find features in before opticalflow; " << ImageError.str();
+			return false;
+		}
+		HasImage = true;
+		return true;
+	}
+	
+	//	same rules as GetFlowPyramids; a new frame makes the current one previous
+	auto FlowParams = GetOpticalFlowParams( Params );
+	auto Stream = GetFlowStream( StreamName );
+	std::shared_ptr<Opencv::TFlowPyramid> Pyramid;
+	{
+		std::lock_guard<std::mutex> Lock( Stream->mLock );
+		int Frame = Params.GetParamAsWithDefault("frame", -1 );
+		if ( Stream->IsCurrentFrame( Frame ) )
+		{
+			if ( !Stream->mCurrent->IsCompatible( FlowParams ) )
+			{
+				Error << "Frame " << Frame << " is the stream's current frame, built with windowsize=" << Stream->mCurrent->mWindowSize;
+				return false;
+			}
+			Pyramid = Stream->mPrevious;
+		}
+		else
+		{
+			Pyramid = Stream->GetNewFramePrevious( FlowParams );
+		}
+	}
+	if ( !Pyramid || Pyramid->mLevels.empty() )
+		return true;
+	
+	try
+	{
+		if ( !Opencv::GetPixels( Image, Pyramid->mLevels[0] ) )
+		{
+			Error << "Failed to copy the stream's previous frame";
+			return false;
+		}
+	}
+	catch ( const Soy::AssertException& e )
+	{
+		Error << "Failed to copy the stream's previous frame; " << e.what();
+		return false;
+	}
+	HasImage = true;
+	return true;
+}
+
+
+void TPopOpencv::OnOpticalFlow(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	std::stringstream Error;
+	
+	//	points=XxY,... in pixels, or the coords of matches from a feature job
+	std::vector<cv::Point2f> Points;
+	auto PointsString = Job.mParams.GetParamAsWithDefault<std::string>("points", std::string() );
+	if ( !PointsString.empty() )
+	{
+		Array<vec2f> ParsedPoints;
+		ParsePoints( ParsedPoints, PointsString, Error );
+		for ( int p=0;	p<ParsedPoints.GetSize();	p++ )
+			Points.push_back( cv::Point2f( ParsedPoints[p].x, ParsedPoints[p].y ) );
+	}
+	else
+	{
+		auto Matches = Job.mParams.GetParamAs<Array<TFeatureMatch>>("matches");
+		for ( int m=0;	m<Matches.GetSize();	m++ )
+			Points.push_back( cv::Point2f( Matches[m].mCoord.x, Matches[m].mCoord.y ) );
+	}
+	if ( Points.empty() && Error.str().empty() )
+		Error << "Expected points= or matches=";
+	
+	auto Params = GetOpticalFlowParams( Job.mParams );
+	
+	std::shared_ptr<Opencv::TFlowPyramid> Previous;
+	std::shared_ptr<Opencv::TFlowPyramid> Next;
+	if ( Error.str().empty() )
+		GetFlowPyramids( Previous, Next, Job.mParams, Params, nullptr, Error );
+	
+	if ( !Error.str().empty() )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	//	first frame of a stream has nothing to flow from yet
+	if ( !Previous )
+	{
+		Reply.mParams.AddDefaultParam( std::string() );
+		Reply.mParams.AddParam("tracked", 0 );
+		Reply.mParams.AddParam("frame", static_cast<int>( Next ? Next->mFrame : -1 ) );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	if ( !Previous->IsCompatible( Params ) )
+		Error << "Previous frame's pyramid was built with windowsize=" << Previous->mWindowSize;
+	
+	std::vector<cv::Point2f> NewPoints;
+	std::vector<uint8> Status;
+	std::vector<float> Errors;
+	if ( Error.str().empty() )
+		Opencv::CalcOpticalFlow( NewPoints, Status, Errors, *Previous, *Next, Points, Params, Error );
+	
+	//	a line per point; x,y,status,error
+	std::stringstream Output;
+	int Tracked = 0;
+	for ( int p=0;	p<NewPoints.size() && p<Status.size() && p<Errors.size();	p++ )
+	{
+		Output << NewPoints[p].x << ',' << NewPoints[p].y << ',' << static_cast<int>( Status[p] ) << ',' << Errors[p] << Soy::lf;
+		Tracked += Status[p] ? 1 : 0;
+	}
+	
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	Reply.mParams.AddDefaultParam( Output.str() );
+	Reply.mParams.AddParam("tracked", Tracked );
+	Reply.mParams.AddParam("previousframe", static_cast<int>( Previous->mFrame ) );
+	Reply.mParams.AddParam("frame", static_cast<int>( Next->mFrame ) );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnPipeline(TJobAndChannel& JobAndChannel)
+{
+	//	transient allocations are released when the job is done
+	TJobArenaScope ArenaScope;
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	std::stringstream Error;
+	
+	//	stages=findfeature,gethomography; each stage reads the job's params and the previous stage's output.
+	//	Features found before opticalflow are found in the previous frame and flowed forward into image=
+	std::vector<std::string> StageNames;
+	auto AppendStage = [&StageNames](const std::string& Name)
+	{
+		StageNames.push_back( Name );
+		return true;
+	};
+	Soy::StringSplitByMatches( AppendStage, Job.mParams.GetParamAs<std::string>("stages"), ",", false );
+	for ( auto& Name : StageNames )
+	{
+		if ( mPipelineStages.find( Name ) == mPipelineStages.end() )
+			Error << "Unknown pipeline stage \"" << Name << "\"" << Soy::lf;
+	}
+	if ( StageNames.empty() )
+		Error << "No pipeline stages";
+	
+	TPipelineState State;
+	if ( Error.str().empty() )
+	{
+		std::stringstream ImageError;
+		State.mHasImage = GetImageParam( State.mImage, Job.mParams, "image", ImageError );
+		if ( State.mHasImage )
+		{
+			State.mWidth = State.mImage.GetWidth();
+			State.mHeight = State.mImage.GetHeight();
+		}
+		GetFeatureRegion( State.mRegion, Job.mParams, Error );
+		
+		//	features found before an opticalflow stage are the points it tracks, so they're found in the frame it
+		//	tracks from, not image= which it tracks to
+		auto FlowStage = std::find( StageNames.begin(), StageNames.end(), "opticalflow" );
+		auto IsDetectStage = [](const std::string& Name)	{	return Name == "findfeature" || Name == "findinterestingfeatures";	};
+		State.mDetectOnPrevious = std::any_of( StageNames.begin(), FlowStage, IsDetectStage ) && FlowStage != StageNames.end();
+		if ( State.mDetectOnPrevious && Error.str().empty() )
+			GetFlowPreviousImage( State.mPreviousImage, State.mHasPreviousImage, Job.mParams, Error );
+		
+		//	points=XxY,... seed a pipeline that doesn't start by finding features
+		auto PointsString = Job.mParams.GetParamAsWithDefault<std::string>("points", std::string() );
+		if ( !PointsString.empty() && ParsePoints( State.mPoints, PointsString, Error ) )
+		{
+			for ( int p=0;	p<State.mPoints.GetSize();	p++ )
+			{
+				auto& Match = State.mMatches.PushBack();
+				Match.mSourceCoord = vec2x<int>(-1,-1);
+				Match.mCoord = vec2x<int>( static_cast<int>( State.mPoints[p].x ), static_cast<int>( State.mPoints[p].y ) );
+				Match.mScore = 1.f;
+				State.mIndexes.push_back( p );
+			}
+		}
+	}
+	
+	int StagesRun = 0;
+	for ( int s=0;	Error.str().empty() && s<StageNames.size();	s++ )
+	{
+		auto Stage = mPipelineStages[StageNames[s]];
+		if ( !(this->*Stage)( State, Job.mParams, Error ) )
+		{
+			Error << " (stage " << s << " " << StageNames[s] << ")";
+			break;
+		}
+		StagesRun++;
+	}
+	Reply.mParams.AddParam("stages", StagesRun );
+	
+	if ( !Error.str().empty() )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	//	only the last result is encoded
+	if ( State.mHasHomography )
+	{
+		std::stringstream CameraOutput;
+		CameraOutput << "homography:";
+		CameraOutput << State.mHomography << Soy::lf;
+		Reply.mParams.AddDefaultParam( CameraOutput.str() );
+	}
+	else
+	{
+		AddFeatureMatchesParam( Reply, std::string(), State.mMatches, true, JobAndChannel );
+	}
+	
+	std::stringstream Indexes;
+	for ( int i=0;	i<State.mIndexes.size();	i++ )
+		Indexes << (i==0 ? "" : ",") << State.mIndexes[i];
+	Reply.mParams.AddParam("indexes", Indexes.str() );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+bool TPopOpencv::PipelineFindFeature(TPipelineState& State,TJobParams& Params,std::stringstream& Error)
+{
+	auto* Image = State.GetDetectImage();
+	if ( !Image )
+	{
+		//	first frame of a flow stream; nothing to track from yet
+		if ( State.mDetectOnPrevious )
+		{
+			State.mMatches.Clear(false);
+			State.mPoints.Clear(false);
+			State.mIndexes.clear();
+			return true;
+		}
+		Error << "findfeature needs an image";
+		return false;
+	}
+	
+	Array<TFeatureBinRing> Features;
+	if ( !FeatureSearch::ParseFeatures( GetArrayBridge(Features), Params.GetParamAs<std::string>("features"), Error ) )
+		return false;
+	
+	TFeatureBinRingParams FeatureParams( Params );
+	static float DefaultMinScore = 0.8f;
+	float MinScore = Params.GetParamAsWithDefault("minscore", DefaultMinScore );
+	std::vector<Array<TFeatureMatch>> FeatureMatches;
+	FeatureSearch::FindFeatureMatches( FeatureMatches, *Image, GetArrayBridge(Features), FeatureParams, MinScore, State.mRegion, Error );
+	if ( !Error.str().empty() )
+		return false;
+	
+	//	the best match of each feature; features with no match drop out
+	State.mMatches.Clear(false);
+	State.mPoints.Clear(false);
+	State.mIndexes.clear();
+	for ( int f=0;	f<FeatureMatches.size();	f++ )
+	{
+		auto& Matches = FeatureMatches[f];
+		int Best = -1;
+		for ( int m=0;	m<Matches.GetSize();	m++ )
+		{
+			if ( Best < 0 || Matches[m].mScore > Matches[Best].mScore )
+				Best = m;
+		}
+		if ( Best < 0 )
+			continue;
+		State.mMatches.PushBack( Matches[Best] );
+		State.mPoints.PushBack( vec2f( Matches[Best].mCoord.x, Matches[Best].mCoord.y ) );
+		State.mIndexes.push_back( f );
+	}
+	return true;
+}
+
+
+bool TPopOpencv::PipelineFindInterestingFeatures(TPipelineState& State,TJobParams& Params,std::stringstream& Error)
+{
+	auto* Image = State.GetDetectImage();
+	State.mMatches.Clear(false);
+	State.mPoints.Clear(false);
+	State.mIndexes.clear();
+	if ( !Image )
+	{
+		//	first frame of a flow stream; nothing to track from yet
+		if ( State.mDetectOnPrevious )
+			return true;
+		Error << "findinterestingfeatures needs an image";
+		return false;
+	}
+	
+	TFeatureBinRingParams FeatureParams( Params );
+	FeatureSearch::GetGridFeatures( GetArrayBridge( State.mMatches ), *Image, FeatureParams, State.mRegion, Error );
+	if ( !Error.str().empty() )
+		return false;
+	int MaxFeatures = Params.GetParamAsWithDefault("maxfeatures", 0 );
+	int NmsRadius = Params.GetParamAsWithDefault("nmsradius", 0 );
+	FilterInterestingFeatures( GetArrayBridge( State.mMatches ), FeatureParams, NmsRadius, MaxFeatures );
+	
+	for ( int m=0;	m<State.mMatches.GetSize();	m++ )
+	{
+		State.mPoints.PushBack( vec2f( State.mMatches[m].mCoord.x, State.mMatches[m].mCoord.y ) );
+		State.mIndexes.push_back( m );
+	}
+	return true;
+}
+
+
+bool TPopOpencv::PipelineOpticalFlow(TPipelineState& State,TJobParams& Params,std::stringstream& Error)
+{
+	auto FlowParams = GetOpticalFlowParams( Params );
+	std::shared_ptr<Opencv::TFlowPyramid> Previous;
+	std::shared_ptr<Opencv::TFlowPyramid> Next;
+	if ( !GetFlowPyramids( Previous, Next, Params, FlowParams, State.mHasImage ? &State.mImage : nullptr, Error ) )
+		return false;
+	if ( Next && !Next->mLevels.empty() )
+	{
+		State.mWidth = Next->mLevels[0].cols;
+		State.mHeight = Next->mLevels[0].rows;
+	}
+	
+	//	first frame of a stream; nothing is tracked yet
+	if ( !Previous )
+	{
+		State.mMatches.Clear(false);
+		State.mPoints.Clear(false);
+		State.mIndexes.clear();
+		return true;
+	}
+	if ( !Previous->IsCompatible( FlowParams ) )
+	{
+		Error << "Previous frame's pyramid was built with windowsize=" << Previous->mWindowSize;
+		return false;
+	}
+	
+	std::vector<cv::Point2f> Points;
+	for ( int p=0;	p<State.mPoints.GetSize();	p++ )
+		Points.push_back( cv::Point2f( State.mPoints[p].x, State.mPoints[p].y ) );
+	std::vector<cv::Point2f> NewPoints;
+	std::vector<uint8> Status;
+	std::vector<float> Errors;
+	if ( !Opencv::CalcOpticalFlow( NewPoints, Status, Errors, *Previous, *Next, Points, FlowParams, Error ) )
+		return false;
+	
+	//	lost points drop out
+	Array<TFeatureMatch> TrackedMatches;
+	Array<vec2f> TrackedPoints;
+	std::vector<int> TrackedIndexes;
+	for ( int p=0;	p<NewPoints.size() && p<Status.size();	p++ )
+	{
+		if ( !Status[p] )
+			continue;
+		auto& Match = TrackedMatches.PushBack();
+		Match = State.mMatches[p];
+		Match.mSourceCoord = Match.mCoord;
+		Match.mCoord = vec2x<int>( static_cast<int>( NewPoints[p].x + 0.5f ), static_cast<int>( NewPoints[p].y + 0.5f ) );
+		TrackedPoints.PushBack( vec2f( NewPoints[p].x, NewPoints[p].y ) );
+		TrackedIndexes.push_back( State.mIndexes[p] );
+	}
+	State.mMatches = TrackedMatches;
+	State.mPoints = TrackedPoints;
+	State.mIndexes.swap( TrackedIndexes );
+	return true;
+}
+
+
+bool TPopOpencv::PipelineGetHomography(TPipelineState& State,TJobParams& Params,std::stringstream& Error)
+{
+	//	pointsuv= has an entry per feature (or seed point); the matches that survived pick theirs by index
+	Array<vec2f> AllPointuvs;
+	if ( !ParsePoints( AllPointuvs, Params.GetParamAs<std::string>("pointsuv"), Error ) )
+		return false;
+	if ( State.mWidth <= 0 || State.mHeight <= 0 )
+	{
+		Error << "gethomography needs a frame before it";
+		return false;
+	}
+	
+	//	gethomography's points2D are normalised
+	Array<vec2f> Point2s;
+	Array<vec2f> Pointuvs;
+	for ( int p=0;	p<State.mPoints.GetSize();	p++ )
+	{
+		auto Index = State.mIndexes[p];
+		if ( Index < 0 || Index >= AllPointuvs.GetSize() )
+			continue;
+		Point2s.PushBack( vec2f( State.mPoints[p].x / State.mWidth, State.mPoints[p].y / State.mHeight ) );
+		Pointuvs.PushBack( AllPointuvs[Index] );
+	}
+	if ( Point2s.GetSize() < 4 )
+	{
+		Error << "Only " << Point2s.GetSize() << " points for the homography, need 4";
+		return false;
+	}
+	
+	State.mHasHomography = GetHomography( State.mHomography, Point2s, Pointuvs, Error );
+	return State.mHasHomography;
+}
+
+
+void TPopOpencv::OnBatch(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	std::stringstream Error;
+	
+	//	jobs=getfeature,getfeature,gethomography with N.xxx params for the Nth job. Other params are shared by every
+	//	job that doesn't have its own
+	std::vector<std::string> Commands;
+	auto AppendCommand = [&Commands](const std::string& Command)
+	{
+		Commands.push_back( Command );
+		return true;
+	};
+	Soy::StringSplitByMatches( AppendCommand, Job.mParams.GetParamAs<std::string>("jobs"), ",", false );
+	for ( int j=0;	j<Commands.size();	j++ )
+	{
+		auto& Command = Commands[j];
+		if ( Command == "batch" || Command == "replay" || Command == "exit" )
+			Error << "Job " << j << " (" << Command << ") can't be batched" << Soy::lf;
+	}
+	if ( Commands.empty() )
+		Error << "No jobs in batch";
+	
+	if ( !Error.str().empty() )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	std::vector<TJob> Jobs( Commands.size() );
+	for ( int j=0;	j<Jobs.size();	j++ )
+		Jobs[j].mParams.mCommand = Commands[j];
+	
+	std::vector<TJobParam> SharedParams;
+	for ( int p=0;	p<Job.mParams.mParams.GetSize();	p++ )
+	{
+		auto& Param = Job.mParams.mParams[p];
+		auto Dot = Param.mName.find('.');
+		int Index = -1;
+		if ( Dot == std::string::npos || !Soy::StringToType( Index, Param.mName.substr( 0, Dot ) ) )
+		{
+			if ( Param.mName != "jobs" && Param.mName != "serial" && Param.mName != "threads" )
+				SharedParams.push_back( Param );
+			continue;
+		}
+		if ( Index < 0 || Index >= Jobs.size() )
+			continue;
+		TJobParam JobParam = Param;
+		JobParam.mName = Param.mName.substr( Dot+1 );
+		Jobs[Index].mParams.AddParam( JobParam );
+	}
+	
+	//	shared images are decoded (or read out of shared memory) here, once, and every job gets the pixels
+	for ( auto& Param : SharedParams )
+	{
+		SoyPixels Pixels;
+		std::stringstream ImageError;
+		bool IsImage = Param.mName == "image" || Param.mName == "mask" || Param.mName == "previous";
+		if ( IsImage && !GetImageParam( Pixels, Job.mParams, Param.mName, ImageError ) )
+			IsImage = false;
+		
+		for ( auto& BatchJob : Jobs )
+		{
+			if ( BatchJob.mParams.HasParam( Param.mName ) )
+				continue;
+			if ( IsImage )
+				BatchJob.mParams.AddParam( Param.mName, Pixels );
+			else
+				BatchJob.mParams.AddParam( Param );
+		}
+	}
+	
+	//	jobs run concurrently on the pool, each with its replies captured, then go back together in order
+	int ThreadCount = std::min<int>( Jobs.size(), Job.mParams.GetParamAsWithDefault("threads", mBatchPool.GetThreadCount() ) );
+	ThreadCount = std::max( 1, ThreadCount );
+	std::vector<TJobParams> Replies( Jobs.size() );
+	TChannel& Channel = JobAndChannel;
+	
+	auto RunJob = [&](int j)
+	{
+		auto Handler = mJobHandlers.find( Commands[j] );
+		if ( Handler == mJobHandlers.end() )
+		{
+			Replies[j].AddErrorParam( std::string("Unknown job ") + Commands[j] );
+			return;
+		}
+		
+		//	a throwing job fails on its own, rather than taking the pool thread (and the server) with it
+		std::stringstream JobError;
+		TJobAndChannel BatchJobAndChannel( Jobs[j], Channel );
+		TJobReplyCapture Capture( true );
+		try
+		{
+			(this->*Handler->second)( BatchJobAndChannel );
+		}
+		catch ( const Soy::AssertException& e )
+		{
+			JobError << e.what();
+		}
+		catch ( const cv::Exception& e )
+		{
+			JobError << e.what();
+		}
+		catch ( const std::exception& e )
+		{
+			JobError << e.what();
+		}
+		catch ( ... )
+		{
+			JobError << "Unknown exception in " << Commands[j];
+		}
+		Replies[j] = Capture.mReply;
+		if ( !JobError.str().empty() )
+			Replies[j].AddErrorParam( JobError.str() );
+	};
+	
+	auto Start = std::chrono::steady_clock::now();
+	mBatchPool.Run( static_cast<int>( Jobs.size() ), ThreadCount, RunJob );
+	auto ElapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - Start ).count();
+	
+	//	the Nth job's params come back as N.xxx
+	int Failed = 0;
+	for ( int j=0;	j<Replies.size();	j++ )
+	{
+		auto& JobReply = Replies[j];
+		std::stringstream Prefix;
+		Prefix << j << '.';
+		for ( int p=0;	p<JobReply.mParams.GetSize();	p++ )
+		{
+			TJobParam Param = JobReply.mParams[p];
+			if ( Param.mName == TJobParam::Param_Error )
+				Failed++;
+			Param.mName = Prefix.str() + Param.mName;
+			Reply.mParams.AddParam( Param );
+		}
+	}
+	
+	Reply.mParams.AddParam("jobs", static_cast<int>( Jobs.size() ) );
+	Reply.mParams.AddParam("failed", Failed );
+	Reply.mParams.AddParam("elapsedms", static_cast<int>( ElapsedMs ) );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnStoreFrame(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	std::stringstream Error;
+	
+	//	decode once, then any worker can be sent image=shm:<store>/<slot>/<frame> instead of the image
+	SoyPixels Image;
+	if ( !mFrameStore )
+		Error << "No frame store; run with workers=N";
+	else
+		GetImageParam( Image, Job.mParams, "image", Error );
+	
+	if ( Error.str().empty() )
+	{
+		uint64 Frame = 0;
+		int Slot = mFrameStore->Write( Image, Frame, Error );
+		if ( Slot >= 0 )
+		{
+			std::stringstream Reference;
+			Reference << "shm:" << mFrameStoreName << "/" << Slot << "/" << Frame;
+			Reply.mParams.AddDefaultParam( Reference.str() );
+			Reply.mParams.AddParam("image", Reference.str() );
+		}
+	}
+	
+	if ( !Error.str().empty() )
+		Reply.mParams.AddErrorParam( Error.str() );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+std::shared_ptr<TCalibrationSession> TPopOpencv::GetCalibrationSession(const std::string& Name,TJobParams* CreateParams,std::stringstream& Error)
+{
+	auto Existing = mCalibrationSolver.GetSession( Name );
+	if ( Existing )
+		return Existing;
+	if ( !CreateParams )
+	{
+		Error << "No calibration session " << Name;
+		return nullptr;
+	}
+	
+	auto& JobParams = *CreateParams;
+	TCalibrationSessionParams Params;
+	static float imgw = 3000;
+	static float imgh = 2250;
+	Params.mCalibrateParams.mCameraImageSize = vec2f( imgw, imgh );
+	Params.mCalibrateParams.mMaxIterations = JobParams.GetParamAsWithDefault("maxiterations", Params.mCalibrateParams.mMaxIterations );
+	Params.mCalibrateParams.mEpsilon = JobParams.GetParamAsWithDefault("epsilon", Params.mCalibrateParams.mEpsilon );
+	Params.mMaxViews = JobParams.GetParamAsWithDefault("maxviews", Params.mMaxViews );
+	Params.mMinViews = JobParams.GetParamAsWithDefault("minviews", Params.mMinViews );
+	Params.mMinViewDifference = JobParams.GetParamAsWithDefault("minviewdifference", Params.mMinViewDifference );
+	Params.mSolveIntervalMs = JobParams.GetParamAsWithDefault("solveintervalms", Params.mSolveIntervalMs );
+	
+	//	each solve is registered so undistortframe etc always use the latest
+	auto CameraName = JobParams.GetParamAsWithDefault<std::string>("camera", std::string() );
+	auto OnSolved = [this,CameraName](const Soy::TCamera& Camera)
+	{
+		if ( !CameraName.empty() )
+			SetCamera( CameraName, Camera );
+	};
+	std::shared_ptr<TCalibrationSession> Session( new TCalibrationSession( Params, OnSolved ) );
+	return mCalibrationSolver.AddSession( Name, Session, Error );
+}
+
+
+void TPopOpencv::OnAddCalibrationView(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	std::stringstream Error;
+	
+	Opencv::TCalibrationView View;
+	if ( !ParseCalibrationPoints( View.mViewPoints, View.mWorldPoints, Job.mParams, Error ) )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	
+	//	the view is queued for the next solve; the reply doesn't wait for it
+	auto Session = GetCalibrationSession( Job.mParams.GetParamAs<std::string>("session"), &Job.mParams, Error );
+	if ( !Session )
+	{
+		Reply.mParams.AddErrorParam( Error.str() );
+		SendReply( JobAndChannel, Reply );
+		return;
+	}
+	bool Added = Session->AddView( View );
+	mCalibrationSolver.Wake();
+	TCalibrationSessionState State;
+	Session->GetState( State );
+	
+	Reply.mParams.AddDefaultParam( std::string( Added ? "view added" : "view replaced a similar view" ) );
+	Reply.mParams.AddParam("added", Added ? 1 : 0 );
+	Reply.mParams.AddParam("views", State.mViewCount );
+	Reply.mParams.AddParam("solves", State.mSolveCount );
+	if ( State.mHasCamera )
+		Reply.mParams.AddParam("CalibrationError", State.mCamera.mCalibrationError );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnGetCalibration(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	
+	auto SessionName = Job.mParams.GetParamAs<std::string>("session");
+	std::stringstream Error;
+	auto Session = GetCalibrationSession( SessionName, nullptr, Error );
+	TCalibrationSessionState State;
+	if ( Session )
+		Session->GetState( State );
+	
+	//	the latest solve, never waits for one in progress
+	if ( !Session )
+		Reply.mParams.AddErrorParam( Error.str() );
+	else if ( !State.mHasCamera )
+		Reply.mParams.AddErrorParam( std::string("No solve yet") + ( State.mSolveError.empty() ? "" : "; " ) + State.mSolveError );
+	else
+		AddCameraParams( Reply, State.mCamera, Job.mParams.GetParamAsWithDefault("asbinary", false ) );
+	
+	Reply.mParams.AddParam("views", State.mViewCount );
+	Reply.mParams.AddParam("viewsseen", State.mViewsSeen );
+	Reply.mParams.AddParam("solves", State.mSolveCount );
+	Reply.mParams.AddParam("solveviews", State.mSolveViewCount );
+	Reply.mParams.AddParam("solving", State.mSolving ? 1 : 0 );
+	if ( State.mHasCamera && !State.mSolveError.empty() )
+		Reply.mParams.AddParam("solveerror", State.mSolveError );
+	SendReply( JobAndChannel, Reply );
+}
+
+
+void TPopOpencv::OnEndCalibration(TJobAndChannel& JobAndChannel)
+{
+	auto& Job = JobAndChannel.GetJob();
+	TJobReply Reply( JobAndChannel );
+	Reply.mParams.AddParam( Job.mParams.GetParam("serial") );
+	
+	//	the solver thread lets the session go, so this doesn't wait for a solve in progress. The camera stays registered
+	auto SessionName = Job.mParams.GetParamAs<std::string>("session");
+	if ( mCalibrationSolver.EndSession( SessionName ) )
+		Reply.mParams.AddDefaultParam( std::string("Ended calibration session ") + SessionName );
+	else
+		Reply.mParams.AddErrorParam( std::string("No calibration session ") + SessionName );
+	SendReply( JobAndChannel, Reply );
+}
@@ -3,28 +3,203 @@
 #include <SoyApp.h>
 #include <TJob.h>
 #include <TChannel.h>
+#include <TParameters.h>
+#include <SoyPixels.h>
+#include <TFeatureBinRing.h>
+#include "CvCalibrateCamera.h"
+#include "CvUndistort.h"
+#include "CvDetector.h"
+#include "CvOpticalFlow.h"
+#include "TJobArena.h"
+#include "TFeatureDatabase.h"
+#include "FeatureSearch.h"
+#include "TFeatureStream.h"
+#include "TStreamCache.h"
+#include "TSequenceProcessor.h"
+#include "TJobRecorder.h"
+#include "TSharedFrameRing.h"
+#include "TReplyCompression.h"
+#include "TFeatureDictionary.h"
+#include "TWorkerSupervisor.h"
+#include "TMappedImage.h"
+#include "TFileRoot.h"
+#include "TCalibrationSession.h"
+#include "TJobWorkerPool.h"
+#include <atomic>
+#include <set>
 
 
 
 
+//	what pipeline stages hand to each other, kept native rather than re-encoded as params between stages
+class TPipelineState
+{
+public:
+	TPipelineState() :
+		mHasImage			( false ),
+		mHasPreviousImage	( false ),
+		mDetectOnPrevious	( false ),
+		mWidth				( 0 ),
+		mHeight				( 0 ),
+		mHasHomography		( false )
+	{
+	}
+	
+	//	the frame findfeature/findinterestingfeatures search; null if there isn't one
+	const SoyPixels*			GetDetectImage() const;
+	
+public:
+	SoyPixels					mImage;			//	decoded once for every stage
+	bool						mHasImage;
+	//	when an opticalflow stage follows, features are found in the frame it tracks from (previous=, or the
+	//	stream's previous frame) so the points flow forward into image=. A stream's first frame has none
+	SoyPixels					mPreviousImage;
+	bool						mHasPreviousImage;
+	bool						mDetectOnPrevious;
+	int							mWidth;			//	frame size, for stages that don't need the pixels
+	int							mHeight;
+	FeatureSearch::TRegion		mRegion;
+	
+	Array<TFeatureMatch>		mMatches;
+	Array<vec2f>				mPoints;		//	sub-pixel coords of the matches
+	std::vector<int>			mIndexes;		//	which feature/seed point each match is, so pointsuv= lines up after matches drop out
+	
+	Soy::Matrix3x3				mHomography;
+	bool						mHasHomography;
+};
+
+
 class TPopOpencv : public TJobHandler, public TPopJobHandler, public TChannelManager
 {
+public:
+	typedef void(TPopOpencv::*TJobHandlerFunc)(TJobAndChannel&);
+	typedef bool(TPopOpencv::*TPipelineStageFunc)(TPipelineState&,TJobParams&,std::stringstream&);
+	
 public:
 	TPopOpencv();
 	
 	virtual bool	AddChannel(std::shared_ptr<TChannel> Channel) override;
+	//	a channel that sends one reply per job (http), so can't stream partial replies
+	void			SetSingleReplyChannel(TChannel& Channel);
 
 	void			OnExit(TJobAndChannel& JobAndChannel);
 	void			OnGetFeature(TJobAndChannel& JobAndChannel);
 	void			OnFindFeature(TJobAndChannel& JobAndChannel);
+	void			OnFindFeatures(TJobAndChannel& JobAndChannel,const SoyPixels& Image,const std::string& FeaturesString,const FeatureSearch::TRegion& Region);
 	void			OnTrackFeatures(TJobAndChannel& JobAndChannel);
 	void			OnFindInterestingFeatures(TJobAndChannel& JobAndChannel);
 	void			OnNewFrame(TJobAndChannel& JobAndChannel);
 	void			OnCalibrateCamera(TJobAndChannel& JobAndChannel);
 	void			OnGetHomography(TJobAndChannel& JobAndChannel);
+	void			OnUndistortFrame(TJobAndChannel& JobAndChannel);
+	void			OnAddFeatures(TJobAndChannel& JobAndChannel);
+	void			OnMatchDatabase(TJobAndChannel& JobAndChannel);
+	void			OnSaveDatabase(TJobAndChannel& JobAndChannel);
+	void			OnLoadDatabase(TJobAndChannel& JobAndChannel);
+	void			OnProcessSequence(TJobAndChannel& JobAndChannel);
+	void			OnRecord(TJobAndChannel& JobAndChannel);
+	void			OnReplay(TJobAndChannel& JobAndChannel);
+	void			OnOpticalFlow(TJobAndChannel& JobAndChannel);
+	void			OnPipeline(TJobAndChannel& JobAndChannel);
+	void			OnBatch(TJobAndChannel& JobAndChannel);
+	void			OnStoreFrame(TJobAndChannel& JobAndChannel);
+	void			OnAddCalibrationView(TJobAndChannel& JobAndChannel);
+	void			OnGetCalibration(TJobAndChannel& JobAndChannel);
+	void			OnEndCalibration(TJobAndChannel& JobAndChannel);
+	
+	//	all replies go through here so replayed jobs can be captured rather than sent
+	void			SendReply(TJobAndChannel& JobAndChannel,TJobReply& Reply);
+	
+	//	progressive=1 jobs send a partial reply as each tile completes, with the job's serial, a sequence number
+	//	and the tile, then the usual reply with the sequence and number of partials
+	void			SendPartialReply(TJobAndChannel& JobAndChannel,TJobReply& Reply,int Sequence,const FeatureSearch::TRect& Tile);
+	//	progressive=1, and the job's replies can be streamed. Otherwise the job runs as if it wasn't set
+	bool			IsProgressive(TJobAndChannel& JobAndChannel);
+	int				GetProgressiveTileSize(TJobParams& Params);
+	//	FeatureSearch::FindFeatureMatches a tile at a time, sending each tile's matches as a partial reply. Returns the number of partials sent.
+	//	Named puts matches for features[n] in matchesN, otherwise they're the default param
+	int				FindFeatureMatchesProgressive(std::vector<Array<TFeatureMatch>>& Matches,const SoyPixels& Image,const ArrayBridge<TFeatureBinRing>& Features,const TFeatureBinRingParams& Params,float MinScore,const FeatureSearch::TRegion& Region,bool Named,TJobAndChannel& JobAndChannel,std::stringstream& Error);
+	
+	//	asdictionary/asjson/asbinary/generic encoding of matches. Empty name is the default param
+	void			AddFeatureMatchesParam(TJobReply& Reply,const std::string& ParamName,const Array<TFeatureMatch>& FeatureMatches,bool HasSource,TJobAndChannel& JobAndChannel);
+	
+	//	compress a payload if the job asked for it and it's big enough, adding the ratio/time to the reply.
+	//	Returns the payload to send, which is the original if it wasn't compressed
+	std::shared_ptr<SoyData>	CompressPayload(TJobReply& Reply,const std::string& ParamName,std::shared_ptr<SoyData_Stack<Array<char>>> Payload,TJobAndChannel& JobAndChannel);
+	std::shared_ptr<SoyData>	CompressPayload(TJobReply& Reply,const std::string& ParamName,std::shared_ptr<SoyData_Impl<json::Object>> Payload,TJobAndChannel& JobAndChannel);
+	TReplyCompressionParams		GetReplyCompression(TJobAndChannel& JobAndChannel);
+	
+	void			SetCamera(const std::string& Name,const Soy::TCamera& Camera);
+	bool			GetCamera(const std::string& Name,Soy::TCamera& Camera);
+	//	Generation changes each time the camera is set
+	bool			GetCamera(const std::string& Name,Soy::TCamera& Camera,uint64& Generation);
+	std::shared_ptr<TFeatureDatabase>	GetFeatureDatabase(const std::string& Name,bool Create);
+	//	a new session is made with the job's session params
+	std::shared_ptr<TCalibrationSession>	GetCalibrationSession(const std::string& Name,TJobParams* CreateParams,std::stringstream& Error);
+	
+	//	image params are either pixels, shm:<ring>/<slot>[/<frame>] for a frame a co-located process put in shared memory,
+	//	or file:<path> for a file under the server's fileroot=. A path with a %d is a sequence; the frame number is <name>frame= (or frame= for image)
+	bool			GetImageParam(SoyPixels& Pixels,TJobParams& Params,const std::string& Name,std::stringstream& Error);
+	
+	//	roi=x,y,w,h,... and mask=image/maskid=xxx params. A mask sent with a maskid is cached so later jobs only need the id
+	bool			GetFeatureRegion(FeatureSearch::TRegion& Region,TJobParams& Params,std::stringstream& Error);
+	std::shared_ptr<TFeatureStream>		GetFeatureStream(const std::string& Name);
+	std::shared_ptr<Opencv::TFlowStream>	GetFlowStream(const std::string& Name);
+	//	the frame GetFlowPyramids will use as Previous; HasImage is false for the first frame of a stream
+	bool			GetFlowPreviousImage(SoyPixels& Image,bool& HasImage,TJobParams& Params,std::stringstream& Error);
+	//	opticalflow frames; image= and previous=, or stream=xxx [frame=n]. Image is the job's image if it's already decoded
+	bool			GetFlowPyramids(std::shared_ptr<Opencv::TFlowPyramid>& Previous,std::shared_ptr<Opencv::TFlowPyramid>& Next,TJobParams& Params,const Opencv::TOpticalFlowParams& FlowParams,const SoyPixels* Image,std::stringstream& Error);
+	
+private:
+	//	registers with the job handler, and for replay
+	void			AddJob(const std::string& Name,const TParameterTraits& Traits,TJobHandlerFunc Handler);
+	
+	//	pipeline stages, named after the jobs they do the work of
+	bool			PipelineFindFeature(TPipelineState& State,TJobParams& Params,std::stringstream& Error);
+	bool			PipelineFindInterestingFeatures(TPipelineState& State,TJobParams& Params,std::stringstream& Error);
+	bool			PipelineOpticalFlow(TPipelineState& State,TJobParams& Params,std::stringstream& Error);
+	bool			PipelineGetHomography(TPipelineState& State,TJobParams& Params,std::stringstream& Error);
 	
 public:
 	Soy::Platform::TConsoleApp	mConsoleApp;
+	
+	std::map<std::string,TJobHandlerFunc>	mJobHandlers;
+	std::map<std::string,TPipelineStageFunc>	mPipelineStages;
+	TJobRecorder							mJobRecorder;
+	
+	//	channels live as long as the app, so they're never removed
+	std::mutex								mSingleReplyChannelsLock;
+	std::set<TChannel*>						mSingleReplyChannels;
+	
+	//	cameras registered by name with calibratecamera camera=xxx
+	std::mutex								mCamerasLock;
+	std::map<std::string,Soy::TCamera>		mCameras;
+	std::map<std::string,uint64>			mCameraGenerations;
+	Opencv::TUndistortMapCache				mUndistortMaps;
+	TReplyBufferCache						mReplyBuffers;
+	TJobWorkerPool							mBatchPool;
+	
+	std::mutex													mFeatureDatabasesLock;
+	std::map<std::string,std::shared_ptr<TFeatureDatabase>>		mFeatureDatabases;
+	
+	TSharedFrameRings											mSharedFrameRings;
+	TMappedImageReader											mMappedImages;
+	TFileRoot													mFileRoot;		//	for jobs naming files to read or write; processsequence, record, savedatabase...
+	//	made by the supervisor before forking, so every worker can put decoded frames where the others can read them
+	std::shared_ptr<TSharedFrameRing>							mFrameStore;
+	std::string													mFrameStoreName;
+	
+	FeatureSearch::TMaskCache									mMasks;
+	std::atomic<int>											mScoreNsPerFeature;	//	recent cost of FilterInterestingFeatures, for budgetms=
+	
+	//	findinterestingfeatures stream=xxx state
+	TStreamCache<TFeatureStream>								mFeatureStreams;
+	
+	//	addcalibrationview session=xxx
+	TCalibrationSolver											mCalibrationSolver;
+	
+	//	opticalflow stream=xxx pyramids
+	TStreamCache<Opencv::TFlowStream>							mFlowStreams;
 };
 
 
@@ -0,0 +1,304 @@
+#include "TCalibrationSession.h"
+#include <SoyAssert.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+
+namespace CalibrationSession
+{
+	//	centroid x,y and standard deviation x,y of the normalised view points
+	void	GetViewSpread(const Opencv::TCalibrationView& View,float Spread[4]);
+}
+
+
+void CalibrationSession::GetViewSpread(const Opencv::TCalibrationView& View,float Spread[4])
+{
+	auto& Points = View.mViewPoints;
+	float Count = std::max( 1.f, static_cast<float>( Points.GetSize() ) );
+	float SumX = 0.f;
+	float SumY = 0.f;
+	for ( int p=0;	p<Points.GetSize();	p++ )
+	{
+		SumX += Points[p].x;
+		SumY += Points[p].y;
+	}
+	Spread[0] = SumX / Count;
+	Spread[1] = SumY / Count;
+
+	float VarianceX = 0.f;
+	float VarianceY = 0.f;
+	for ( int p=0;	p<Points.GetSize();	p++ )
+	{
+		VarianceX += ( Points[p].x - Spread[0] ) * ( Points[p].x - Spread[0] );
+		VarianceY += ( Points[p].y - Spread[1] ) * ( Points[p].y - Spread[1] );
+	}
+	Spread[2] = sqrtf( VarianceX / Count );
+	Spread[3] = sqrtf( VarianceY / Count );
+}
+
+
+TCalibrationSession::TCalibrationSession(const TCalibrationSessionParams& Params,std::function<void(const Soy::TCamera&)> OnSolved) :
+	mParams			( Params ),
+	mOnSolved		( OnSolved ),
+	mViewsChanged	( false ),
+	mLastUsed		( std::chrono::steady_clock::now() )
+{
+	mParams.mMaxViews = std::max( 1, mParams.mMaxViews );
+	mParams.mMinViews = std::max( 1, std::min( mParams.mMinViews, mParams.mMaxViews ) );
+	mLastSolve = mLastUsed - std::chrono::milliseconds( mParams.mSolveIntervalMs );
+}
+
+
+float TCalibrationSession::GetViewDifference(const Opencv::TCalibrationView& a,const Opencv::TCalibrationView& b)
+{
+	float SpreadA[4];
+	float SpreadB[4];
+	CalibrationSession::GetViewSpread( a, SpreadA );
+	CalibrationSession::GetViewSpread( b, SpreadB );
+	float Difference = 0.f;
+	for ( int i=0;	i<4;	i++ )
+		Difference = std::max( Difference, fabsf( SpreadA[i] - SpreadB[i] ) );
+	return Difference;
+}
+
+
+bool TCalibrationSession::AddView(const Opencv::TCalibrationView& View)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	mLastUsed = std::chrono::steady_clock::now();
+	mState.mViewsSeen++;
+
+	//	a view like one we have doesn't add anything to the solve, but is fresher (and the newest view is the pose)
+	int Closest = -1;
+	float ClosestDifference = mParams.mMinViewDifference;
+	for ( int v=0;	v<mViews.size();	v++ )
+	{
+		float Difference = GetViewDifference( View, mViews[v] );
+		if ( Difference >= ClosestDifference )
+			continue;
+		Closest = v;
+		ClosestDifference = Difference;
+	}
+
+	bool Added = Closest < 0;
+	if ( !Added )
+		mViews.erase( mViews.begin() + Closest );
+	else if ( mViews.size() >= mParams.mMaxViews )
+		mViews.erase( mViews.begin() );
+	mViews.push_back( View );
+
+	mState.mViewCount = static_cast<int>( mViews.size() );
+	mViewsChanged = true;
+	return Added;
+}
+
+
+void TCalibrationSession::GetState(TCalibrationSessionState& State)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	mLastUsed = std::chrono::steady_clock::now();
+	State = mState;
+}
+
+
+bool TCalibrationSession::GetSolveDue(std::chrono::steady_clock::time_point& Due)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( !mViewsChanged || mViews.size() < mParams.mMinViews )
+		return false;
+	Due = mLastSolve + std::chrono::milliseconds( mParams.mSolveIntervalMs );
+	return true;
+}
+
+
+std::chrono::steady_clock::time_point TCalibrationSession::GetLastUsed()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	return mLastUsed;
+}
+
+
+void TCalibrationSession::Solve()
+{
+	//	views that arrived whilst waiting out the interval go into this solve
+	std::vector<Opencv::TCalibrationView> Views;
+	auto Params = mParams.mCalibrateParams;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		Views = mViews;
+		mViewsChanged = false;
+		mState.mSolving = true;
+		mLastSolve = std::chrono::steady_clock::now();
+		if ( mState.mHasCamera )
+		{
+			Params.mKnownCamera = mState.mCamera;
+			Params.mUseKnownCamera = true;
+		}
+	}
+
+	Soy::TCamera Camera;
+	std::string Error;
+	try
+	{
+		if ( !Opencv::CalibrateCamera( Camera, Params, Views ) )
+			Error = "Failed to calibrate camera";
+	}
+	catch ( const Soy::AssertException& e )
+	{
+		Error = e.what();
+	}
+	catch ( ... )
+	{
+		Error = "Unknown exception calibrating camera";
+	}
+
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mState.mSolving = false;
+		mState.mSolveError = Error;
+		if ( Error.empty() )
+		{
+			mState.mCamera = Camera;
+			mState.mHasCamera = true;
+			mState.mSolveCount++;
+			mState.mSolveViewCount = static_cast<int>( Views.size() );
+		}
+	}
+	if ( Error.empty() && mOnSolved )
+		mOnSolved( Camera );
+}
+
+
+TCalibrationSolver::TCalibrationSolver(const TCalibrationSolverParams& Params) :
+	mParams		( Params ),
+	mStopping	( false )
+{
+	mThread = std::thread( [this]	{	SolveThread();	} );
+}
+
+
+TCalibrationSolver::~TCalibrationSolver()
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mStopping = true;
+	}
+	mWake.notify_all();
+	if ( mThread.joinable() )
+		mThread.join();
+}
+
+
+std::shared_ptr<TCalibrationSession> TCalibrationSolver::GetSession(const std::string& Name)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Existing = mSessions.find( Name );
+	if ( Existing == mSessions.end() )
+		return nullptr;
+	return Existing->second;
+}
+
+
+std::shared_ptr<TCalibrationSession> TCalibrationSolver::AddSession(const std::string& Name,std::shared_ptr<TCalibrationSession> Session,std::stringstream& Error)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Existing = mSessions.find( Name );
+	if ( Existing != mSessions.end() )
+		return Existing->second;
+	
+	if ( mSessions.size() >= mParams.mMaxSessions )
+	{
+		EndIdleSessions();
+		if ( mSessions.size() >= mParams.mMaxSessions )
+		{
+			Error << "Too many calibration sessions (" << mParams.mMaxSessions << "), end one first";
+			return nullptr;
+		}
+	}
+	mSessions[Name] = Session;
+	return Session;
+}
+
+
+bool TCalibrationSolver::EndSession(const std::string& Name)
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		auto Existing = mSessions.find( Name );
+		if ( Existing == mSessions.end() )
+			return false;
+		mEnded.push_back( Existing->second );
+		mSessions.erase( Existing );
+	}
+	mWake.notify_all();
+	return true;
+}
+
+
+void TCalibrationSolver::Wake()
+{
+	//	the solver holds the lock from checking the sessions until it waits, so this can't land in between
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+	}
+	mWake.notify_all();
+}
+
+
+void TCalibrationSolver::EndIdleSessions()
+{
+	auto IdleBefore = std::chrono::steady_clock::now() - std::chrono::seconds( mParams.mIdleTimeoutSecs );
+	for ( auto it=mSessions.begin();	it!=mSessions.end();	)
+	{
+		if ( it->second->GetLastUsed() >= IdleBefore )
+		{
+			it++;
+			continue;
+		}
+		mEnded.push_back( it->second );
+		it = mSessions.erase( it );
+	}
+}
+
+
+void TCalibrationSolver::SolveThread()
+{
+	std::unique_lock<std::mutex> Lock( mLock );
+	while ( !mStopping )
+	{
+		//	let go of ended sessions here rather than on a job's thread
+		EndIdleSessions();
+		mEnded.clear();
+
+		//	the session that's been due longest, or when the next one will be
+		auto Now = std::chrono::steady_clock::now();
+		auto NextWake = Now + std::chrono::seconds( std::max( 1, mParams.mIdleTimeoutSecs ) );
+		std::shared_ptr<TCalibrationSession> Solve;
+		auto SolveDue = NextWake;
+		for ( auto& Session : mSessions )
+		{
+			std::chrono::steady_clock::time_point Due;
+			if ( !Session.second->GetSolveDue( Due ) )
+				continue;
+			if ( Due <= Now && ( !Solve || Due < SolveDue ) )
+			{
+				Solve = Session.second;
+				SolveDue = Due;
+			}
+			NextWake = std::min( NextWake, Due );
+		}
+
+		if ( !Solve )
+		{
+			mWake.wait_until( Lock, NextWake );
+			continue;
+		}
+
+		//	sessions can be added, used and ended whilst this one solves
+		Lock.unlock();
+		Solve->Solve();
+		Solve.reset();
+		Lock.lock();
+	}
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include "CvCalibrateCamera.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//	maxviews= minviews= minviewdifference= solveintervalms=
+class TCalibrationSessionParams
+{
+public:
+	TCalibrationSessionParams() :
+		mMaxViews			( 20 ),
+		mMinViews			( 3 ),
+		mMinViewDifference	( 0.05f ),
+		mSolveIntervalMs	( 500 )
+	{
+	}
+
+public:
+	Opencv::TCalibrateCameraParams	mCalibrateParams;
+	int		mMaxViews;				//	sliding window; the oldest view goes when a new one is added
+	int		mMinViews;				//	no solve until there are this many
+	float	mMinViewDifference;		//	normalised; a view closer than this to a held one replaces it rather than adding to the set
+	int		mSolveIntervalMs;		//	least time between the starts of two solves
+};
+
+
+//	what a client can have instantly, without waiting for a solve
+class TCalibrationSessionState
+{
+public:
+	TCalibrationSessionState() :
+		mHasCamera		( false ),
+		mViewCount		( 0 ),
+		mViewsSeen		( 0 ),
+		mSolveCount		( 0 ),
+		mSolveViewCount	( 0 ),
+		mSolving		( false )
+	{
+	}
+
+public:
+	bool			mHasCamera;
+	Soy::TCamera	mCamera;			//	latest successful solve
+	int				mViewCount;			//	views held
+	int				mViewsSeen;
+	int				mSolveCount;
+	int				mSolveViewCount;	//	views the camera was solved from
+	bool			mSolving;
+	std::string		mSolveError;		//	last solve's failure, cleared by a success
+};
+
+
+//	calibration from views streamed a frame at a time. The solver thread re-solves over the held views whenever they
+//	change, no more often than the solve interval, warm started from the previous solve so each one is a short refinement
+class TCalibrationSession
+{
+public:
+	TCalibrationSession(const TCalibrationSessionParams& Params,std::function<void(const Soy::TCamera&)> OnSolved);
+
+	//	returns true if the view added to the set, false if it replaced a similar one
+	bool			AddView(const Opencv::TCalibrationView& View);
+	void			GetState(TCalibrationSessionState& State);
+
+	//	for the solver. False if there's nothing new to solve, otherwise when the next solve can start
+	bool			GetSolveDue(std::chrono::steady_clock::time_point& Due);
+	std::chrono::steady_clock::time_point	GetLastUsed();
+	void			Solve();
+
+private:
+	//	how far apart two views' points are spread over the frame; centroid and extent
+	static float	GetViewDifference(const Opencv::TCalibrationView& a,const Opencv::TCalibrationView& b);
+
+private:
+	TCalibrationSessionParams					mParams;
+	std::function<void(const Soy::TCamera&)>	mOnSolved;
+
+	std::mutex									mLock;
+	std::vector<Opencv::TCalibrationView>		mViews;			//	oldest first
+	bool										mViewsChanged;
+	TCalibrationSessionState					mState;
+	std::chrono::steady_clock::time_point		mLastSolve;
+	std::chrono::steady_clock::time_point		mLastUsed;		//	by a job
+};
+
+
+class TCalibrationSolverParams
+{
+public:
+	TCalibrationSolverParams() :
+		mMaxSessions	( 16 ),
+		mIdleTimeoutSecs( 10*60 )
+	{
+	}
+
+public:
+	int		mMaxSessions;
+	int		mIdleTimeoutSecs;	//	sessions no job has used for this long are ended
+};
+
+
+//	owns the sessions by name, and one thread solves whichever are due in turn, so clients can't make a thread per
+//	session. Sessions are released on the solver thread, so ending one never waits for its solve
+class TCalibrationSolver
+{
+public:
+	TCalibrationSolver(const TCalibrationSolverParams& Params=TCalibrationSolverParams());
+	~TCalibrationSolver();
+
+	std::shared_ptr<TCalibrationSession>	GetSession(const std::string& Name);
+	//	returns the session now registered with the name; an existing one wins over Session. Null if there are
+	//	already the maximum number of sessions (after idle ones are ended)
+	std::shared_ptr<TCalibrationSession>	AddSession(const std::string& Name,std::shared_ptr<TCalibrationSession> Session,std::stringstream& Error);
+	bool			EndSession(const std::string& Name);
+	//	a session has new views
+	void			Wake();
+
+private:
+	void			SolveThread();
+	void			EndIdleSessions();		//	call with mLock held
+
+private:
+	TCalibrationSolverParams									mParams;
+	std::mutex													mLock;
+	std::condition_variable										mWake;
+	std::map<std::string,std::shared_ptr<TCalibrationSession>>	mSessions;
+	std::vector<std::shared_ptr<TCalibrationSession>>			mEnded;			//	released by the solver thread
+	bool														mStopping;
+	std::thread													mThread;
+};
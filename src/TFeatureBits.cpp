@@ -0,0 +1,205 @@
+#include "TFeatureBits.h"
+#include <TFeatureBinRing.h>
+#include <algorithm>
+
+//	the simd kernels are compiled for their instruction sets with target attributes and picked at runtime, so the
+//	shipped (baseline x86-64) build uses them on cpus that have them without needing per-file compiler flags
+#if defined(__x86_64__) && ( defined(__clang__) || defined(__GNUC__) )
+	#define FEATUREBITS_SIMD
+	#include <immintrin.h>
+#endif
+
+
+bool FeatureBits::Pack(TFeatureBits& Bits,const TFeatureBinRing& Feature)
+{
+	Bits = TFeatureBits();
+	auto& Bins = Feature.mBrighters;
+	auto BinCount = static_cast<int>( Bins.GetSize() );
+	if ( BinCount > TFeatureBits::MaxBits )
+		return false;
+	
+	for ( int b=0;	b<BinCount;	b++ )
+	{
+		if ( Bins[b] )
+			Bits.SetBit( b );
+	}
+	Bits.mBitCount = BinCount;
+	return Bits.IsValid();
+}
+
+
+int FeatureBits::GetHammingDistance(const TFeatureBits& a,const TFeatureBits& b)
+{
+	//	descriptors made with different params can't be compared
+	if ( a.mBitCount != b.mBitCount )
+		return std::max( a.mBitCount, b.mBitCount );
+	
+	int Distance = 0;
+	for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		Distance += __builtin_popcountll( a.mWords[w] ^ b.mWords[w] );
+	return Distance;
+}
+
+
+float FeatureBits::GetMatchScore(const TFeatureBits& a,const TFeatureBits& b)
+{
+	return GetMatchScore( GetHammingDistance( a, b ), a.mBitCount, b.mBitCount );
+}
+
+
+float FeatureBits::GetMatchScore(int Distance,int BitCountA,int BitCountB)
+{
+	int BitCount = std::max( BitCountA, BitCountB );
+	if ( BitCount == 0 )
+		return 0.f;
+	return 1.f - ( Distance / static_cast<float>( BitCount ) );
+}
+
+
+
+void TFeatureBitsBuffer::Clear()
+{
+	for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		mWords[w].clear();
+	mBitCounts.clear();
+}
+
+
+void TFeatureBitsBuffer::PushBack(const TFeatureBits& Bits)
+{
+	for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		mWords[w].push_back( Bits.mWords[w] );
+	mBitCounts.push_back( Bits.mBitCount );
+}
+
+
+TFeatureBits TFeatureBitsBuffer::GetBits(size_t Index) const
+{
+	TFeatureBits Bits;
+	for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		Bits.mWords[w] = mWords[w][Index];
+	Bits.mBitCount = mBitCounts[Index];
+	return Bits;
+}
+
+
+#if defined(FEATUREBITS_SIMD)
+//	popcount of each 64 bit lane; nibble lookup then sum bytes with sad
+__attribute__((target("avx2")))
+static inline __m256i Popcount64(__m256i v)
+{
+	const __m256i Lookup = _mm256_setr_epi8( 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 );
+	const __m256i LowMask = _mm256_set1_epi8( 0x0f );
+	__m256i Low = _mm256_and_si256( v, LowMask );
+	__m256i High = _mm256_and_si256( _mm256_srli_epi16( v, 4 ), LowMask );
+	__m256i Counts = _mm256_add_epi8( _mm256_shuffle_epi8( Lookup, Low ), _mm256_shuffle_epi8( Lookup, High ) );
+	return _mm256_sad_epu8( Counts, _mm256_setzero_si256() );
+}
+
+
+//	each kernel does whole blocks and returns how many candidates it did; the scalar loop does the rest
+__attribute__((target("avx2")))
+static size_t GetHammingDistancesAvx2(int* Distances,const TFeatureBits& Query,const TFeatureBitsBuffer& Candidates,size_t Count)
+{
+	size_t i = 0;
+	for ( ;	i+4<=Count;	i+=4 )
+	{
+		__m256i Sum = _mm256_setzero_si256();
+		for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		{
+			__m256i Words = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( &Candidates.mWords[w][i] ) );
+			__m256i Xor = _mm256_xor_si256( Words, _mm256_set1_epi64x( Query.mWords[w] ) );
+			Sum = _mm256_add_epi64( Sum, Popcount64( Xor ) );
+		}
+		//	counts are < 2^32 so take the low half of each lane
+		__m256i Packed = _mm256_permutevar8x32_epi32( Sum, _mm256_setr_epi32( 0, 2, 4, 6, 0, 0, 0, 0 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( &Distances[i] ), _mm256_castsi256_si128( Packed ) );
+	}
+	return i;
+}
+
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t GetHammingDistancesAvx512(int* Distances,const TFeatureBits& Query,const TFeatureBitsBuffer& Candidates,size_t Count)
+{
+	size_t i = 0;
+	for ( ;	i+8<=Count;	i+=8 )
+	{
+		__m512i Sum = _mm512_setzero_si512();
+		for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		{
+			__m512i Words = _mm512_loadu_si512( &Candidates.mWords[w][i] );
+			__m512i Xor = _mm512_xor_si512( Words, _mm512_set1_epi64( Query.mWords[w] ) );
+			Sum = _mm512_add_epi64( Sum, _mm512_popcnt_epi64( Xor ) );
+		}
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( &Distances[i] ), _mm512_cvtepi64_epi32( Sum ) );
+	}
+	return i;
+}
+#endif
+
+
+namespace FeatureBits
+{
+	typedef size_t(*THammingKernel)(int*,const TFeatureBits&,const TFeatureBitsBuffer&,size_t);
+	
+	struct TKernel
+	{
+		THammingKernel	mFunction;
+		const char*		mName;
+	};
+	
+	//	decided once, on first use
+	const TKernel&	GetKernel();
+}
+
+
+const FeatureBits::TKernel& FeatureBits::GetKernel()
+{
+	static const TKernel Kernel = []
+	{
+#if defined(FEATUREBITS_SIMD)
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq") )
+			return TKernel{ GetHammingDistancesAvx512, "avx512vpopcntdq" };
+		if ( __builtin_cpu_supports("avx2") )
+			return TKernel{ GetHammingDistancesAvx2, "avx2" };
+#endif
+		return TKernel{ nullptr, "scalar" };
+	}();
+	return Kernel;
+}
+
+
+void FeatureBits::GetHammingDistances(int* Distances,const TFeatureBits& Query,const TFeatureBitsBuffer& Candidates)
+{
+	size_t Count = Candidates.GetSize();
+	size_t i = 0;
+	
+	auto& Kernel = GetKernel();
+	if ( Kernel.mFunction )
+		i = Kernel.mFunction( Distances, Query, Candidates, Count );
+	
+	//	remainder (or everything without simd)
+	for ( ;	i<Count;	i++ )
+	{
+		int Distance = 0;
+		for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+			Distance += __builtin_popcountll( Candidates.mWords[w][i] ^ Query.mWords[w] );
+		Distances[i] = Distance;
+	}
+	
+	//	descriptors made with different params can't be compared
+	for ( i=0;	i<Count;	i++ )
+	{
+		auto CandidateBitCount = Candidates.mBitCounts[i];
+		if ( CandidateBitCount != Query.mBitCount )
+			Distances[i] = std::max( CandidateBitCount, Query.mBitCount );
+	}
+}
+
+
+const char* FeatureBits::GetHammingKernelName()
+{
+	return GetKernel().mName;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <SoyTypes.h>
+#include <vector>
+
+class TFeatureBinRing;
+
+
+//	TFeatureBinRing bins packed into a fixed width bit vector so comparisons are xor+popcount
+class TFeatureBits
+{
+public:
+	static const int	MaxBits = 256;
+	static const int	WordCount = MaxBits / 64;
+	
+public:
+	TFeatureBits() :
+		mBitCount	( 0 )
+	{
+		for ( int w=0;	w<WordCount;	w++ )
+			mWords[w] = 0;
+	}
+	
+	bool		IsValid() const			{	return mBitCount > 0;	}
+	void		SetBit(int Index)		{	mWords[Index/64] |= 1ull << (Index%64);	}
+	
+public:
+	uint64		mWords[WordCount];
+	int			mBitCount;
+};
+
+
+//	structure-of-arrays store of many descriptors; word N of every descriptor is contiguous
+//	so the matcher can xor+popcount several candidates per instruction
+class TFeatureBitsBuffer
+{
+public:
+	void		Clear();
+	void		PushBack(const TFeatureBits& Bits);
+	size_t		GetSize() const		{	return mBitCounts.size();	}
+	//	rebuild a single descriptor
+	TFeatureBits	GetBits(size_t Index) const;
+	
+public:
+	std::vector<uint64>	mWords[TFeatureBits::WordCount];
+	std::vector<int>	mBitCounts;
+};
+
+
+namespace FeatureBits
+{
+	//	fails if the ring has no bins or more than MaxBits
+	bool	Pack(TFeatureBits& Bits,const TFeatureBinRing& Feature);
+	
+	int		GetHammingDistance(const TFeatureBits& a,const TFeatureBits& b);
+	//	1 for identical, 0 for every bin different; the fraction of bins that agree. This is the score for every
+	//	packed search (features=, databases), and is not the same as TFeatureBinRing's own score used by feature=,
+	//	so the two aren't interchangeable against one minscore
+	float	GetMatchScore(const TFeatureBits& a,const TFeatureBits& b);
+	float	GetMatchScore(int Distance,int BitCountA,int BitCountB);
+	
+	//	distance from Query to every descriptor in Candidates. Distances must have room for Candidates.GetSize().
+	//	Uses AVX-512 VPOPCNTDQ or AVX2 when the cpu has them, otherwise scalar popcount
+	void	GetHammingDistances(int* Distances,const TFeatureBits& Query,const TFeatureBitsBuffer& Candidates);
+	const char*	GetHammingKernelName();
+};
+
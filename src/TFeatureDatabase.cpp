@@ -0,0 +1,302 @@
+#include "TFeatureDatabase.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+
+namespace FeatureDatabase
+{
+	const char		Magic[4] = { 'P', 'F', 'D', 'B' };
+	const uint32	Version = 1;
+	
+	uint16	GetSubstring(const uint64* Words,int Substring)
+	{
+		int Bit = Substring * TFeatureDatabase::SubstringBits;
+		return static_cast<uint16>( Words[Bit/64] >> (Bit%64) );
+	}
+	
+	uint16	GetSubstring(const TFeatureBitsBuffer& Buffer,int Index,int Substring)
+	{
+		int Bit = Substring * TFeatureDatabase::SubstringBits;
+		return static_cast<uint16>( Buffer.mWords[Bit/64][Index] >> (Bit%64) );
+	}
+	
+	int		GetDistance(const TFeatureBitsBuffer& Buffer,int Index,const TFeatureBits& Query)
+	{
+		int Distance = 0;
+		for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+			Distance += __builtin_popcountll( Buffer.mWords[w][Index] ^ Query.mWords[w] );
+		return Distance;
+	}
+	
+	//	de-dupes candidates found in several tables. Per thread so concurrent queries don't share it, and each
+	//	query takes a new stamp so it's only cleared when the stamp wraps
+	class TVisited
+	{
+	public:
+		TVisited() :
+			mStamp	( 0 )
+		{
+		}
+		
+		void	Begin(size_t EntryCount)
+		{
+			if ( mStamps.size() < EntryCount )
+				mStamps.resize( EntryCount, 0 );
+			if ( ++mStamp == 0 )
+			{
+				std::fill( mStamps.begin(), mStamps.end(), 0 );
+				mStamp = 1;
+			}
+		}
+		//	false if already visited this query
+		bool	Visit(uint32 Index)
+		{
+			if ( mStamps[Index] == mStamp )
+				return false;
+			mStamps[Index] = mStamp;
+			return true;
+		}
+		
+	private:
+		std::vector<uint32>	mStamps;
+		uint32				mStamp;
+	};
+	thread_local TVisited	Visited;
+	
+	template<typename TYPE>
+	void	Write(std::ofstream& File,const TYPE& Value)	{	File.write( reinterpret_cast<const char*>(&Value), sizeof(Value) );	}
+	template<typename TYPE>
+	bool	Read(std::ifstream& File,TYPE& Value)			{	File.read( reinterpret_cast<char*>(&Value), sizeof(Value) );	return File.good();	}
+}
+
+
+bool TFeatureDatabase::Add(const std::string& Id,const TFeatureBits& Bits,std::stringstream& Error)
+{
+	if ( !Bits.IsValid() )
+	{
+		Error << "Invalid feature for " << Id;
+		return false;
+	}
+	if ( mBitCount == 0 )
+		mBitCount = Bits.mBitCount;
+	if ( Bits.mBitCount != mBitCount )
+	{
+		Error << "Feature " << Id << " has " << Bits.mBitCount << " bins, database has " << mBitCount;
+		return false;
+	}
+	
+	mIds.push_back( Id );
+	mBits.PushBack( Bits );
+	AddToTables( static_cast<int>( mIds.size()-1 ) );
+	return true;
+}
+
+
+void TFeatureDatabase::AddToTables(int Index)
+{
+	for ( int s=0;	s<GetSubstringCount();	s++ )
+	{
+		auto Key = FeatureDatabase::GetSubstring( mBits, Index, s );
+		mTables[s][Key].push_back( Index );
+	}
+}
+
+
+void TFeatureDatabase::FindBruteForce(std::vector<TFeatureDatabaseMatch>& Candidates,const TFeatureBits& Query,int MaxDistance) const
+{
+	std::vector<int> Distances( mBits.GetSize() );
+	FeatureBits::GetHammingDistances( Distances.data(), Query, mBits );
+	for ( int i=0;	i<Distances.size();	i++ )
+	{
+		if ( Distances[i] > MaxDistance )
+			continue;
+		TFeatureDatabaseMatch Match;
+		Match.mIndex = i;
+		Match.mDistance = Distances[i];
+		Candidates.push_back( Match );
+	}
+}
+
+
+void TFeatureDatabase::FindMultiIndex(std::vector<TFeatureDatabaseMatch>& Candidates,const TFeatureBits& Query,int MaxDistance,int SubstringRadius) const
+{
+	auto& Visited = FeatureDatabase::Visited;
+	Visited.Begin( mIds.size() );
+	
+	auto VisitBucket = [&](int Substring,uint16 Key)
+	{
+		auto& Table = mTables[Substring];
+		auto Bucket = Table.find( Key );
+		if ( Bucket == Table.end() )
+			return;
+		for ( auto Index : Bucket->second )
+		{
+			if ( !Visited.Visit( Index ) )
+				continue;
+			int Distance = FeatureDatabase::GetDistance( mBits, Index, Query );
+			if ( Distance > MaxDistance )
+				continue;
+			TFeatureDatabaseMatch Match;
+			Match.mIndex = Index;
+			Match.mDistance = Distance;
+			Candidates.push_back( Match );
+		}
+	};
+	
+	for ( int s=0;	s<GetSubstringCount();	s++ )
+	{
+		auto Key = FeatureDatabase::GetSubstring( Query.mWords, s );
+		VisitBucket( s, Key );
+		if ( SubstringRadius < 1 )
+			continue;
+		for ( int a=0;	a<SubstringBits;	a++ )
+		{
+			uint16 KeyA = Key ^ (1<<a);
+			VisitBucket( s, KeyA );
+			if ( SubstringRadius < 2 )
+				continue;
+			for ( int b=a+1;	b<SubstringBits;	b++ )
+				VisitBucket( s, KeyA ^ (1<<b) );
+		}
+	}
+}
+
+
+void TFeatureDatabase::FindNearest(ArrayBridge<TFeatureDatabaseMatch>&& Matches,const TFeatureBits& Query,int MaxDistance,int MaxResults) const
+{
+	if ( mIds.empty() || Query.mBitCount != mBitCount )
+		return;
+	
+	std::vector<TFeatureDatabaseMatch> Candidates;
+	int SubstringRadius = MaxDistance / GetSubstringCount();
+	if ( SubstringRadius > MaxSubstringRadius )
+		FindBruteForce( Candidates, Query, MaxDistance );
+	else
+		FindMultiIndex( Candidates, Query, MaxDistance, SubstringRadius );
+	
+	auto Closer = [](const TFeatureDatabaseMatch& a,const TFeatureDatabaseMatch& b)
+	{
+		return a.mDistance < b.mDistance || ( a.mDistance == b.mDistance && a.mIndex < b.mIndex );
+	};
+	if ( Candidates.size() > MaxResults )
+	{
+		std::partial_sort( Candidates.begin(), Candidates.begin()+MaxResults, Candidates.end(), Closer );
+		Candidates.resize( MaxResults );
+	}
+	else
+	{
+		std::sort( Candidates.begin(), Candidates.end(), Closer );
+	}
+	
+	for ( auto& Candidate : Candidates )
+		Matches.PushBack( Candidate );
+}
+
+
+bool TFeatureDatabase::Save(const std::string& Filename,std::stringstream& Error)
+{
+	std::ofstream File( Filename, std::ios::binary | std::ios::trunc );
+	if ( !File.is_open() )
+	{
+		Error << "Failed to open " << Filename << " for writing";
+		return false;
+	}
+	
+	using namespace FeatureDatabase;
+	File.write( Magic, sizeof(Magic) );
+	Write( File, Version );
+	Write( File, static_cast<uint32>( mBitCount ) );
+	Write( File, static_cast<uint32>( mIds.size() ) );
+	for ( auto& Id : mIds )
+	{
+		Write( File, static_cast<uint32>( Id.length() ) );
+		File.write( Id.c_str(), Id.length() );
+	}
+	//	words are written column by column, same as they're stored
+	for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+		File.write( reinterpret_cast<const char*>( mBits.mWords[w].data() ), mBits.mWords[w].size() * sizeof(uint64) );
+	
+	if ( !File.good() )
+	{
+		Error << "Error writing " << Filename;
+		return false;
+	}
+	return true;
+}
+
+
+bool TFeatureDatabase::Load(const std::string& Filename,std::stringstream& Error)
+{
+	std::ifstream File( Filename, std::ios::binary );
+	if ( !File.is_open() )
+	{
+		Error << "Failed to open " << Filename;
+		return false;
+	}
+	
+	using namespace FeatureDatabase;
+	char FileMagic[sizeof(Magic)];
+	uint32 FileVersion = 0;
+	uint32 BitCount = 0;
+	uint32 Count = 0;
+	File.read( FileMagic, sizeof(FileMagic) );
+	if ( !File.good() || memcmp( FileMagic, Magic, sizeof(Magic) ) != 0 || !Read( File, FileVersion ) || FileVersion != Version )
+	{
+		Error << Filename << " is not a feature database snapshot";
+		return false;
+	}
+	//	an empty database is saved with no bit count yet, and loads as one that takes the first feature's
+	if ( !Read( File, BitCount ) || !Read( File, Count ) || ( BitCount == 0 ) != ( Count == 0 ) || BitCount > TFeatureBits::MaxBits )
+	{
+		Error << Filename << " has a corrupt header";
+		return false;
+	}
+	
+	//	every entry is at least an id length and its words, so a count the file can't hold is corrupt, not an allocation
+	uint64 HeaderEnd = static_cast<uint64>( File.tellg() );
+	File.seekg( 0, std::ios::end );
+	uint64 FileSize = static_cast<uint64>( File.tellg() );
+	File.seekg( HeaderEnd, std::ios::beg );
+	uint64 MinEntrySize = sizeof(uint32) + TFeatureBits::WordCount * sizeof(uint64);
+	if ( Count > ( FileSize - HeaderEnd ) / MinEntrySize )
+	{
+		Error << Filename << " claims " << Count << " entries but is only " << FileSize << " bytes";
+		return false;
+	}
+	
+	std::vector<std::string> Ids( Count );
+	for ( auto& Id : Ids )
+	{
+		uint32 Length = 0;
+		if ( !Read( File, Length ) || Length > FileSize - static_cast<uint64>( File.tellg() ) )
+		{
+			Error << Filename << " has a corrupt id";
+			return false;
+		}
+		Id.resize( Length );
+		File.read( &Id[0], Length );
+	}
+	TFeatureBitsBuffer Bits;
+	for ( int w=0;	w<TFeatureBits::WordCount;	w++ )
+	{
+		Bits.mWords[w].resize( Count );
+		File.read( reinterpret_cast<char*>( Bits.mWords[w].data() ), Count * sizeof(uint64) );
+	}
+	if ( !File.good() )
+	{
+		Error << Filename << " is truncated";
+		return false;
+	}
+	Bits.mBitCounts.assign( Count, BitCount );
+
+	//	replace contents and rebuild the tables
+	mBitCount = BitCount;
+	mIds.swap( Ids );
+	mBits = std::move( Bits );
+	for ( int s=0;	s<MaxSubstrings;	s++ )
+		mTables[s].clear();
+	for ( int i=0;	i<mIds.size();	i++ )
+		AddToTables( i );
+	return true;
+}
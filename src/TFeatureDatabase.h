@@ -0,0 +1,107 @@
+#pragma once
+
+#include "TFeatureBits.h"
+#include <array.hpp>
+#include <mutex>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+class TFeatureDatabaseMatch
+{
+public:
+	TFeatureDatabaseMatch() :
+		mIndex		( -1 ),
+		mDistance	( -1 )
+	{
+	}
+	
+public:
+	int			mIndex;		//	entry in database
+	int			mDistance;	//	hamming distance
+};
+
+
+//	many readers or one writer; lock()/unlock() are exclusive so std::lock_guard works for writing
+class TReadWriteLock
+{
+public:
+	TReadWriteLock()		{	pthread_rwlock_init( &mLock, nullptr );	}
+	~TReadWriteLock()		{	pthread_rwlock_destroy( &mLock );	}
+	
+	void	lock()			{	pthread_rwlock_wrlock( &mLock );	}
+	void	unlock()		{	pthread_rwlock_unlock( &mLock );	}
+	void	lock_shared()	{	pthread_rwlock_rdlock( &mLock );	}
+	void	unlock_shared()	{	pthread_rwlock_unlock( &mLock );	}
+	
+private:
+	TReadWriteLock(const TReadWriteLock&) = delete;
+	TReadWriteLock&	operator=(const TReadWriteLock&) = delete;
+	
+private:
+	pthread_rwlock_t	mLock;
+};
+
+class TReadLock
+{
+public:
+	TReadLock(TReadWriteLock& Lock) :
+		mLock	( Lock )
+	{
+		mLock.lock_shared();
+	}
+	~TReadLock()
+	{
+		mLock.unlock_shared();
+	}
+	
+private:
+	TReadWriteLock&		mLock;
+};
+
+
+//	descriptors with ids, searched in hamming space with multi-index hashing;
+//	the bits are split into 16 bit substrings each with its own table. Any descriptor within distance D of
+//	the query has at least one substring within D/SubstringCount bits of the query's, so only those buckets are probed
+class TFeatureDatabase
+{
+public:
+	static const int	SubstringBits = 16;
+	static const int	MaxSubstrings = TFeatureBits::MaxBits / SubstringBits;
+	static const int	MaxSubstringRadius = 2;		//	beyond this probing costs more than a brute force scan
+	
+public:
+	TFeatureDatabase() :
+		mBitCount	( 0 )
+	{
+	}
+	
+	bool				Add(const std::string& Id,const TFeatureBits& Bits,std::stringstream& Error);
+	//	nearest entries, closest first. Doesn't modify the database, so only needs mLock shared
+	void				FindNearest(ArrayBridge<TFeatureDatabaseMatch>&& Matches,const TFeatureBits& Query,int MaxDistance,int MaxResults) const;
+	size_t				GetSize() const			{	return mIds.size();	}
+	const std::string&	GetId(int Index) const	{	return mIds[Index];	}
+	
+	bool				Save(const std::string& Filename,std::stringstream& Error);
+	//	replaces the contents, which are untouched if it fails
+	bool				Load(const std::string& Filename,std::stringstream& Error);
+	
+private:
+	int					GetSubstringCount() const	{	return (mBitCount + SubstringBits - 1) / SubstringBits;	}
+	void				AddToTables(int Index);
+	void				FindBruteForce(std::vector<TFeatureDatabaseMatch>& Candidates,const TFeatureBits& Query,int MaxDistance) const;
+	void				FindMultiIndex(std::vector<TFeatureDatabaseMatch>& Candidates,const TFeatureBits& Query,int MaxDistance,int SubstringRadius) const;
+	
+public:
+	TReadWriteLock		mLock;
+	
+private:
+	int														mBitCount;		//	all entries must be the same length
+	std::vector<std::string>								mIds;
+	TFeatureBitsBuffer										mBits;
+	std::unordered_map<uint16,std::vector<uint32>>			mTables[MaxSubstrings];
+};
+
@@ -0,0 +1,105 @@
+#include "TFeatureDictionary.h"
+#include "TFeatureBits.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+
+namespace FeatureDictionary
+{
+	const char	Magic[4] = { 'P', 'F', 'D', 'D' };
+
+	class TBitsLess
+	{
+	public:
+		bool	operator()(const TFeatureBits& a,const TFeatureBits& b) const
+		{
+			if ( a.mBitCount != b.mBitCount )
+				return a.mBitCount < b.mBitCount;
+			return memcmp( a.mWords, b.mWords, sizeof(a.mWords) ) < 0;
+		}
+	};
+
+	class TDictionary
+	{
+	public:
+		//	false if the feature can't be packed
+		bool		GetIndex(uint32& Index,const TFeatureBinRing& Feature);
+
+	public:
+		std::map<TFeatureBits,uint32,TBitsLess>	mIndexes;
+		std::vector<const TFeatureBits*>		mDescriptors;	//	keys of mIndexes in index order
+	};
+
+	template<typename TYPE>
+	void	Write(ArrayBridge<char>& Data,const TYPE& Value)
+	{
+		auto* Block = Data.PushBlock( sizeof(Value) );
+		memcpy( Block, &Value, sizeof(Value) );
+	}
+}
+
+
+bool FeatureDictionary::TDictionary::GetIndex(uint32& Index,const TFeatureBinRing& Feature)
+{
+	TFeatureBits Bits;
+	if ( !FeatureBits::Pack( Bits, Feature ) )
+		return false;
+	auto Inserted = mIndexes.insert( std::make_pair( Bits, static_cast<uint32>( mDescriptors.size() ) ) );
+	if ( Inserted.second )
+		mDescriptors.push_back( &Inserted.first->first );
+	Index = Inserted.first->second;
+	return true;
+}
+
+
+bool FeatureDictionary::Encode(ArrayBridge<char>&& Data,const Array<TFeatureMatch>& Matches,bool HasSource,std::stringstream& Error)
+{
+	TDictionary Dictionary;
+	std::vector<uint32> Indexes( Matches.GetSize() * ( HasSource ? 2 : 1 ) );
+	for ( int m=0;	m<Matches.GetSize();	m++ )
+	{
+		auto* MatchIndexes = &Indexes[ m * ( HasSource ? 2 : 1 ) ];
+		bool Packed = Dictionary.GetIndex( MatchIndexes[0], Matches[m].mFeature );
+		if ( Packed && HasSource )
+			Packed = Dictionary.GetIndex( MatchIndexes[1], Matches[m].mSourceFeature );
+		if ( !Packed )
+		{
+			Error << "Descriptor of match " << m << " can't be packed into " << TFeatureBits::MaxBits << " bits";
+			return false;
+		}
+	}
+
+	auto* Header = Data.PushBlock( sizeof(Magic) );
+	memcpy( Header, Magic, sizeof(Magic) );
+	Write( Data, Version );
+	Write( Data, static_cast<uint32>( Dictionary.mDescriptors.size() ) );
+	Write( Data, static_cast<uint32>( Matches.GetSize() ) );
+	Write( Data, HasSource ? Flag_Source : 0u );
+
+	//	packed words are little endian, so byte n/8 of the words holds bit n at (1<<(n%8))
+	for ( auto* Descriptor : Dictionary.mDescriptors )
+	{
+		Write( Data, static_cast<uint16>( Descriptor->mBitCount ) );
+		auto ByteCount = ( Descriptor->mBitCount + 7 ) / 8;
+		auto* Bytes = Data.PushBlock( ByteCount );
+		for ( int b=0;	b<ByteCount;	b++ )
+			Bytes[b] = static_cast<char>( Descriptor->mWords[b/8] >> ( (b%8) * 8 ) );
+	}
+
+	for ( int m=0;	m<Matches.GetSize();	m++ )
+	{
+		auto& Match = Matches[m];
+		auto* MatchIndexes = &Indexes[ m * ( HasSource ? 2 : 1 ) ];
+		Write( Data, static_cast<int32_t>( Match.mCoord.x ) );
+		Write( Data, static_cast<int32_t>( Match.mCoord.y ) );
+		Write( Data, static_cast<float>( Match.mScore ) );
+		Write( Data, MatchIndexes[0] );
+		if ( !HasSource )
+			continue;
+		Write( Data, static_cast<int32_t>( Match.mSourceCoord.x ) );
+		Write( Data, static_cast<int32_t>( Match.mSourceCoord.y ) );
+		Write( Data, MatchIndexes[1] );
+	}
+	return true;
+}
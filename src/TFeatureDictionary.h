@@ -0,0 +1,23 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <TFeatureBinRing.h>
+#include <sstream>
+
+
+//	feature matches with each distinct descriptor sent once. Textured scenes repeat descriptors a lot
+//	(it's what ScoreInterestingFeatures counts) so this is much smaller than a descriptor per match.
+//	Little endian layout:
+//		char[4] "PFDD", uint32 version, uint32 descriptor count, uint32 match count, uint32 flags
+//		descriptors: uint16 bit count, then (bitcount+7)/8 bytes, bit n is byte[n/8] & (1<<(n%8))
+//		matches: int32 x, int32 y, float score, uint32 descriptor index
+//			with Flag_Source: int32 source x, int32 source y, uint32 source descriptor index
+namespace FeatureDictionary
+{
+	const uint32	Version = 1;
+	const uint32	Flag_Source = 1<<0;		//	matches have a source feature (findfeature/trackfeatures)
+
+	//	fails if a descriptor can't be packed into bits. HasSource is whether the matches came from a search for
+	//	source features, rather than guessing from the source feature's bins, which can legitimately be all zero
+	bool	Encode(ArrayBridge<char>&& Data,const Array<TFeatureMatch>& Matches,bool HasSource,std::stringstream& Error);
+};
@@ -0,0 +1,196 @@
+#include "TFeatureStream.h"
+#include "CvPixels.h"
+#include <algorithm>
+#include <cstdlib>
+
+//	as with FeatureBits, the avx2 kernel is compiled with a target attribute and picked at runtime, so the baseline
+//	build uses it where the cpu has it. sse2 is part of x86-64 so needs no check
+#if defined(__x86_64__) && ( defined(__clang__) || defined(__GNUC__) )
+	#define FEATURESTREAM_SIMD
+	#include <immintrin.h>
+#endif
+
+
+namespace FeatureStream
+{
+	//	each kernel does whole blocks of a row, adds them to Sum and returns how many pixels it did
+	typedef int(*TRowSadKernel)(const uint8*,const uint8*,int,uint32&);
+	
+	//	decided once, on first use
+	TRowSadKernel	GetRowSadKernel();
+}
+
+
+#if defined(FEATURESTREAM_SIMD)
+//	psadbw sums 8 byte groups into 64 bit lanes
+__attribute__((target("avx2")))
+static int GetRowSadAvx2(const uint8* RowA,const uint8* RowB,int Width,uint32& Sum)
+{
+	__m256i Sad = _mm256_setzero_si256();
+	int x = 0;
+	for ( ;	x+32<=Width;	x+=32 )
+	{
+		auto PixelsA = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( RowA + x ) );
+		auto PixelsB = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( RowB + x ) );
+		Sad = _mm256_add_epi64( Sad, _mm256_sad_epu8( PixelsA, PixelsB ) );
+	}
+	Sum += static_cast<uint32>( _mm256_extract_epi64( Sad, 0 ) + _mm256_extract_epi64( Sad, 1 ) + _mm256_extract_epi64( Sad, 2 ) + _mm256_extract_epi64( Sad, 3 ) );
+	return x;
+}
+
+
+static int GetRowSadSse2(const uint8* RowA,const uint8* RowB,int Width,uint32& Sum)
+{
+	__m128i Sad = _mm_setzero_si128();
+	int x = 0;
+	for ( ;	x+16<=Width;	x+=16 )
+	{
+		auto PixelsA = _mm_loadu_si128( reinterpret_cast<const __m128i*>( RowA + x ) );
+		auto PixelsB = _mm_loadu_si128( reinterpret_cast<const __m128i*>( RowB + x ) );
+		Sad = _mm_add_epi64( Sad, _mm_sad_epu8( PixelsA, PixelsB ) );
+	}
+	Sum += static_cast<uint32>( _mm_cvtsi128_si32( Sad ) + _mm_cvtsi128_si32( _mm_srli_si128( Sad, 8 ) ) );
+	return x;
+}
+#endif
+
+
+FeatureStream::TRowSadKernel FeatureStream::GetRowSadKernel()
+{
+	static const TRowSadKernel Kernel = []() -> TRowSadKernel
+	{
+#if defined(FEATURESTREAM_SIMD)
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports("avx2") )
+			return GetRowSadAvx2;
+		return GetRowSadSse2;
+#else
+		return nullptr;
+#endif
+	}();
+	return Kernel;
+}
+
+
+uint32 FeatureStream::GetBlockSad(const uint8* a,int StrideA,const uint8* b,int StrideB,int Width,int Height)
+{
+	auto Kernel = GetRowSadKernel();
+	uint32 Sum = 0;
+	for ( int y=0;	y<Height;	y++ )
+	{
+		auto* RowA = a + y*StrideA;
+		auto* RowB = b + y*StrideB;
+		int x = Kernel ? Kernel( RowA, RowB, Width, Sum ) : 0;
+		for ( ;	x<Width;	x++ )
+			Sum += std::abs( static_cast<int>(RowA[x]) - static_cast<int>(RowB[x]) );
+	}
+	return Sum;
+}
+
+
+void TFeatureStream::Reset()
+{
+	mPreviousLuma = cv::Mat();
+	mTileFeatures.clear();
+	mTilesWide = 0;
+	mTilesHigh = 0;
+	mTilesChanged = 0;
+}
+
+
+void TFeatureStream::Update(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const FeatureSearch::TRegion& Region,std::stringstream& Error)
+{
+	cv::Mat Luma;
+	Opencv::GetLuma( Luma, Image );
+
+	int TileSize = std::max( 1, mTileSize );
+	int TilesWide = (Luma.cols + TileSize - 1) / TileSize;
+	int TilesHigh = (Luma.rows + TileSize - 1) / TileSize;
+
+	bool Restart = mPreviousLuma.empty();
+	Restart |= mPreviousLuma.cols != Luma.cols || mPreviousLuma.rows != Luma.rows;
+	Restart |= mStepX != Params.mMatchStepX || mStepY != Params.mMatchStepY;
+	Restart |= mStreamTileSize != TileSize;
+	Restart |= mRegion.mMask != Region.mMask;
+	Restart |= mRegion.mRects.size() != Region.mRects.size();
+	for ( int r=0;	!Restart && r<Region.mRects.size();	r++ )
+	{
+		auto& Old = mRegion.mRects[r];
+		auto& New = Region.mRects[r];
+		Restart |= Old.x != New.x || Old.y != New.y || Old.w != New.w || Old.h != New.h;
+	}
+	if ( Restart )
+	{
+		Reset();
+		mStepX = Params.mMatchStepX;
+		mStepY = Params.mMatchStepY;
+		mStreamTileSize = TileSize;
+		mRegion = Region;
+		mTilesWide = TilesWide;
+		mTilesHigh = TilesHigh;
+		mTileFeatures.resize( TilesWide * TilesHigh );
+		Luma.copyTo( mPreviousLuma );
+	}
+
+	auto GetTileRect = [&](int tx,int ty)
+	{
+		int x = tx * TileSize;
+		int y = ty * TileSize;
+		return FeatureSearch::TRect( x, y, std::min( TileSize, Luma.cols - x ), std::min( TileSize, Luma.rows - y ) );
+	};
+
+	//	find changed tiles, then grow by one as features near the edge of a tile sample its neighbours
+	std::vector<uint8> Changed( TilesWide * TilesHigh, Restart ? 1 : 0 );
+	if ( !Restart )
+	{
+		for ( int ty=0;	ty<TilesHigh;	ty++ )
+		{
+			for ( int tx=0;	tx<TilesWide;	tx++ )
+			{
+				auto Tile = GetTileRect( tx, ty );
+				auto Sad = FeatureStream::GetBlockSad( Luma.ptr<uint8>(Tile.y) + Tile.x, static_cast<int>(Luma.step), mPreviousLuma.ptr<uint8>(Tile.y) + Tile.x, static_cast<int>(mPreviousLuma.step), Tile.w, Tile.h );
+				Changed[ ty*TilesWide + tx ] = Sad > static_cast<uint32>( mChangeThreshold * Tile.w * Tile.h );
+			}
+		}
+	}
+	std::vector<uint8> Dirty( Changed );
+	for ( int ty=0;	ty<TilesHigh;	ty++ )
+	{
+		for ( int tx=0;	tx<TilesWide;	tx++ )
+		{
+			if ( !Changed[ ty*TilesWide + tx ] )
+				continue;
+			for ( int ny=std::max(0,ty-1);	ny<=std::min(TilesHigh-1,ty+1);	ny++ )
+				for ( int nx=std::max(0,tx-1);	nx<=std::min(TilesWide-1,tx+1);	nx++ )
+					Dirty[ ny*TilesWide + nx ] = 1;
+		}
+	}
+
+	//	re-extract dirty tiles. The previous luma is only updated where we re-extracted, so slow drift
+	//	below the threshold accumulates until the tile is refreshed
+	mTilesChanged = 0;
+	for ( int t=0;	t<Dirty.size();	t++ )
+	{
+		if ( !Dirty[t] )
+			continue;
+		mTilesChanged++;
+		auto Tile = GetTileRect( t % TilesWide, t / TilesWide );
+		auto& TileFeatures = mTileFeatures[t];
+		TileFeatures.Clear(false);
+		FeatureSearch::GetGridFeatures( GetArrayBridge(TileFeatures), Image, Params, Region, Tile, Error );
+		if ( Error.tellp() > 0 )
+		{
+			Reset();
+			return;
+		}
+		if ( !Restart )
+		{
+			cv::Rect TileRect( Tile.x, Tile.y, Tile.w, Tile.h );
+			Luma( TileRect ).copyTo( mPreviousLuma( TileRect ) );
+		}
+	}
+
+	for ( auto& TileFeatures : mTileFeatures )
+		for ( int f=0;	f<TileFeatures.GetSize();	f++ )
+			Features.PushBack( TileFeatures[f] );
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <SoyPixels.h>
+#include <TFeatureBinRing.h>
+#include <opencv2/core/core.hpp>
+#include "FeatureSearch.h"
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+
+namespace FeatureStream
+{
+	//	sum of absolute differences of a block of 8 bit pixels
+	uint32	GetBlockSad(const uint8* a,int StrideA,const uint8* b,int StrideB,int Width,int Height);
+};
+
+
+//	grid features of a camera stream. Each frame's luma is compared with the previous in tiles and only the
+//	tiles that changed (and their neighbours, as a feature samples beyond its tile) are re-extracted.
+//	Features are reused whilst the frame size, grid step and roi/mask stay the same; other extractor
+//	params aren't tracked, so Reset() when they change. Tiles should be at least the feature radius
+class TFeatureStream
+{
+public:
+	TFeatureStream() :
+		mTileSize			( 32 ),
+		mChangeThreshold	( 4 ),
+		mStepX				( 0 ),
+		mStepY				( 0 ),
+		mStreamTileSize		( 0 ),
+		mTilesWide			( 0 ),
+		mTilesHigh			( 0 ),
+		mTilesChanged		( 0 )
+	{
+	}
+
+	void		Reset();
+
+	//	grid features (unscored) of the new frame
+	void		Update(ArrayBridge<TFeatureMatch>&& Features,const SoyPixels& Image,const TFeatureBinRingParams& Params,const FeatureSearch::TRegion& Region,std::stringstream& Error);
+
+	int			GetTileCount() const		{	return mTilesWide * mTilesHigh;	}
+	int			GetTilesChanged() const		{	return mTilesChanged;	}	//	tiles re-extracted by the last update
+
+public:
+	std::mutex	mLock;
+	int			mTileSize;
+	int			mChangeThreshold;	//	mean absolute luma difference for a tile to count as changed
+
+private:
+	cv::Mat		mPreviousLuma;
+	int			mStepX;
+	int			mStepY;
+	int			mStreamTileSize;
+	FeatureSearch::TRegion	mRegion;	//	holds the mask so a new mask can't reuse its address
+	int			mTilesWide;
+	int			mTilesHigh;
+	int			mTilesChanged;
+	std::vector<Array<TFeatureMatch>>	mTileFeatures;
+};
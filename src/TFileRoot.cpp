@@ -0,0 +1,121 @@
+#include "TFileRoot.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+
+bool TFileRoot::SetRoot(const std::string& Root,std::stringstream& Error)
+{
+	char Resolved[PATH_MAX];
+	if ( !realpath( Root.c_str(), Resolved ) )
+	{
+		Error << "Failed to resolve file root " << Root << ": " << strerror( errno );
+		return false;
+	}
+	std::lock_guard<std::mutex> Lock( mLock );
+	mRoot = Resolved;
+	if ( mRoot.back() != '/' )
+		mRoot += '/';
+	return true;
+}
+
+
+bool TFileRoot::IsSet()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	return !mRoot.empty();
+}
+
+
+bool TFileRoot::GetRoot(std::string& Root,std::stringstream& Error)
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		Root = mRoot;
+	}
+	if ( Root.empty() )
+	{
+		Error << "Files are disabled, start with fileroot=";
+		return false;
+	}
+	return true;
+}
+
+
+bool TFileRoot::IsInside(const std::string& Resolved,const std::string& Root) const
+{
+	//	the root itself resolves without the trailing slash
+	std::string Path = Resolved;
+	if ( Path.back() != '/' )
+		Path += '/';
+	return Path.compare( 0, Root.length(), Root ) == 0;
+}
+
+
+bool TFileRoot::GetPath(std::string& Filename,std::stringstream& Error)
+{
+	std::string Root;
+	if ( !GetRoot( Root, Error ) )
+		return false;
+
+	std::string Path = ( !Filename.empty() && Filename[0] == '/' ) ? Filename : Root + Filename;
+	char Resolved[PATH_MAX];
+	if ( !realpath( Path.c_str(), Resolved ) )
+	{
+		Error << "Failed to open " << Filename << ": " << strerror( errno );
+		return false;
+	}
+	if ( !IsInside( Resolved, Root ) )
+	{
+		Error << Filename << " is outside the file root";
+		return false;
+	}
+	Filename = Resolved;
+	return true;
+}
+
+
+bool TFileRoot::GetNewPath(std::string& Filename,std::stringstream& Error)
+{
+	std::string Root;
+	if ( !GetRoot( Root, Error ) )
+		return false;
+
+	std::string Path = ( !Filename.empty() && Filename[0] == '/' ) ? Filename : Root + Filename;
+	auto Slash = Path.find_last_of('/');
+	std::string Directory = Path.substr( 0, Slash+1 );
+	std::string Name = Path.substr( Slash+1 );
+	if ( Name.empty() || Name == "." || Name == ".." )
+	{
+		Error << Filename << " isn't a filename";
+		return false;
+	}
+
+	char Resolved[PATH_MAX];
+	if ( !realpath( Directory.c_str(), Resolved ) )
+	{
+		Error << "Failed to open directory of " << Filename << ": " << strerror( errno );
+		return false;
+	}
+	if ( !IsInside( Resolved, Root ) )
+	{
+		Error << Filename << " is outside the file root";
+		return false;
+	}
+
+	std::string NewPath = Resolved;
+	if ( NewPath.back() != '/' )
+		NewPath += '/';
+	NewPath += Name;
+
+	struct stat Info;
+	if ( lstat( NewPath.c_str(), &Info ) == 0 && S_ISLNK( Info.st_mode ) )
+	{
+		Error << Filename << " is a link, not writing through it";
+		return false;
+	}
+	Filename = NewPath;
+	return true;
+}
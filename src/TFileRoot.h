@@ -0,0 +1,29 @@
+#pragma once
+
+#include <mutex>
+#include <sstream>
+#include <string>
+
+
+//	the directory (fileroot=) every client named file is confined to. Clients name the files, so with no root set
+//	nothing is resolved, and after resolving links and .. a path must still be inside the root
+class TFileRoot
+{
+public:
+	bool			SetRoot(const std::string& Root,std::stringstream& Error);
+	bool			IsSet();
+
+	//	Filename is relative to the root (or absolute), must exist and is replaced with the resolved path
+	bool			GetPath(std::string& Filename,std::stringstream& Error);
+	//	for a file that's about to be written; it needn't exist, but its directory must and that is what's resolved.
+	//	The name itself can't be a link, so a write can't be redirected outside the root
+	bool			GetNewPath(std::string& Filename,std::stringstream& Error);
+
+private:
+	bool			GetRoot(std::string& Root,std::stringstream& Error);
+	bool			IsInside(const std::string& Resolved,const std::string& Root) const;
+
+private:
+	std::mutex		mLock;
+	std::string		mRoot;		//	resolved, with a trailing slash. Empty until set
+};
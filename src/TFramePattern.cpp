@@ -0,0 +1,61 @@
+#include "TFramePattern.h"
+#include <cctype>
+
+
+bool TFramePattern::Parse(const std::string& Pattern,std::stringstream& Error)
+{
+	mIsSequence = false;
+	mPrefix = Pattern;
+	mSuffix.clear();
+	mWidth = 0;
+
+	auto Percent = Pattern.find('%');
+	if ( Percent == std::string::npos )
+		return true;
+	if ( Pattern.find( '%', Percent+1 ) != std::string::npos )
+	{
+		Error << "Frame pattern " << Pattern << " should have a single %d";
+		return false;
+	}
+
+	//	%d or %0Nd, N up to 2 digits
+	auto Position = Percent + 1;
+	int Width = 0;
+	if ( Position < Pattern.length() && Pattern[Position] == '0' )
+	{
+		Position++;
+		auto WidthStart = Position;
+		while ( Position < Pattern.length() && isdigit( Pattern[Position] ) && Position - WidthStart < 2 )
+			Width = Width * 10 + ( Pattern[Position++] - '0' );
+		if ( Position == WidthStart )
+		{
+			Error << "Frame pattern " << Pattern << " has %0 without a width";
+			return false;
+		}
+	}
+	if ( Position >= Pattern.length() || Pattern[Position] != 'd' )
+	{
+		Error << "Frame pattern " << Pattern << " should use %d or %0Nd";
+		return false;
+	}
+
+	mIsSequence = true;
+	mPrefix = Pattern.substr( 0, Percent );
+	mSuffix = Pattern.substr( Position+1 );
+	mWidth = Width;
+	return true;
+}
+
+
+std::string TFramePattern::GetFilename(int Frame) const
+{
+	if ( !mIsSequence )
+		return mPrefix;
+
+	auto Number = std::to_string( Frame < 0 ? -static_cast<long long>(Frame) : Frame );
+	if ( Number.length() < static_cast<size_t>(mWidth) )
+		Number.insert( 0, mWidth - Number.length(), '0' );
+	if ( Frame < 0 )
+		Number.insert( 0, 1, '-' );
+	return mPrefix + Number + mSuffix;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+
+//	a frame sequence filename like frames/%05d.png. Patterns come from clients, so they're never used as a printf
+//	format; the only conversion allowed is a single %d or %0Nd, which is substituted here
+class TFramePattern
+{
+public:
+	TFramePattern() :
+		mIsSequence	( false ),
+		mWidth		( 0 )
+	{
+	}
+
+	//	a pattern without any % is a single file. Anything else with a % that isn't one %d/%0Nd is an error
+	bool			Parse(const std::string& Pattern,std::stringstream& Error);
+	bool			IsSequence() const		{	return mIsSequence;	}
+	//	the pattern itself if it isn't a sequence
+	std::string		GetFilename(int Frame) const;
+
+	static bool		HasConversion(const std::string& Pattern)	{	return Pattern.find('%') != std::string::npos;	}
+
+private:
+	bool			mIsSequence;
+	std::string		mPrefix;
+	std::string		mSuffix;
+	int				mWidth;		//	zero padded to this many digits
+};
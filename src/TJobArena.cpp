@@ -0,0 +1,115 @@
+#include "TJobArena.h"
+#include <SoyAssert.h>
+#include <algorithm>
+
+
+namespace JobArena
+{
+	//	alignment must be a power of 2
+	size_t	AlignUp(size_t Offset,size_t Alignment)	{	return (Offset + Alignment - 1) & ~(Alignment - 1);	}
+	
+	thread_local int		ScopeDepth = 0;
+	thread_local std::unique_ptr<TJobArena>	Arena;
+}
+
+
+TJobArena::TJobArena(size_t InitialBlockSize) :
+	mBlockUsed				( 0 ),
+	mUsedBeforeCurrentBlock	( 0 ),
+	mHighWaterMark			( 0 )
+{
+	AllocBlock( InitialBlockSize );
+}
+
+void TJobArena::AllocBlock(size_t MinSize)
+{
+	//	grow geometrically so a big job only needs a few blocks
+	size_t Size = mBlockSizes.empty() ? MinSize : std::max( MinSize, mBlockSizes.back() * 2 );
+	
+	if ( !mBlockSizes.empty() )
+		mUsedBeforeCurrentBlock += mBlockUsed;
+	mBlocks.push_back( std::unique_ptr<char[]>( new char[Size] ) );
+	mBlockSizes.push_back( Size );
+	mBlockUsed = 0;
+}
+
+void* TJobArena::Alloc(size_t Size,size_t Alignment)
+{
+	auto Offset = JobArena::AlignUp( mBlockUsed, Alignment );
+	if ( Offset + Size > mBlockSizes.back() )
+	{
+		//	worst case alignment from new char[] is covered by over-allocating
+		AllocBlock( Size + Alignment );
+		Offset = JobArena::AlignUp( reinterpret_cast<size_t>( mBlocks.back().get() ), Alignment ) - reinterpret_cast<size_t>( mBlocks.back().get() );
+	}
+	
+	mBlockUsed = Offset + Size;
+	return mBlocks.back().get() + Offset;
+}
+
+void TJobArena::Reset()
+{
+	mHighWaterMark = std::max( mHighWaterMark, GetUsedSize() );
+	
+	//	replace multiple blocks with one that would have fit everything
+	if ( mBlocks.size() > 1 )
+	{
+		mBlocks.clear();
+		mBlockSizes.clear();
+		mUsedBeforeCurrentBlock = 0;
+		AllocBlock( mHighWaterMark );
+	}
+	
+	mBlockUsed = 0;
+	mUsedBeforeCurrentBlock = 0;
+}
+
+
+TJobArenaScope::TJobArenaScope()
+{
+	JobArena::ScopeDepth++;
+}
+
+TJobArenaScope::~TJobArenaScope()
+{
+	JobArena::ScopeDepth--;
+	if ( JobArena::ScopeDepth == 0 && JobArena::Arena )
+		JobArena::Arena->Reset();
+}
+
+TJobArena& TJobArenaScope::GetArena()
+{
+	Soy::Assert( JobArena::ScopeDepth > 0, "Job arena used outside of a TJobArenaScope" );
+
+	//	freed when the thread exits
+	if ( !JobArena::Arena )
+		JobArena::Arena.reset( new TJobArena() );
+	return *JobArena::Arena;
+}
+
+
+
+TReplyBufferCache::TReplyBufferCache(size_t MaxBuffers) :
+	mMaxBuffers	( MaxBuffers )
+{
+}
+
+std::shared_ptr<SoyData_Stack<Array<char>>> TReplyBufferCache::GetBuffer()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	
+	//	one only we reference has been sent and released; keep the allocation
+	for ( auto& Buffer : mBuffers )
+	{
+		if ( Buffer.use_count() > 1 )
+			continue;
+		Buffer->mValue.Clear(false);
+		return Buffer;
+	}
+	
+	//	all in flight
+	std::shared_ptr<SoyData_Stack<Array<char>>> Buffer( new SoyData_Stack<Array<char>>() );
+	if ( mBuffers.size() < mMaxBuffers )
+		mBuffers.push_back( Buffer );
+	return Buffer;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <array.hpp>
+#include <SoyData.h>
+
+
+//	monotonic allocator. Nothing is freed until Reset(), which is done when a job completes.
+//	Reset() merges blocks into one so a steady stream of similar jobs stops hitting the heap
+class TJobArena
+{
+public:
+	TJobArena(size_t InitialBlockSize=64*1024);
+
+	void*		Alloc(size_t Size,size_t Alignment);
+	template<typename TYPE>
+	TYPE*		AllocArray(size_t Count)	{	return static_cast<TYPE*>( Alloc( sizeof(TYPE)*Count, alignof(TYPE) ) );	}
+	void		Reset();
+	
+	size_t		GetUsedSize() const			{	return mUsedBeforeCurrentBlock + mBlockUsed;	}
+
+private:
+	void		AllocBlock(size_t MinSize);
+	
+private:
+	std::vector<std::unique_ptr<char[]>>	mBlocks;
+	std::vector<size_t>						mBlockSizes;
+	size_t									mBlockUsed;				//	bytes used in the last block
+	size_t									mUsedBeforeCurrentBlock;
+	size_t									mHighWaterMark;
+};
+
+
+//	each worker thread has its own arena; the outermost scope on a thread resets it when the job is done
+class TJobArenaScope
+{
+public:
+	TJobArenaScope();
+	~TJobArenaScope();
+	
+	static TJobArena&	GetArena();
+};
+
+
+//	STL allocator on the current thread's job arena. Containers using it must not outlive the TJobArenaScope
+template<typename TYPE>
+class TJobArenaAllocator
+{
+public:
+	typedef TYPE	value_type;
+	
+	TJobArenaAllocator()	{}
+	template<typename OTHERTYPE>
+	TJobArenaAllocator(const TJobArenaAllocator<OTHERTYPE>&)	{}
+	
+	TYPE*		allocate(size_t Count)			{	return TJobArenaScope::GetArena().AllocArray<TYPE>( Count );	}
+	void		deallocate(TYPE*,size_t)		{	}
+	
+	template<typename OTHERTYPE>
+	bool		operator==(const TJobArenaAllocator<OTHERTYPE>&) const	{	return true;	}
+	template<typename OTHERTYPE>
+	bool		operator!=(const TJobArenaAllocator<OTHERTYPE>&) const	{	return false;	}
+};
+
+
+//	binary reply payloads are re-used once the previous reply using them has been sent and released.
+//	Buffers aren't tied to a channel, so there's nothing to clean up when one goes
+class TReplyBufferCache
+{
+public:
+	TReplyBufferCache(size_t MaxBuffers=16);
+	
+	std::shared_ptr<SoyData_Stack<Array<char>>>	GetBuffer();
+	
+public:
+	std::mutex												mLock;
+	size_t													mMaxBuffers;	//	more replies than this in flight get buffers that aren't kept
+	std::vector<std::shared_ptr<SoyData_Stack<Array<char>>>>	mBuffers;
+};
@@ -0,0 +1,377 @@
+#include "TJobRecorder.h"
+#include <SoyDebug.h>
+#include <SoyString.h>
+#include <algorithm>
+#include <cstring>
+
+
+namespace JobLog
+{
+	const char		Magic[4] = { 'P', 'J', 'O', 'B' };
+	const uint32	Version = 1;
+
+	void	WriteString(std::ostream& File,const std::string& String);
+	//	fails rather than allocating a length longer than what's left of the file
+	bool	ReadString(std::istream& File,std::string& String,uint64 FileSize);
+	template<typename TYPE>
+	void	WriteValue(std::ostream& File,const TYPE& Value)	{	File.write( reinterpret_cast<const char*>(&Value), sizeof(Value) );	}
+	template<typename TYPE>
+	bool	ReadValue(std::istream& File,TYPE& Value)			{	return static_cast<bool>( File.read( reinterpret_cast<char*>(&Value), sizeof(Value) ) );	}
+
+	//	params that carry images; anything else is recorded as its string
+	bool	IsImageParam(const std::string& Name);
+
+	//	jobs that change state outside of their reply; files, registered cameras/databases, channel settings
+	bool	HasSideEffects(const std::string& Command,const TJobRecord& Record);
+	const TJobRecordParam*	GetParam(const TJobRecord& Record,const std::string& Name);
+}
+
+
+void JobLog::WriteString(std::ostream& File,const std::string& String)
+{
+	WriteValue( File, static_cast<uint32>( String.length() ) );
+	File.write( String.c_str(), String.length() );
+}
+
+
+bool JobLog::ReadString(std::istream& File,std::string& String,uint64 FileSize)
+{
+	uint32 Length = 0;
+	if ( !ReadValue( File, Length ) )
+		return false;
+	auto Position = File.tellg();
+	if ( Position < 0 || Length > FileSize - static_cast<uint64>( Position ) )
+		return false;
+	String.resize( Length );
+	if ( Length == 0 )
+		return true;
+	return static_cast<bool>( File.read( &String[0], Length ) );
+}
+
+
+bool JobLog::IsImageParam(const std::string& Name)
+{
+	if ( Name == TJobParam::Param_Default )
+		return true;
+	
+	//	batch jobs prefix their own images with the job index; 0.image, 1.mask...
+	static const char* ImageNames[] = { "image", "mask", "previous" };
+	for ( auto* ImageName : ImageNames )
+	{
+		std::string Suffix = std::string(".") + ImageName;
+		if ( Name == ImageName )
+			return true;
+		if ( Name.length() > Suffix.length() && Name.compare( Name.length() - Suffix.length(), Suffix.length(), Suffix ) == 0 )
+			return true;
+	}
+	return false;
+}
+
+
+bool JobLog::Read(std::vector<TJobRecord>& Records,const std::string& Filename,std::stringstream& Error)
+{
+	std::ifstream File( Filename, std::ios::in | std::ios::binary );
+	if ( !File.is_open() )
+	{
+		Error << "Failed to open job log " << Filename;
+		return false;
+	}
+
+	File.seekg( 0, std::ios::end );
+	uint64 FileSize = static_cast<uint64>( File.tellg() );
+	File.seekg( 0, std::ios::beg );
+
+	char FileMagic[4];
+	uint32 FileVersion = 0;
+	if ( !File.read( FileMagic, sizeof(FileMagic) ) || memcmp( FileMagic, Magic, sizeof(Magic) ) != 0 || !ReadValue( File, FileVersion ) || FileVersion != Version )
+	{
+		Error << Filename << " is not a version " << Version << " job log";
+		return false;
+	}
+
+	//	a truncated last record (recording was killed) is dropped, as is everything after a length that runs past the
+	//	end of the file. A record with pixels that don't match their size is skipped
+	int Rejected = 0;
+	while ( File.peek() != EOF )
+	{
+		TJobRecord Record;
+		uint32 ParamCount = 0;
+		if ( !ReadValue( File, Record.mTimeUs ) || !ReadString( File, Record.mCommand, FileSize ) || !ReadValue( File, ParamCount ) )
+			break;
+
+		bool Complete = true;
+		bool Valid = true;
+		for ( int p=0;	Complete && p<ParamCount;	p++ )
+		{
+			TJobRecordParam Param;
+			uint8 IsPixels = 0;
+			Complete = ReadString( File, Param.mName, FileSize ) && ReadValue( File, IsPixels );
+			Param.mIsPixels = IsPixels != 0;
+			if ( Complete && Param.mIsPixels )
+			{
+				int32_t Width = 0;
+				int32_t Height = 0;
+				int32_t Format = 0;
+				std::string Pixels;
+				Complete = ReadValue( File, Width ) && ReadValue( File, Height ) && ReadValue( File, Format ) && ReadString( File, Pixels, FileSize );
+
+				//	every pixel is at least a byte, so this bounds the allocation by what was actually read
+				bool SizeValid = Width > 0 && Height > 0 && static_cast<uint64>( Width ) * static_cast<uint64>( Height ) <= Pixels.length();
+				if ( Complete && SizeValid && Param.mPixels.Init( Width, Height, static_cast<SoyPixelsFormat::Type>( Format ) ) && Param.mPixels.GetPixelsArray().GetSize() == Pixels.length() )
+				{
+					auto& PixelsArray = Param.mPixels.GetPixelsArray();
+					memcpy( PixelsArray.GetArray(), Pixels.c_str(), Pixels.length() );
+				}
+				else
+				{
+					Valid = false;
+				}
+			}
+			else if ( Complete )
+			{
+				Complete = ReadString( File, Param.mString, FileSize );
+			}
+			Record.mParams.push_back( Param );
+		}
+		if ( !Complete )
+			break;
+		if ( !Valid )
+		{
+			Rejected++;
+			continue;
+		}
+		Records.push_back( Record );
+	}
+	if ( Rejected > 0 )
+		std::Debug << "Rejected " << Rejected << " job records with invalid pixels in " << Filename << std::endl;
+
+	if ( Records.empty() )
+	{
+		Error << "No jobs in " << Filename;
+		return false;
+	}
+	return true;
+}
+
+
+const TJobRecordParam* JobLog::GetParam(const TJobRecord& Record,const std::string& Name)
+{
+	for ( auto& Param : Record.mParams )
+		if ( Param.mName == Name )
+			return &Param;
+	return nullptr;
+}
+
+
+bool JobLog::HasSideEffects(const std::string& Command,const TJobRecord& Record)
+{
+	static const char* Commands[] = { "savedatabase", "loaddatabase", "addfeatures", "processsequence", "storeframe", "addcalibrationview", "endcalibration" };
+	for ( auto* Match : Commands )
+		if ( Command == Match )
+			return true;
+
+	//	only registering the camera is a side effect
+	if ( Command == "calibratecamera" )
+		return GetParam( Record, "camera" ) != nullptr;
+	return false;
+}
+
+
+bool JobLog::IsReplayable(const TJobRecord& Record,bool AllowSideEffects)
+{
+	//	these act on the server doing the replaying, never replayed
+	auto& Command = Record.mCommand;
+	if ( Command == "exit" || Command == "record" || Command == "replay" )
+		return false;
+	if ( AllowSideEffects )
+		return true;
+	if ( HasSideEffects( Command, Record ) )
+		return false;
+
+	//	a batch is only as safe as its jobs
+	if ( Command == "batch" )
+	{
+		auto* Jobs = GetParam( Record, "jobs" );
+		if ( !Jobs )
+			return true;
+		bool Safe = true;
+		auto CheckCommand = [&Safe,&Record](const std::string& BatchCommand)
+		{
+			if ( HasSideEffects( BatchCommand, Record ) )
+				Safe = false;
+			return Safe;
+		};
+		Soy::StringSplitByMatches( CheckCommand, Jobs->mString, ",", false );
+		return Safe;
+	}
+	return true;
+}
+
+
+void JobLog::GetJob(TJob& Job,const TJobRecord& Record)
+{
+	Job.mParams.mCommand = Record.mCommand;
+	for ( auto& Param : Record.mParams )
+	{
+		bool IsDefault = Param.mName == TJobParam::Param_Default;
+		if ( Param.mIsPixels && IsDefault )
+			Job.mParams.AddDefaultParam( Param.mPixels );
+		else if ( Param.mIsPixels )
+			Job.mParams.AddParam( Param.mName, Param.mPixels );
+		else if ( IsDefault )
+			Job.mParams.AddDefaultParam( Param.mString );
+		else
+			Job.mParams.AddParam( Param.mName, Param.mString );
+	}
+}
+
+
+bool TJobRecorder::Start(const std::string& Filename,std::stringstream& Error)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( mFile.is_open() )
+		mFile.close();
+
+	mFile.open( Filename, std::ios::out | std::ios::binary | std::ios::trunc );
+	if ( !mFile.is_open() )
+	{
+		Error << "Failed to open " << Filename << " to record jobs";
+		return false;
+	}
+	mFile.write( JobLog::Magic, sizeof(JobLog::Magic) );
+	JobLog::WriteValue( mFile, JobLog::Version );
+	mStart = std::chrono::steady_clock::now();
+	mRecordCount = 0;
+	return true;
+}
+
+
+void TJobRecorder::Stop()
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( mFile.is_open() )
+		mFile.close();
+}
+
+
+void TJobRecorder::OnJob(TJob& Job)
+{
+	//	timestamp on arrival, not when the record is written
+	auto Now = std::chrono::steady_clock::now();
+
+	//	cheap check before we decode anything
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		if ( !mFile.is_open() )
+			return;
+	}
+
+	auto& Command = Job.mParams.mCommand;
+	if ( Command == "record" || Command == "replay" )
+		return;
+
+	//	serialise outside the lock so channels only contend on the write
+	std::stringstream Record;
+	uint32 ParamCount = 0;
+	for ( int p=0;	p<Job.mParams.mParams.GetSize();	p++ )
+	{
+		auto& Name = Job.mParams.mParams[p].mName;
+		SoyPixels Pixels;
+		if ( JobLog::IsImageParam( Name ) && Job.mParams.GetParamAs( Name, Pixels ) && Pixels.IsValid() )
+		{
+			JobLog::WriteString( Record, Name );
+			JobLog::WriteValue( Record, static_cast<uint8>(1) );
+			JobLog::WriteValue( Record, static_cast<int32_t>( Pixels.GetWidth() ) );
+			JobLog::WriteValue( Record, static_cast<int32_t>( Pixels.GetHeight() ) );
+			JobLog::WriteValue( Record, static_cast<int32_t>( Pixels.GetFormat() ) );
+			auto& PixelsArray = Pixels.GetPixelsArray();
+			JobLog::WriteString( Record, std::string( reinterpret_cast<const char*>( PixelsArray.GetArray() ), PixelsArray.GetSize() ) );
+		}
+		else
+		{
+			JobLog::WriteString( Record, Name );
+			JobLog::WriteValue( Record, static_cast<uint8>(0) );
+			JobLog::WriteString( Record, Job.mParams.GetParamAs<std::string>( Name ) );
+		}
+		ParamCount++;
+	}
+
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( !mFile.is_open() )
+		return;
+	uint64 TimeUs = std::chrono::duration_cast<std::chrono::microseconds>( Now - mStart ).count();
+	JobLog::WriteValue( mFile, TimeUs );
+	JobLog::WriteString( mFile, Command );
+	JobLog::WriteValue( mFile, ParamCount );
+	auto RecordString = Record.str();
+	mFile.write( RecordString.c_str(), RecordString.length() );
+	mFile.flush();
+	mRecordCount++;
+}
+
+
+void TJobLatencyStats::Add(const std::string& Command,float LatencyMs)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	mLatencies[Command].push_back( LatencyMs );
+}
+
+
+void TJobLatencyStats::GetSummary(std::ostream& Output,float ElapsedSecs)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto GetPercentile = [](const std::vector<float>& Sorted,float Percentile)
+	{
+		auto Index = static_cast<size_t>( Percentile * (Sorted.size()-1) + 0.5f );
+		return Sorted[ std::min( Index, Sorted.size()-1 ) ];
+	};
+
+	Output << "command,count,persec,p50ms,p90ms,p99ms,maxms" << Soy::lf;
+	for ( auto& Entry : mLatencies )
+	{
+		auto& Latencies = Entry.second;
+		if ( Latencies.empty() )
+			continue;
+		std::sort( Latencies.begin(), Latencies.end() );
+		Output << Entry.first << ',' << Latencies.size() << ',' << ( ElapsedSecs > 0.f ? Latencies.size() / ElapsedSecs : 0.f ) << ',';
+		Output << GetPercentile( Latencies, 0.50f ) << ',' << GetPercentile( Latencies, 0.90f ) << ',' << GetPercentile( Latencies, 0.99f ) << ',' << Latencies.back() << Soy::lf;
+	}
+}
+
+
+namespace JobLog
+{
+	thread_local TJobReplyCapture*	gReplyCapture = nullptr;
+}
+
+
+TJobReplyCapture::TJobReplyCapture(bool KeepReply) :
+	mReplyCount	( 0 ),
+	mKeepReply	( KeepReply ),
+	mPrevious	( JobLog::gReplyCapture )
+{
+	JobLog::gReplyCapture = this;
+}
+
+
+TJobReplyCapture::~TJobReplyCapture()
+{
+	JobLog::gReplyCapture = mPrevious;
+}
+
+
+TJobReplyCapture* TJobReplyCapture::Get()
+{
+	return JobLog::gReplyCapture;
+}
+
+
+void TJobReplyCapture::OnReply(const TJobReply& Reply)
+{
+	mReplyCount++;
+	mReplyTime = std::chrono::steady_clock::now();
+	
+	//	partial replies are replaced by the final one
+	if ( mKeepReply )
+		mReply = Reply.mParams;
+}
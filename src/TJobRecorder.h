@@ -0,0 +1,116 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <TJob.h>
+#include <SoyPixels.h>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+class TJobRecordParam
+{
+public:
+	TJobRecordParam() :
+		mIsPixels	( false )
+	{
+	}
+
+public:
+	std::string		mName;
+	bool			mIsPixels;
+	std::string		mString;
+	SoyPixels		mPixels;
+};
+
+
+class TJobRecord
+{
+public:
+	TJobRecord() :
+		mTimeUs	( 0 )
+	{
+	}
+
+public:
+	uint64							mTimeUs;	//	since recording started
+	std::string						mCommand;
+	std::vector<TJobRecordParam>	mParams;
+};
+
+
+namespace JobLog
+{
+	bool	Read(std::vector<TJobRecord>& Records,const std::string& Filename,std::stringstream& Error);
+
+	//	exit, record and replay are never replayed. Jobs with side effects (saving/loading files, registering
+	//	cameras, changing settings) only with AllowSideEffects
+	bool	IsReplayable(const TJobRecord& Record,bool AllowSideEffects);
+
+	//	rebuild the job that was recorded
+	void	GetJob(TJob& Job,const TJobRecord& Record);
+};
+
+
+//	appends every job received on any channel, with its params and decoded images, to a log file to be replayed
+//	with the replay job. Writing is done on the receiving thread, so recording adds a little latency
+class TJobRecorder
+{
+public:
+	TJobRecorder() :
+		mRecordCount	( 0 )
+	{
+	}
+
+	bool			Start(const std::string& Filename,std::stringstream& Error);
+	void			Stop();
+	void			OnJob(TJob& Job);
+	int				GetRecordCount()	{	std::lock_guard<std::mutex> Lock( mLock );	return mRecordCount;	}
+
+private:
+	std::mutex								mLock;
+	std::ofstream							mFile;
+	std::chrono::steady_clock::time_point	mStart;
+	int										mRecordCount;
+};
+
+
+//	latencies of replayed jobs, per command
+class TJobLatencyStats
+{
+public:
+	void			Add(const std::string& Command,float LatencyMs);
+
+	//	a line per command; count, throughput and percentiles
+	void			GetSummary(std::ostream& Output,float ElapsedSecs);
+
+private:
+	std::mutex								mLock;
+	std::map<std::string,std::vector<float>>	mLatencies;
+};
+
+
+//	whilst one of these is on a thread's stack, TPopOpencv::SendReply records replies here rather than sending them.
+//	KeepReply holds onto the params of the last reply (a batch sends them on), otherwise they're only counted
+class TJobReplyCapture
+{
+public:
+	TJobReplyCapture(bool KeepReply=false);
+	~TJobReplyCapture();
+
+	static TJobReplyCapture*	Get();
+	void						OnReply(const TJobReply& Reply);
+
+public:
+	int										mReplyCount;
+	std::chrono::steady_clock::time_point	mReplyTime;
+	bool									mKeepReply;
+	TJobParams								mReply;
+
+private:
+	TJobReplyCapture*						mPrevious;
+};
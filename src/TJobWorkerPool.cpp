@@ -0,0 +1,118 @@
+#include "TJobWorkerPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+
+namespace JobWorkerPool
+{
+	//	one Run(); outlives it if a helper queued for it is only picked up afterwards
+	class TWork
+	{
+	public:
+		TWork(int Count,std::function<void(int)> Function) :
+			mCount		( Count ),
+			mFunction	( Function ),
+			mNext		( 0 ),
+			mActive		( 0 ),
+			mClosed		( false )
+		{
+		}
+
+		void	Drain()
+		{
+			for ( int i=mNext++;	i<mCount;	i=mNext++ )
+				mFunction( i );
+		}
+
+	public:
+		int							mCount;
+		std::function<void(int)>	mFunction;
+		std::atomic<int>			mNext;
+
+		std::mutex					mLock;
+		std::condition_variable		mDone;
+		int							mActive;	//	helpers inside Drain()
+		bool						mClosed;	//	the caller has finished, late helpers do nothing
+	};
+}
+
+
+TJobWorkerPool::TJobWorkerPool(int ThreadCount) :
+	mStopping	( false )
+{
+	if ( ThreadCount <= 0 )
+		ThreadCount = std::max<int>( 1, std::thread::hardware_concurrency() );
+
+	//	the caller of Run() is always one of the threads
+	for ( int t=1;	t<ThreadCount;	t++ )
+		mThreads.push_back( std::thread( [this]	{	WorkerThread();	} ) );
+}
+
+
+TJobWorkerPool::~TJobWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for ( auto& Thread : mThreads )
+		Thread.join();
+}
+
+
+void TJobWorkerPool::WorkerThread()
+{
+	while ( true )
+	{
+		std::function<void()> Task;
+		{
+			std::unique_lock<std::mutex> Lock( mLock );
+			mWake.wait( Lock, [this]	{	return mStopping || !mQueue.empty();	} );
+			if ( mStopping )
+				return;
+			Task = mQueue.front();
+			mQueue.pop_front();
+		}
+		Task();
+	}
+}
+
+
+void TJobWorkerPool::Run(int Count,int MaxThreads,std::function<void(int)> Function)
+{
+	if ( Count <= 0 )
+		return;
+	std::shared_ptr<JobWorkerPool::TWork> Work( new JobWorkerPool::TWork( Count, Function ) );
+
+	int Helpers = std::min( { Count, MaxThreads, GetThreadCount() } ) - 1;
+	if ( Helpers > 0 )
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		for ( int h=0;	h<Helpers;	h++ )
+		{
+			mQueue.push_back( [Work]
+			{
+				{
+					std::lock_guard<std::mutex> WorkLock( Work->mLock );
+					if ( Work->mClosed )
+						return;
+					Work->mActive++;
+				}
+				Work->Drain();
+				std::lock_guard<std::mutex> WorkLock( Work->mLock );
+				Work->mActive--;
+				Work->mDone.notify_all();
+			} );
+		}
+		mWake.notify_all();
+	}
+
+	Work->Drain();
+
+	//	everything has been taken; wait for the helpers still running theirs
+	std::unique_lock<std::mutex> WorkLock( Work->mLock );
+	Work->mClosed = true;
+	Work->mDone.wait( WorkLock, [&Work]	{	return Work->mActive == 0;	} );
+}
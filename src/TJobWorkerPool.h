@@ -0,0 +1,34 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//	threads kept for the life of the app for jobs that fan out (batch), so their thread-local arenas are
+//	re-used rather than a thread (and an arena) being made and thrown away per request
+class TJobWorkerPool
+{
+public:
+	TJobWorkerPool(int ThreadCount=0);		//	0 is one per core
+	~TJobWorkerPool();
+
+	//	calls Function(0..Count-1) on up to MaxThreads threads; the calling thread is one of them, so this always
+	//	makes progress even if every pool thread is busy with another request. Returns when all are done.
+	//	Function must not throw
+	void			Run(int Count,int MaxThreads,std::function<void(int)> Function);
+	int				GetThreadCount() const	{	return static_cast<int>( mThreads.size() ) + 1;	}
+
+private:
+	void			WorkerThread();
+
+private:
+	std::mutex							mLock;
+	std::condition_variable				mWake;
+	std::deque<std::function<void()>>	mQueue;
+	bool								mStopping;
+	std::vector<std::thread>			mThreads;
+};
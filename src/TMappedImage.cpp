@@ -0,0 +1,334 @@
+#include "TMappedImage.h"
+#include "CvPixels.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace MappedImage
+{
+	const char	Prefix[] = "file:";
+
+	//	binary netpbm header; P5 (grey) or P6 (rgb) width height maxval, then a single whitespace and the pixels
+	//	false if it isn't an 8 bit P5/P6, or with an error if it is but the header is bad
+	bool		ReadNetpbmHeader(const uint8* Data,size_t Size,SoyPixelsFormat::Type& Format,int& Width,int& Height,size_t& DataOffset,std::stringstream& Error);
+
+	//	bigger than any camera frame, and small enough that width*height*channels can't overflow
+	const uint64	MaxNetpbmDimension = 1<<16;
+}
+
+
+TMappedFile::TMappedFile() :
+	mMemory	( nullptr ),
+	mSize	( 0 )
+{
+}
+
+
+TMappedFile::~TMappedFile()
+{
+	if ( mMemory )
+		munmap( mMemory, mSize );
+}
+
+
+bool TMappedFile::Open(const std::string& Filename,std::stringstream& Error)
+{
+	int FileDescriptor = open( Filename.c_str(), O_RDONLY );
+	if ( FileDescriptor < 0 )
+	{
+		Error << "Failed to open " << Filename << ": " << strerror( errno );
+		return false;
+	}
+	struct stat Info;
+	if ( fstat( FileDescriptor, &Info ) != 0 || Info.st_size == 0 )
+	{
+		Error << Filename << " is empty";
+		close( FileDescriptor );
+		return false;
+	}
+
+	auto* Memory = mmap( nullptr, Info.st_size, PROT_READ, MAP_PRIVATE, FileDescriptor, 0 );
+	close( FileDescriptor );
+	if ( Memory == MAP_FAILED )
+	{
+		Error << "Failed to map " << Filename << ": " << strerror( errno );
+		return false;
+	}
+	mMemory = Memory;
+	mSize = Info.st_size;
+	return true;
+}
+
+
+void TMappedFile::Prefetch()
+{
+	if ( mMemory )
+		madvise( mMemory, mSize, MADV_WILLNEED );
+}
+
+
+bool MappedImage::IsReference(const std::string& Reference)
+{
+	return Reference.compare( 0, sizeof(Prefix)-1, Prefix ) == 0;
+}
+
+
+std::string MappedImage::GetPath(const std::string& Reference)
+{
+	return Reference.substr( sizeof(Prefix)-1 );
+}
+
+
+bool MappedImage::ReadNetpbmHeader(const uint8* Data,size_t Size,SoyPixelsFormat::Type& Format,int& Width,int& Height,size_t& DataOffset,std::stringstream& Error)
+{
+	if ( Size < 2 || Data[0] != 'P' || ( Data[1] != '5' && Data[1] != '6' ) )
+		return false;
+	Format = ( Data[1] == '5' ) ? SoyPixelsFormat::Greyscale : SoyPixelsFormat::RGB;
+
+	size_t Position = 2;
+	uint64 Values[3] = { 0, 0, 0 };
+	for ( int v=0;	v<3;	v++ )
+	{
+		//	whitespace and # comments between values
+		while ( Position < Size && ( isspace( Data[Position] ) || Data[Position] == '#' ) )
+		{
+			if ( Data[Position] == '#' )
+				while ( Position < Size && Data[Position] != '\n' )
+					Position++;
+			else
+				Position++;
+		}
+		if ( Position >= Size || !isdigit( Data[Position] ) )
+			return false;
+		//	stop before the value can overflow; anything past the cap is rejected below
+		while ( Position < Size && isdigit( Data[Position] ) )
+		{
+			if ( Values[v] <= MaxNetpbmDimension )
+				Values[v] = Values[v] * 10 + ( Data[Position] - '0' );
+			Position++;
+		}
+	}
+	if ( Position >= Size || !isspace( Data[Position] ) )
+		return false;
+
+	//	16 bit samples need converting, so are decoded like any other file
+	if ( Values[2] > 255 )
+		return false;
+	if ( Values[0] == 0 || Values[1] == 0 || Values[0] > MaxNetpbmDimension || Values[1] > MaxNetpbmDimension )
+	{
+		Error << "Netpbm width and height should be 1 to " << MaxNetpbmDimension;
+		return false;
+	}
+	Width = static_cast<int>( Values[0] );
+	Height = static_cast<int>( Values[1] );
+	DataOffset = Position + 1;
+	return true;
+}
+
+
+bool MappedImage::Read(SoyPixels& Pixels,const TMappedFile& File,const std::string& Filename,std::stringstream& Error)
+{
+	SoyPixelsFormat::Type Format = SoyPixelsFormat::Invalid;
+	int Width = 0;
+	int Height = 0;
+	size_t DataOffset = 0;
+	std::stringstream HeaderError;
+	if ( ReadNetpbmHeader( File.GetData(), File.GetSize(), Format, Width, Height, DataOffset, HeaderError ) )
+	{
+		size_t Channels = ( Format == SoyPixelsFormat::Greyscale ) ? 1 : 3;
+		size_t DataSize = static_cast<size_t>( Width ) * static_cast<size_t>( Height ) * Channels;
+		if ( DataSize > File.GetSize() - DataOffset )
+		{
+			Error << Filename << " is truncated";
+			return false;
+		}
+		if ( !Pixels.Init( Width, Height, Format ) )
+		{
+			Error << "Failed to allocate " << Width << "x" << Height << " pixels for " << Filename;
+			return false;
+		}
+		//	the only copy; from the page cache to the pixels
+		auto& PixelsArray = Pixels.GetPixelsArray();
+		memcpy( PixelsArray.GetArray(), File.GetData() + DataOffset, std::min<size_t>( DataSize, PixelsArray.GetSize() ) );
+		return true;
+	}
+	if ( HeaderError.tellp() > 0 )
+	{
+		Error << Filename << ": " << HeaderError.str();
+		return false;
+	}
+
+	//	decode straight out of the mapping, the mat doesn't own it
+	try
+	{
+		cv::Mat Encoded( 1, static_cast<int>( File.GetSize() ), CV_8UC1, const_cast<uint8*>( File.GetData() ) );
+		cv::Mat Bgr = cv::imdecode( Encoded, CV_LOAD_IMAGE_COLOR );
+		if ( Bgr.empty() )
+		{
+			Error << "Failed to decode " << Filename;
+			return false;
+		}
+		cv::Mat Rgb;
+		cv::cvtColor( Bgr, Rgb, CV_BGR2RGB );
+		if ( !Opencv::GetPixels( Pixels, Rgb ) )
+		{
+			Error << "Failed to convert " << Filename << " to pixels";
+			return false;
+		}
+	}
+	catch ( cv::Exception& Exception )
+	{
+		Error << "Failed to decode " << Filename << ": " << Exception.what();
+		return false;
+	}
+	return true;
+}
+
+
+TMappedImageReader::TMappedImageReader(int ReadAhead) :
+	mReadAhead	( std::max( 0, ReadAhead ) ),
+	mMaxFiles	( mReadAhead * 2 + 8 ),
+	mStopping	( false )
+{
+}
+
+
+TMappedImageReader::~TMappedImageReader()
+{
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mStopping = true;
+	}
+	mPrefetchWake.notify_all();
+	if ( mPrefetchThread.joinable() )
+		mPrefetchThread.join();
+}
+
+
+bool TMappedImageReader::SetRoot(const std::string& Root,std::stringstream& Error)
+{
+	return mRoot.SetRoot( Root, Error );
+}
+
+
+std::shared_ptr<TMappedFile> TMappedImageReader::OpenFile(std::string Filename,std::stringstream& Error)
+{
+	if ( !mRoot.GetPath( Filename, Error ) )
+		return nullptr;
+	std::shared_ptr<TMappedFile> File( new TMappedFile() );
+	if ( !File->Open( Filename, Error ) )
+		return nullptr;
+	return File;
+}
+
+
+std::shared_ptr<TMappedFile> TMappedImageReader::GetFile(const std::string& Filename,std::stringstream& Error)
+{
+	//	a prefetched file is handed over; frames are read once so it isn't kept
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		auto Prefetched = mFiles.find( Filename );
+		if ( Prefetched != mFiles.end() )
+		{
+			auto File = Prefetched->second;
+			mFiles.erase( Prefetched );
+			mFileOrder.erase( std::find( mFileOrder.begin(), mFileOrder.end(), Filename ) );
+			return File;
+		}
+	}
+
+	return OpenFile( Filename, Error );
+}
+
+
+void TMappedImageReader::AddPrefetchedFile(const std::string& Filename,std::shared_ptr<TMappedFile> File)
+{
+	std::lock_guard<std::mutex> Lock( mLock );
+	if ( mFiles.find( Filename ) != mFiles.end() )
+		return;
+	mFiles[Filename] = File;
+	mFileOrder.push_back( Filename );
+
+	//	frames prefetched but never asked for (the client skipped or stopped) are dropped, oldest first
+	while ( mFileOrder.size() > mMaxFiles )
+	{
+		mFiles.erase( mFileOrder.front() );
+		mFileOrder.pop_front();
+	}
+}
+
+
+void TMappedImageReader::QueuePrefetch(const TFramePattern& Pattern,int Frame)
+{
+	if ( mReadAhead <= 0 )
+		return;
+
+	std::lock_guard<std::mutex> Lock( mLock );
+	for ( int f=Frame+1;	f<=Frame+mReadAhead;	f++ )
+	{
+		auto Filename = Pattern.GetFilename( f );
+		if ( mFiles.find( Filename ) != mFiles.end() )
+			continue;
+		if ( std::find( mPrefetchQueue.begin(), mPrefetchQueue.end(), Filename ) != mPrefetchQueue.end() )
+			continue;
+		mPrefetchQueue.push_back( Filename );
+	}
+	if ( !mPrefetchThread.joinable() )
+		mPrefetchThread = std::thread( [this]	{	PrefetchThread();	} );
+	mPrefetchWake.notify_one();
+}
+
+
+void TMappedImageReader::PrefetchThread()
+{
+	while ( true )
+	{
+		std::string Filename;
+		{
+			std::unique_lock<std::mutex> Lock( mLock );
+			mPrefetchWake.wait( Lock, [this]	{	return mStopping || !mPrefetchQueue.empty();	} );
+			if ( mStopping )
+				return;
+			Filename = mPrefetchQueue.front();
+			mPrefetchQueue.pop_front();
+		}
+
+		//	past the end of the sequence is expected
+		std::stringstream Error;
+		auto File = OpenFile( Filename, Error );
+		if ( !File )
+			continue;
+		File->Prefetch();
+		AddPrefetchedFile( Filename, File );
+	}
+}
+
+
+bool TMappedImageReader::Read(SoyPixels& Pixels,const std::string& Reference,int Frame,std::stringstream& Error)
+{
+	TFramePattern Pattern;
+	if ( !Pattern.Parse( MappedImage::GetPath( Reference ), Error ) )
+		return false;
+	if ( Pattern.IsSequence() && Frame < 0 )
+	{
+		Error << Reference << " is a sequence but no frame was given";
+		return false;
+	}
+
+	auto Filename = Pattern.GetFilename( Frame );
+	if ( Pattern.IsSequence() )
+		QueuePrefetch( Pattern, Frame );
+
+	auto File = GetFile( Filename, Error );
+	if ( !File )
+		return false;
+	return MappedImage::Read( Pixels, *File, Filename, Error );
+}
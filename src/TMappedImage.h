@@ -0,0 +1,82 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <SoyPixels.h>
+#include "TFileRoot.h"
+#include "TFramePattern.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+
+//	a read-only mapping of a whole file
+class TMappedFile
+{
+public:
+	TMappedFile();
+	~TMappedFile();
+
+	bool			Open(const std::string& Filename,std::stringstream& Error);
+	//	ask the os to start reading the pages in
+	void			Prefetch();
+
+	const uint8*	GetData() const		{	return static_cast<const uint8*>( mMemory );	}
+	size_t			GetSize() const		{	return mSize;	}
+
+private:
+	void*			mMemory;
+	size_t			mSize;
+};
+
+
+namespace MappedImage
+{
+	//	file:/path/image.png, or a sequence, file:/path/frame%06d.ppm with the frame number in another param
+	bool	IsReference(const std::string& Reference);
+	std::string	GetPath(const std::string& Reference);
+
+	//	binary ppm/pgm are copied straight out of the mapping, anything else is decoded from it
+	bool	Read(SoyPixels& Pixels,const TMappedFile& File,const std::string& Filename,std::stringstream& Error);
+};
+
+
+//	image=file: params. Files are mapped rather than read, and after a frame of a sequence the next few frames
+//	are mapped and prefetched on a thread so archive processing isn't waiting on the disk.
+//	Clients name the files, so nothing is read until a root is set and nothing outside it is ever mapped
+class TMappedImageReader
+{
+public:
+	TMappedImageReader(int ReadAhead=4);
+	~TMappedImageReader();
+
+	bool			SetRoot(const std::string& Root,std::stringstream& Error);
+
+	//	Frame<0 for a reference that isn't a sequence
+	bool			Read(SoyPixels& Pixels,const std::string& Reference,int Frame,std::stringstream& Error);
+
+private:
+	std::shared_ptr<TMappedFile>	OpenFile(std::string Filename,std::stringstream& Error);
+	std::shared_ptr<TMappedFile>	GetFile(const std::string& Filename,std::stringstream& Error);
+	void			AddPrefetchedFile(const std::string& Filename,std::shared_ptr<TMappedFile> File);
+	void			QueuePrefetch(const TFramePattern& Pattern,int Frame);
+	void			PrefetchThread();
+
+private:
+	int												mReadAhead;
+	size_t											mMaxFiles;		//	prefetched mappings kept; enough for the read-ahead and a few jobs in flight
+
+	std::mutex										mLock;
+	TFileRoot										mRoot;			//	unset and file: is disabled
+	std::map<std::string,std::shared_ptr<TMappedFile>>	mFiles;			//	prefetched, not yet read
+	std::deque<std::string>							mFileOrder;		//	oldest first
+
+	std::deque<std::string>							mPrefetchQueue;
+	std::condition_variable							mPrefetchWake;
+	bool											mStopping;
+	std::thread										mPrefetchThread;	//	started by the first sequence read
+};
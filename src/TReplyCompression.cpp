@@ -0,0 +1,113 @@
+#include "TReplyCompression.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(POPOPENCV_LZ4)
+	#include <lz4.h>
+#endif
+#if defined(POPOPENCV_ZSTD)
+	#include <zstd.h>
+#endif
+
+
+ReplyCompression::Codec::Type ReplyCompression::ToCodec(const std::string& Name)
+{
+	if ( Name == "lz4" )
+		return Codec::Lz4;
+	if ( Name == "zstd" )
+		return Codec::Zstd;
+	return Codec::None;
+}
+
+
+std::string ReplyCompression::ToString(Codec::Type Codec)
+{
+	switch ( Codec )
+	{
+		case Codec::Lz4:	return "lz4";
+		case Codec::Zstd:	return "zstd";
+		default:			return "none";
+	}
+}
+
+
+bool ReplyCompression::IsSupported(Codec::Type Codec)
+{
+	switch ( Codec )
+	{
+#if defined(POPOPENCV_LZ4)
+		case Codec::Lz4:	return true;
+#endif
+#if defined(POPOPENCV_ZSTD)
+		case Codec::Zstd:	return true;
+#endif
+		case Codec::None:	return true;
+		default:			return false;
+	}
+}
+
+
+bool ReplyCompression::Compress(ArrayBridge<char>&& Output,const char* Data,size_t Size,Codec::Type Codec,int Level,std::stringstream& Error)
+{
+	//	compress into a scratch buffer kept by the worker thread, then copy out the (smaller) result
+	thread_local std::vector<char> Scratch;
+	size_t CompressedSize = 0;
+
+	switch ( Codec )
+	{
+#if defined(POPOPENCV_LZ4)
+		case Codec::Lz4:
+		{
+			if ( Size > static_cast<size_t>( LZ4_MAX_INPUT_SIZE ) )
+			{
+				Error << "Payload of " << Size << " bytes is too big for lz4";
+				return false;
+			}
+			Scratch.resize( LZ4_compressBound( static_cast<int>(Size) ) );
+			int Result = LZ4_compress_default( Data, Scratch.data(), static_cast<int>(Size), static_cast<int>(Scratch.size()) );
+			if ( Result <= 0 )
+			{
+				Error << "lz4 compression failed";
+				return false;
+			}
+			CompressedSize = Result;
+			break;
+		}
+#endif
+#if defined(POPOPENCV_ZSTD)
+		case Codec::Zstd:
+		{
+			Scratch.resize( ZSTD_compressBound( Size ) );
+			auto Result = ZSTD_compress( Scratch.data(), Scratch.size(), Data, Size, Level );
+			if ( ZSTD_isError( Result ) )
+			{
+				Error << "zstd compression failed: " << ZSTD_getErrorName( Result );
+				return false;
+			}
+			CompressedSize = Result;
+			break;
+		}
+#endif
+		default:
+			Error << "Compression " << ToString( Codec ) << " is not supported by this build";
+			return false;
+	}
+
+	auto* Block = Output.PushBlock( CompressedSize );
+	memcpy( Block, Scratch.data(), CompressedSize );
+	return true;
+}
+
+
+TReplyCompressionParams::TReplyCompressionParams(TJobParams& Params) :
+	TReplyCompressionParams	()
+{
+	auto CodecName = Params.GetParamAsWithDefault<std::string>("compress", std::string() );
+	if ( !CodecName.empty() )
+		mCodec = ReplyCompression::ToCodec( CodecName );
+
+	int MinSize = Params.GetParamAsWithDefault("compressmin", static_cast<int>(mMinSize) );
+	mMinSize = std::max( 0, MinSize );
+	mLevel = Params.GetParamAsWithDefault("compresslevel", mLevel );
+}
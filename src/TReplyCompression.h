@@ -0,0 +1,51 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <TJob.h>
+#include <sstream>
+#include <string>
+
+
+//	codecs are enabled by POPOPENCV_LZ4 and POPOPENCV_ZSTD, which the project defines (linking liblz4/libzstd from
+//	homebrew). A build without one of them replies compression=none to requests for it
+namespace ReplyCompression
+{
+	namespace Codec
+	{
+		enum Type
+		{
+			None,
+			Lz4,
+			Zstd,
+		};
+	}
+
+	Codec::Type		ToCodec(const std::string& Name);	//	unknown names are None
+	std::string		ToString(Codec::Type Codec);
+	bool			IsSupported(Codec::Type Codec);
+
+	//	appends the compressed data to Output
+	bool			Compress(ArrayBridge<char>&& Output,const char* Data,size_t Size,Codec::Type Codec,int Level,std::stringstream& Error);
+};
+
+
+//	compress=lz4|zstd compressmin=bytes compresslevel=n
+class TReplyCompressionParams
+{
+public:
+	TReplyCompressionParams() :
+		mCodec		( ReplyCompression::Codec::None ),
+		mMinSize	( 4*1024 ),
+		mLevel		( 3 )
+	{
+	}
+	//	only ever from the job; a channel can serve many clients, so there's no per-channel default
+	TReplyCompressionParams(TJobParams& Params);
+
+	bool		IsEnabled(size_t PayloadSize) const	{	return mCodec != ReplyCompression::Codec::None && PayloadSize >= mMinSize;	}
+
+public:
+	ReplyCompression::Codec::Type	mCodec;
+	size_t							mMinSize;	//	smaller payloads aren't worth the time
+	int								mLevel;		//	zstd level; lz4 ignores it
+};
@@ -0,0 +1,271 @@
+#include "TSequenceProcessor.h"
+#include "CvPixels.h"
+#include "TFramePattern.h"
+#include <SoyData.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <dirent.h>
+#include <sys/stat.h>
+
+
+namespace SequenceProcessor
+{
+	bool	IsImageFilename(const std::string& Filename);
+	bool	FileExists(const std::string& Filename);
+	void	Decode(TSequenceFrame& Frame);
+	void	Write(TSequenceFrame& Frame,const TSequenceParams& Params);
+	int64	GetElapsedUs(std::chrono::steady_clock::time_point Start);
+}
+
+
+bool SequenceProcessor::IsImageFilename(const std::string& Filename)
+{
+	static const char* Extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".ppm", ".pgm" };
+	auto Dot = Filename.find_last_of('.');
+	if ( Dot == std::string::npos )
+		return false;
+	std::string Extension = Filename.substr( Dot );
+	std::transform( Extension.begin(), Extension.end(), Extension.begin(), ::tolower );
+	for ( auto* Match : Extensions )
+		if ( Extension == Match )
+			return true;
+	return false;
+}
+
+
+bool SequenceProcessor::FileExists(const std::string& Filename)
+{
+	struct stat Info;
+	return stat( Filename.c_str(), &Info ) == 0 && S_ISREG( Info.st_mode );
+}
+
+
+int64 SequenceProcessor::GetElapsedUs(std::chrono::steady_clock::time_point Start)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - Start ).count();
+}
+
+
+bool SequenceProcessor::GetInputFilenames(std::vector<std::string>& Filenames,const std::string& Input,int First,int Count,std::stringstream& Error)
+{
+	TFramePattern Pattern;
+	if ( !Pattern.Parse( Input, Error ) )
+		return false;
+
+	if ( Pattern.IsSequence() )
+	{
+		//	gaps end an open ended sequence
+		for ( int i=First;	Count<=0 || i<First+Count;	i++ )
+		{
+			auto Filename = Pattern.GetFilename( i );
+			if ( !FileExists( Filename ) )
+			{
+				if ( Count > 0 )
+				{
+					Error << "Missing sequence frame " << Filename;
+					return false;
+				}
+				break;
+			}
+			Filenames.push_back( Filename );
+		}
+	}
+	else
+	{
+		auto* Dir = opendir( Input.c_str() );
+		if ( !Dir )
+		{
+			Error << "Failed to open directory " << Input;
+			return false;
+		}
+		std::string Directory = Input;
+		if ( !Directory.empty() && Directory.back() != '/' )
+			Directory += '/';
+		while ( auto* Entry = readdir( Dir ) )
+		{
+			std::string Filename = Directory + Entry->d_name;
+			if ( IsImageFilename( Filename ) && FileExists( Filename ) )
+				Filenames.push_back( Filename );
+		}
+		closedir( Dir );
+		std::sort( Filenames.begin(), Filenames.end() );
+
+		if ( First > 0 )
+			Filenames.erase( Filenames.begin(), Filenames.begin() + std::min<size_t>( First, Filenames.size() ) );
+		if ( Count > 0 && Filenames.size() > Count )
+			Filenames.resize( Count );
+	}
+
+	if ( Filenames.empty() )
+	{
+		Error << "No frames found in " << Input;
+		return false;
+	}
+	return true;
+}
+
+
+std::string SequenceProcessor::GetOutputFilename(const std::string& OutputDirectory,const std::string& InputFilename,const std::string& Extension)
+{
+	auto Slash = InputFilename.find_last_of('/');
+	std::string Name = ( Slash == std::string::npos ) ? InputFilename : InputFilename.substr( Slash+1 );
+	auto Dot = Name.find_last_of('.');
+	if ( Dot != std::string::npos )
+		Name.resize( Dot );
+
+	std::string Filename = OutputDirectory;
+	if ( !Filename.empty() && Filename.back() != '/' )
+		Filename += '/';
+	return Filename + Name + Extension;
+}
+
+
+void SequenceProcessor::Decode(TSequenceFrame& Frame)
+{
+	cv::Mat Bgr = cv::imread( Frame.mInputFilename, CV_LOAD_IMAGE_COLOR );
+	if ( Bgr.empty() )
+	{
+		Frame.mError << "Failed to decode " << Frame.mInputFilename;
+		return;
+	}
+	cv::Mat Rgb;
+	cv::cvtColor( Bgr, Rgb, CV_BGR2RGB );
+	if ( !Opencv::GetPixels( Frame.mImage, Rgb ) )
+		Frame.mError << "Failed to convert " << Frame.mInputFilename << " to pixels";
+}
+
+
+void SequenceProcessor::Write(TSequenceFrame& Frame,const TSequenceParams& Params)
+{
+	//	the directory is checked against the root, but a link left in it would truncate whatever it points at
+	struct stat Info;
+	if ( lstat( Frame.mOutputFilename.c_str(), &Info ) == 0 && !S_ISREG( Info.st_mode ) )
+	{
+		Frame.mError << "Not overwriting " << Frame.mOutputFilename << ", it isn't a regular file";
+		return;
+	}
+
+	std::ofstream File( Frame.mOutputFilename, std::ios::out | std::ios::binary | std::ios::trunc );
+	if ( !File.is_open() )
+	{
+		Frame.mError << "Failed to open " << Frame.mOutputFilename << " for writing";
+		return;
+	}
+
+	if ( Params.mAsBinary )
+	{
+		SoyData_Stack<Array<char>> Binary;
+		if ( !Binary.EncodeRaw( Frame.mFeatures ) )
+		{
+			Frame.mError << "Failed to encode features for " << Frame.mOutputFilename;
+			return;
+		}
+		auto& Data = Binary.mValue;
+		File.write( Data.GetArray(), Data.GetSize() );
+	}
+	else
+	{
+		for ( int f=0;	f<Frame.mFeatures.GetSize();	f++ )
+		{
+			auto& Feature = Frame.mFeatures[f];
+			File << Feature.mCoord.x << ',' << Feature.mCoord.y << ',' << Feature.mScore << ',' << Feature.mFeature << '\n';
+		}
+	}
+
+	if ( !File.good() )
+		Frame.mError << "Failed writing " << Frame.mOutputFilename;
+}
+
+
+void SequenceProcessor::Run(const std::vector<std::string>& Filenames,std::function<void(TSequenceFrame&)> Extract,const TSequenceParams& Params,TSequenceStats& Stats)
+{
+	typedef std::shared_ptr<TSequenceFrame> TFramePtr;
+	TPipelineQueue<TFramePtr> Decoded( Params.mQueueDepth );
+	TPipelineQueue<TFramePtr> Extracted( Params.mQueueDepth );
+	std::atomic<int> NextFrame( 0 );
+	std::string Extension = Params.mAsBinary ? ".bin" : ".txt";
+
+	auto OnFailed = [&Stats](TSequenceFrame& Frame)
+	{
+		Stats.mFramesFailed++;
+		std::lock_guard<std::mutex> Lock( Stats.mErrorsLock );
+		Stats.mErrors << Frame.mError.str() << Soy::lf;
+	};
+
+	//	decoders take the next index, so frames can reach the later stages out of order; each frame has its own output
+	auto DecodeThread = [&]
+	{
+		for ( int Index=NextFrame++;	Index<Filenames.size();	Index=NextFrame++ )
+		{
+			TFramePtr Frame( new TSequenceFrame() );
+			Frame->mIndex = Index;
+			Frame->mInputFilename = Filenames[Index];
+			Frame->mOutputFilename = GetOutputFilename( Params.mOutputDirectory, Frame->mInputFilename, Extension );
+			auto Start = std::chrono::steady_clock::now();
+			Decode( *Frame );
+			Stats.mDecodeUs += GetElapsedUs( Start );
+			if ( Frame->mError.tellp() > 0 )
+			{
+				OnFailed( *Frame );
+				continue;
+			}
+			Decoded.Push( Frame );
+		}
+	};
+
+	auto ExtractThread = [&]
+	{
+		TFramePtr Frame;
+		while ( Decoded.Pop( Frame ) )
+		{
+			auto Start = std::chrono::steady_clock::now();
+			Extract( *Frame );
+			Stats.mExtractUs += GetElapsedUs( Start );
+
+			//	pixels aren't needed any more, don't hold them in the write queue
+			Frame->mImage = SoyPixels();
+			if ( Frame->mError.tellp() > 0 )
+			{
+				OnFailed( *Frame );
+				continue;
+			}
+			Extracted.Push( Frame );
+		}
+	};
+
+	auto WriteThread = [&]
+	{
+		TFramePtr Frame;
+		while ( Extracted.Pop( Frame ) )
+		{
+			auto Start = std::chrono::steady_clock::now();
+			Write( *Frame, Params );
+			Stats.mWriteUs += GetElapsedUs( Start );
+			if ( Frame->mError.tellp() > 0 )
+				OnFailed( *Frame );
+			else
+				Stats.mFramesWritten++;
+		}
+	};
+
+	std::vector<std::thread> Decoders;
+	std::vector<std::thread> Extractors;
+	for ( int i=0;	i<std::max(1,Params.mDecodeThreads);	i++ )
+		Decoders.push_back( std::thread( DecodeThread ) );
+	for ( int i=0;	i<std::max(1,Params.mExtractThreads);	i++ )
+		Extractors.push_back( std::thread( ExtractThread ) );
+	std::thread Writer( WriteThread );
+
+	//	close each queue once everything feeding it has finished
+	for ( auto& Thread : Decoders )
+		Thread.join();
+	Decoded.Close();
+	for ( auto& Thread : Extractors )
+		Thread.join();
+	Extracted.Close();
+	Writer.join();
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <SoyPixels.h>
+#include <TFeatureBinRing.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+class TSequenceFrame
+{
+public:
+	TSequenceFrame() :
+		mIndex	( -1 )
+	{
+	}
+
+public:
+	int						mIndex;
+	std::string				mInputFilename;
+	std::string				mOutputFilename;
+	SoyPixels				mImage;
+	Array<TFeatureMatch>	mFeatures;
+	std::stringstream		mError;
+};
+
+
+//	bounded queue between two pipeline stages. Push blocks whilst full so a fast stage can't run away from a slow one
+template<typename TYPE>
+class TPipelineQueue
+{
+public:
+	TPipelineQueue(size_t MaxSize) :
+		mMaxSize	( std::max<size_t>( 1, MaxSize ) ),
+		mClosed		( false )
+	{
+	}
+
+	void		Push(const TYPE& Item)
+	{
+		std::unique_lock<std::mutex> Lock( mLock );
+		mNotFull.wait( Lock, [this]{	return mItems.size() < mMaxSize;	} );
+		mItems.push_back( Item );
+		mNotEmpty.notify_one();
+	}
+
+	//	false when closed and drained
+	bool		Pop(TYPE& Item)
+	{
+		std::unique_lock<std::mutex> Lock( mLock );
+		mNotEmpty.wait( Lock, [this]{	return !mItems.empty() || mClosed;	} );
+		if ( mItems.empty() )
+			return false;
+		Item = mItems.front();
+		mItems.pop_front();
+		mNotFull.notify_one();
+		return true;
+	}
+
+	//	no more pushes; poppers finish what's queued
+	void		Close()
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mClosed = true;
+		mNotEmpty.notify_all();
+	}
+
+private:
+	std::mutex				mLock;
+	std::condition_variable	mNotEmpty;
+	std::condition_variable	mNotFull;
+	std::deque<TYPE>		mItems;
+	size_t					mMaxSize;
+	bool					mClosed;
+};
+
+
+class TSequenceParams
+{
+public:
+	TSequenceParams() :
+		mDecodeThreads	( 2 ),
+		mExtractThreads	( 1 ),
+		mQueueDepth		( 4 ),
+		mAsBinary		( false )
+	{
+	}
+
+public:
+	int				mDecodeThreads;
+	int				mExtractThreads;
+	int				mQueueDepth;		//	frames waiting between each pair of stages
+	bool			mAsBinary;			//	raw encoded matches rather than x,y,score,feature lines
+	std::string		mOutputDirectory;
+};
+
+
+class TSequenceStats
+{
+public:
+	TSequenceStats() :
+		mFramesWritten	( 0 ),
+		mFramesFailed	( 0 ),
+		mDecodeUs		( 0 ),
+		mExtractUs		( 0 ),
+		mWriteUs		( 0 )
+	{
+	}
+
+public:
+	std::atomic<int>		mFramesWritten;
+	std::atomic<int>		mFramesFailed;
+	std::atomic<int64>		mDecodeUs;		//	summed over threads
+	std::atomic<int64>		mExtractUs;
+	std::atomic<int64>		mWriteUs;
+
+	std::mutex				mErrorsLock;
+	std::stringstream		mErrors;		//	first error of each failed frame
+};
+
+
+namespace SequenceProcessor
+{
+	//	input is a directory (image files, sorted by name) or a pattern with a single %d/%0Nd like frames/%05d.png.
+	//	A pattern runs from First for Count frames, or until a file is missing if Count is zero
+	bool	GetInputFilenames(std::vector<std::string>& Filenames,const std::string& Input,int First,int Count,std::stringstream& Error);
+
+	//	output directory plus the input's name with a new extension
+	std::string	GetOutputFilename(const std::string& OutputDirectory,const std::string& InputFilename,const std::string& Extension);
+
+	//	decode -> extract -> write, each stage on its own thread(s) connected by bounded queues. Output is one file per frame.
+	//	Extract is called on the extract threads and must be safe to call concurrently
+	void	Run(const std::vector<std::string>& Filenames,std::function<void(TSequenceFrame&)> Extract,const TSequenceParams& Params,TSequenceStats& Stats);
+};
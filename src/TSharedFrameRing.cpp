@@ -0,0 +1,414 @@
+#include "TSharedFrameRing.h"
+#include <SoyDebug.h>
+#include <SoyString.h>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace SharedFrameRing
+{
+	const char	Magic[4] = { 'P', 'F', 'R', 'M' };
+	const char	Prefix[] = "shm:";
+
+	size_t		GetSlotsOffset()				{	return ( sizeof(TSharedFrameRingHeader) + 63 ) & ~63;	}
+	size_t		GetDataOffset(int SlotCount)	{	return ( GetSlotsOffset() + SlotCount * sizeof(TSharedFrameSlot) + 63 ) & ~63;	}
+}
+
+
+TSharedFrameRing::TSharedFrameRing() :
+	mOwner		( false ),
+	mMemory		( nullptr ),
+	mMemorySize	( 0 ),
+	mHeader		( nullptr ),
+	mDevice		( 0 ),
+	mInode		( 0 )
+{
+}
+
+
+TSharedFrameRing::~TSharedFrameRing()
+{
+	Close();
+}
+
+
+std::string TSharedFrameRing::GetShmName(const std::string& Name)
+{
+	//	osx limits shm names to 31 chars
+	return "/pfr." + Name;
+}
+
+
+void TSharedFrameRing::Close()
+{
+	if ( mMemory )
+		munmap( mMemory, mMemorySize );
+	if ( mOwner )
+		shm_unlink( GetShmName( mName ).c_str() );
+	mMemory = nullptr;
+	mMemorySize = 0;
+	mHeader = nullptr;
+	mOwner = false;
+}
+
+
+bool TSharedFrameRing::Map(int FileDescriptor,size_t Size,bool Writable,std::stringstream& Error)
+{
+	int Protection = PROT_READ | ( Writable ? PROT_WRITE : 0 );
+	auto* Memory = mmap( nullptr, Size, Protection, MAP_SHARED, FileDescriptor, 0 );
+	close( FileDescriptor );
+	if ( Memory == MAP_FAILED )
+	{
+		Error << "Failed to map shared frame ring " << mName << ": " << strerror( errno );
+		return false;
+	}
+	mMemory = Memory;
+	mMemorySize = Size;
+	mHeader = static_cast<TSharedFrameRingHeader*>( Memory );
+	return true;
+}
+
+
+TSharedFrameSlot& TSharedFrameRing::GetSlot(int Slot)
+{
+	auto* Slots = reinterpret_cast<TSharedFrameSlot*>( static_cast<uint8*>(mMemory) + SharedFrameRing::GetSlotsOffset() );
+	return Slots[Slot];
+}
+
+
+uint8* TSharedFrameRing::GetSlotData(int Slot)
+{
+	auto* Data = static_cast<uint8*>(mMemory) + SharedFrameRing::GetDataOffset( mHeader->mSlotCount );
+	return Data + Slot * static_cast<size_t>( mHeader->mSlotDataSize );
+}
+
+
+bool TSharedFrameRing::Create(const std::string& Name,int SlotCount,size_t SlotDataSize,std::stringstream& Error)
+{
+	Close();
+	mName = Name;
+	if ( SlotCount <= 0 || SlotDataSize == 0 )
+	{
+		Error << "Shared frame ring needs slots";
+		return false;
+	}
+
+	auto ShmName = GetShmName( Name );
+	shm_unlink( ShmName.c_str() );
+	int FileDescriptor = shm_open( ShmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+	if ( FileDescriptor < 0 )
+	{
+		Error << "Failed to create shared frame ring " << Name << ": " << strerror( errno );
+		return false;
+	}
+	auto Size = SharedFrameRing::GetDataOffset( SlotCount ) + SlotCount * SlotDataSize;
+	if ( ftruncate( FileDescriptor, Size ) != 0 )
+	{
+		Error << "Failed to size shared frame ring " << Name << ": " << strerror( errno );
+		close( FileDescriptor );
+		shm_unlink( ShmName.c_str() );
+		return false;
+	}
+	if ( !Map( FileDescriptor, Size, true, Error ) )
+	{
+		shm_unlink( ShmName.c_str() );
+		return false;
+	}
+	mOwner = true;
+
+	//	memory is zeroed by ftruncate; magic goes last so a reader never sees a half made header
+	mHeader->mVersion = TSharedFrameRingHeader::Version;
+	mHeader->mSlotCount = SlotCount;
+	mHeader->mSlotDataSize = static_cast<uint32>( SlotDataSize );
+	mHeader->mNextFrame.store( 0 );
+	std::atomic_thread_fence( std::memory_order_release );
+	memcpy( mHeader->mMagic, SharedFrameRing::Magic, sizeof(SharedFrameRing::Magic) );
+	return true;
+}
+
+
+int TSharedFrameRing::Write(const SoyPixels& Pixels,uint64& Frame,std::stringstream& Error)
+{
+	if ( !mHeader || !mOwner )
+	{
+		Error << "Shared frame ring " << mName << " isn't open for writing";
+		return -1;
+	}
+
+	//	no const access to the array, but we only read
+	auto& PixelsArray = const_cast<SoyPixels&>( Pixels ).GetPixelsArray();
+	auto DataSize = PixelsArray.GetSize();
+	if ( DataSize > mHeader->mSlotDataSize )
+	{
+		Error << "Frame " << Pixels.GetWidth() << "x" << Pixels.GetHeight() << " is too big for shared frame ring " << mName;
+		return -1;
+	}
+
+	Frame = mHeader->mNextFrame.fetch_add( 1 );
+	int SlotIndex = static_cast<int>( Frame % mHeader->mSlotCount );
+	auto& Slot = GetSlot( SlotIndex );
+
+	//	claim the slot; odd whilst writing. If a writer a lap behind still has it, wait for it, but not forever
+	//	as a worker that crashed mid-write never releases it. After the timeout a dead writer's claim is taken over
+	static const auto ClaimTimeout = std::chrono::milliseconds( 100 );
+	auto ClaimDeadline = std::chrono::steady_clock::now() + ClaimTimeout;
+	bool TookOver = false;
+	auto Sequence = Slot.mSequence.load( std::memory_order_acquire );
+	while ( ( Sequence & 1 ) || !Slot.mSequence.compare_exchange_weak( Sequence, Sequence+1, std::memory_order_acq_rel ) )
+	{
+		if ( std::chrono::steady_clock::now() > ClaimDeadline )
+		{
+			TookOver = ( Sequence & 1 ) && TakeOverSlot( Slot, Sequence );
+			if ( TookOver )
+				break;
+			Error << "Shared frame ring " << mName << " slot " << SlotIndex << " is stuck being written";
+			return -1;
+		}
+		std::this_thread::yield();
+		Sequence = Slot.mSequence.load( std::memory_order_acquire );
+	}
+	//	from here on Sequence is the even value before our claim
+	Slot.mWriterPid.store( getpid() );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	//	a writer a lap ahead got here first; don't replace its newer frame. The pid is cleared before the sequence moves
+	//	on, so the next claim never shows ours. A dead writer's slot is half written though, so that's always replaced
+	if ( !TookOver && Slot.mFrame > Frame )
+	{
+		Slot.mWriterPid.store( 0 );
+		Slot.mSequence.store( Sequence+2, std::memory_order_release );
+		Error << "Shared frame ring " << mName << " slot " << SlotIndex << " already has newer frame " << Slot.mFrame;
+		return -1;
+	}
+
+	memcpy( GetSlotData( SlotIndex ), PixelsArray.GetArray(), DataSize );
+	Slot.mWidth = Pixels.GetWidth();
+	Slot.mHeight = Pixels.GetHeight();
+	Slot.mFormat = static_cast<uint32>( Pixels.GetFormat() );
+	Slot.mDataSize = static_cast<uint32>( DataSize );
+	Slot.mFrame = Frame;
+	Slot.mWriterPid.store( 0 );
+	Slot.mSequence.store( Sequence+2, std::memory_order_release );
+	return SlotIndex;
+}
+
+
+bool TSharedFrameRing::TakeOverSlot(TSharedFrameSlot& Slot,uint32& Sequence)
+{
+	//	the pid was read during this claim (the sequence hasn't moved), and a claimer that hasn't set it yet is alive
+	auto Pid = Slot.mWriterPid.load();
+	if ( Pid == 0 || Slot.mSequence.load( std::memory_order_acquire ) != Sequence )
+		return false;
+	if ( kill( Pid, 0 ) == 0 || errno != ESRCH )
+		return false;
+
+	//	still odd, so readers keep rejecting the slot. Other writers racing to take it over compete on the same swap
+	if ( !Slot.mSequence.compare_exchange_strong( Sequence, Sequence+2, std::memory_order_acq_rel ) )
+		return false;
+	Sequence += 1;
+	std::Debug << "Shared frame ring " << mName << " writer " << Pid << " died mid-write, taking over its slot" << std::endl;
+	return true;
+}
+
+
+bool TSharedFrameRing::Open(const std::string& Name,std::stringstream& Error)
+{
+	Close();
+	mName = Name;
+	int FileDescriptor = shm_open( GetShmName( Name ).c_str(), O_RDONLY, 0 );
+	if ( FileDescriptor < 0 )
+	{
+		Error << "No shared frame ring " << Name << ": " << strerror( errno );
+		return false;
+	}
+	struct stat Info;
+	if ( fstat( FileDescriptor, &Info ) != 0 || Info.st_size < static_cast<off_t>( sizeof(TSharedFrameRingHeader) ) )
+	{
+		Error << "Shared frame ring " << Name << " is too small";
+		close( FileDescriptor );
+		return false;
+	}
+	if ( !Map( FileDescriptor, Info.st_size, false, Error ) )
+		return false;
+	mDevice = Info.st_dev;
+	mInode = Info.st_ino;
+
+	bool Valid = memcmp( mHeader->mMagic, SharedFrameRing::Magic, sizeof(SharedFrameRing::Magic) ) == 0;
+	Valid = Valid && mHeader->mVersion == TSharedFrameRingHeader::Version;
+	Valid = Valid && SharedFrameRing::GetDataOffset( mHeader->mSlotCount ) + mHeader->mSlotCount * static_cast<size_t>( mHeader->mSlotDataSize ) <= mMemorySize;
+	if ( !Valid )
+	{
+		Error << "Shared frame ring " << Name << " isn't a version " << TSharedFrameRingHeader::Version << " ring";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+bool TSharedFrameRing::IsReplaced() const
+{
+	//	if it's gone altogether there's nothing newer to open
+	int FileDescriptor = shm_open( GetShmName( mName ).c_str(), O_RDONLY, 0 );
+	if ( FileDescriptor < 0 )
+		return false;
+	struct stat Info;
+	bool Replaced = fstat( FileDescriptor, &Info ) == 0 && ( Info.st_dev != mDevice || Info.st_ino != mInode );
+	close( FileDescriptor );
+	return Replaced;
+}
+
+
+bool TSharedFrameRing::Read(SoyPixels& Pixels,int SlotIndex,int64 Frame,bool& Stale,std::stringstream& Error)
+{
+	Stale = false;
+	if ( !mHeader || SlotIndex < 0 || SlotIndex >= static_cast<int>( mHeader->mSlotCount ) )
+	{
+		Error << "Shared frame ring " << mName << " has no slot " << SlotIndex;
+		Stale = true;
+		return false;
+	}
+
+	auto& Slot = GetSlot( SlotIndex );
+	auto Sequence = Slot.mSequence.load( std::memory_order_acquire );
+	if ( Sequence & 1 )
+	{
+		Error << "Shared frame ring " << mName << " slot " << SlotIndex << " is being written";
+		return false;
+	}
+	if ( Sequence == 0 )
+	{
+		Error << "Shared frame ring " << mName << " slot " << SlotIndex << " has never been written";
+		Stale = true;
+		return false;
+	}
+
+	auto Width = Slot.mWidth;
+	auto Height = Slot.mHeight;
+	auto Format = static_cast<SoyPixelsFormat::Type>( Slot.mFormat );
+	auto DataSize = std::min( Slot.mDataSize, mHeader->mSlotDataSize );
+	auto SlotFrame = Slot.mFrame;
+	if ( Frame >= 0 && SlotFrame != static_cast<uint64>( Frame ) )
+	{
+		Error << "Shared frame ring " << mName << " slot " << SlotIndex << " holds frame " << SlotFrame << " not " << Frame;
+		Stale = true;
+		return false;
+	}
+
+	//	the fields may be mid-write until the sequence is re-checked, so never size the image bigger than a slot
+	auto FrameSize = static_cast<uint64>( Width ) * Height * SoyPixelsFormat::GetChannelCount( Format );
+	if ( FrameSize == 0 || FrameSize > mHeader->mSlotDataSize )
+	{
+		Error << "Shared frame ring " << mName << " slot " << SlotIndex << " has an invalid frame";
+		return false;
+	}
+
+	if ( Pixels.GetWidth() != static_cast<int>(Width) || Pixels.GetHeight() != static_cast<int>(Height) || Pixels.GetFormat() != Format )
+	{
+		if ( !Pixels.Init( Width, Height, Format ) )
+		{
+			Error << "Shared frame ring " << mName << " slot " << SlotIndex << " has an invalid frame";
+			return false;
+		}
+	}
+	auto& PixelsArray = Pixels.GetPixelsArray();
+	memcpy( PixelsArray.GetArray(), GetSlotData( SlotIndex ), std::min<size_t>( DataSize, PixelsArray.GetSize() ) );
+
+	//	if the writer came round whilst we were copying, the pixels are torn
+	std::atomic_thread_fence( std::memory_order_acquire );
+	if ( Slot.mSequence.load( std::memory_order_relaxed ) != Sequence )
+	{
+		Error << "Shared frame ring " << mName << " slot " << SlotIndex << " was overwritten whilst reading";
+		return false;
+	}
+	return true;
+}
+
+
+bool SharedFrameRing::IsReference(const std::string& Reference)
+{
+	return Reference.compare( 0, sizeof(Prefix)-1, Prefix ) == 0;
+}
+
+
+bool SharedFrameRing::ParseReference(const std::string& Reference,std::string& Ring,int& Slot,int64& Frame,std::stringstream& Error)
+{
+	//	shm:ring/slot[/frame]
+	auto Path = Reference.substr( sizeof(Prefix)-1 );
+	auto SlotStart = Path.find('/');
+	if ( SlotStart == std::string::npos || SlotStart == 0 )
+	{
+		Error << "Expected shm:<ring>/<slot>[/<frame>], got " << Reference;
+		return false;
+	}
+	Ring = Path.substr( 0, SlotStart );
+	auto SlotString = Path.substr( SlotStart+1 );
+	auto FrameStart = SlotString.find('/');
+	std::string FrameString;
+	if ( FrameStart != std::string::npos )
+	{
+		FrameString = SlotString.substr( FrameStart+1 );
+		SlotString.resize( FrameStart );
+	}
+
+	Frame = -1;
+	if ( !Soy::StringToType( Slot, SlotString ) || ( !FrameString.empty() && !Soy::StringToType( Frame, FrameString ) ) )
+	{
+		Error << "Bad slot/frame in " << Reference;
+		return false;
+	}
+	return true;
+}
+
+
+bool TSharedFrameRings::Read(SoyPixels& Pixels,const std::string& Reference,std::stringstream& Error)
+{
+	std::string RingName;
+	int Slot = -1;
+	int64 Frame = -1;
+	if ( !SharedFrameRing::ParseReference( Reference, RingName, Slot, Frame, Error ) )
+		return false;
+
+	std::shared_ptr<TSharedFrameRing> Ring;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		auto& OpenRing = mRings[RingName];
+		if ( !OpenRing )
+		{
+			std::shared_ptr<TSharedFrameRing> NewRing( new TSharedFrameRing() );
+			if ( !NewRing->Open( RingName, Error ) )
+			{
+				mRings.erase( RingName );
+				return false;
+			}
+			OpenRing = NewRing;
+		}
+		Ring = OpenRing;
+	}
+
+	//	a producer that restarted has a new ring under the same name; re-open and try once more. A slot being
+	//	written or a frame that's been reused are normal, so only look for a new ring when the slot is stale
+	bool Stale = false;
+	if ( Ring->Read( Pixels, Slot, Frame, Stale, Error ) )
+		return true;
+	if ( !Stale || !Ring->IsReplaced() )
+		return false;
+
+	std::shared_ptr<TSharedFrameRing> NewRing( new TSharedFrameRing() );
+	std::stringstream ReopenError;
+	if ( !NewRing->Open( RingName, ReopenError ) )
+		return false;
+	{
+		std::lock_guard<std::mutex> Lock( mLock );
+		mRings[RingName] = NewRing;
+	}
+	Error.str( std::string() );
+	return NewRing->Read( Pixels, Slot, Frame, Stale, Error );
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <SoyPixels.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/types.h>
+
+
+//	a ring of frames in posix shared memory, written by a capture process on the same host and read by jobs
+//	that reference a slot with image=shm:<ring>/<slot>[/<frame>] rather than sending pixels.
+//	Each slot is a seqlock; a writer claims the slot by swapping the sequence from even to odd (so writers in several
+//	processes can share a ring), and makes it even again when done. Readers copy then check it didn't change.
+//	The sequence only ever goes up, so each odd value is one claim, and the claimer's pid lets another writer take
+//	over a slot whose writer died mid-write.
+//	This layout is the contract with producers in other processes, so it's fixed size and versioned
+class TSharedFrameRingHeader
+{
+public:
+	static const uint32	Version = 2;
+
+public:
+	char					mMagic[4];		//	PFRM
+	uint32					mVersion;
+	uint32					mSlotCount;
+	uint32					mSlotDataSize;	//	max bytes of pixels per slot
+	std::atomic<uint64>		mNextFrame;
+};
+
+
+class TSharedFrameSlot
+{
+public:
+	std::atomic<uint32>		mSequence;
+	std::atomic<int32_t>	mWriterPid;		//	whilst the sequence is odd; 0 until the claimer has set it
+	uint32					mWidth;
+	uint32					mHeight;
+	uint32					mFormat;		//	SoyPixelsFormat::Type
+	uint32					mDataSize;
+	uint64					mFrame;			//	frame number written; lets a reader detect the slot was reused
+};
+
+
+class TSharedFrameRing
+{
+public:
+	TSharedFrameRing();
+	~TSharedFrameRing();
+
+	//	producer; creates (or replaces) the ring
+	bool			Create(const std::string& Name,int SlotCount,size_t SlotDataSize,std::stringstream& Error);
+	//	write into the next slot, returns the slot index, or -1 if the frame is too big or the slot couldn't be claimed
+	int				Write(const SoyPixels& Pixels,uint64& Frame,std::stringstream& Error);
+
+	//	consumer
+	bool			Open(const std::string& Name,std::stringstream& Error);
+	//	copy a slot out. Frame<0 accepts whatever is in the slot. Stale is set if the slot doesn't exist or doesn't
+	//	hold that frame, which is also what a ring replaced by a restarted producer looks like
+	bool			Read(SoyPixels& Pixels,int Slot,int64 Frame,bool& Stale,std::stringstream& Error);
+	//	a different ring has been created under our name since we opened it
+	bool			IsReplaced() const;
+
+	int				GetSlotCount() const	{	return mHeader ? mHeader->mSlotCount : 0;	}
+
+private:
+	bool			Map(int FileDescriptor,size_t Size,bool Writable,std::stringstream& Error);
+	void			Close();
+	TSharedFrameSlot&	GetSlot(int Slot);
+	//	a claim (odd Sequence) whose writer has exited is taken over; the sequence moves on to a new odd value
+	bool			TakeOverSlot(TSharedFrameSlot& Slot,uint32& Sequence);
+	uint8*			GetSlotData(int Slot);
+	static std::string	GetShmName(const std::string& Name);
+
+private:
+	std::string				mName;
+	bool					mOwner;		//	created it, so unlinks it
+	void*					mMemory;
+	size_t					mMemorySize;
+	TSharedFrameRingHeader*	mHeader;
+	dev_t					mDevice;	//	identity of the shm object we opened
+	ino_t					mInode;
+};
+
+
+namespace SharedFrameRing
+{
+	//	shm:<ring>/<slot>[/<frame>]
+	bool	IsReference(const std::string& Reference);
+	bool	ParseReference(const std::string& Reference,std::string& Ring,int& Slot,int64& Frame,std::stringstream& Error);
+};
+
+
+//	rings opened on demand by name
+class TSharedFrameRings
+{
+public:
+	bool		Read(SoyPixels& Pixels,const std::string& Reference,std::stringstream& Error);
+
+private:
+	std::mutex												mLock;
+	std::map<std::string,std::shared_ptr<TSharedFrameRing>>	mRings;
+};
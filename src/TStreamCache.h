@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+//	state kept between jobs under a client's stream= id. Clients make the ids up, so like the mask cache the least
+//	recently used go when there are too many, and like calibration sessions, streams nothing has used for a while
+//	are dropped. A job still holding a dropped stream finishes with it; the next call with the id starts afresh
+template<typename TYPE>
+class TStreamCache
+{
+public:
+	TStreamCache(size_t MaxStreams=16,int IdleTimeoutSecs=5*60) :
+		mMaxStreams			( MaxStreams ),
+		mIdleTimeoutSecs	( IdleTimeoutSecs )
+	{
+	}
+
+	//	creates the stream if it doesn't exist (or has been dropped)
+	std::shared_ptr<TYPE>	Get(const std::string& Name);
+
+private:
+	typedef std::chrono::steady_clock::time_point	TTime;
+
+	struct TEntry
+	{
+		std::string				mName;
+		std::shared_ptr<TYPE>	mStream;
+		TTime					mLastUsed;
+	};
+	typedef std::list<TEntry>	TStreamList;
+
+	size_t									mMaxStreams;
+	int										mIdleTimeoutSecs;
+	std::mutex								mLock;
+	TStreamList								mStreams;	//	most recently used first
+	std::map<std::string,typename TStreamList::iterator>	mIndex;
+};
+
+
+template<typename TYPE>
+std::shared_ptr<TYPE> TStreamCache<TYPE>::Get(const std::string& Name)
+{
+	//	dropped streams are released after the lock, they can be big
+	std::vector<std::shared_ptr<TYPE>> Dropped;
+	std::lock_guard<std::mutex> Lock( mLock );
+	auto Now = std::chrono::steady_clock::now();
+
+	auto Existing = mIndex.find( Name );
+	if ( Existing != mIndex.end() )
+	{
+		mStreams.splice( mStreams.begin(), mStreams, Existing->second );
+	}
+	else
+	{
+		mStreams.push_front( TEntry{ Name, std::make_shared<TYPE>(), Now } );
+		mIndex[Name] = mStreams.begin();
+	}
+	auto& Entry = mStreams.front();
+	Entry.mLastUsed = Now;
+	auto Stream = Entry.mStream;
+
+	//	least recently used are at the back, so that's where the idle ones are too
+	auto IdleBefore = Now - std::chrono::seconds( mIdleTimeoutSecs );
+	while ( mStreams.size() > 1 && ( mStreams.size() > mMaxStreams || mStreams.back().mLastUsed < IdleBefore ) )
+	{
+		Dropped.push_back( mStreams.back().mStream );
+		mIndex.erase( mStreams.back().mName );
+		mStreams.pop_back();
+	}
+	return Stream;
+}
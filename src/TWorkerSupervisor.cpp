@@ -0,0 +1,252 @@
+#include "TWorkerSupervisor.h"
+#include <SoyDebug.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <thread>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+
+namespace WorkerSupervisor
+{
+	volatile sig_atomic_t	gStopSignal = 0;
+
+	void	OnStopSignal(int Signal)	{	gStopSignal = Signal;	}
+	void	OnAlarmSignal(int Signal)	{	}
+
+	//	SIGALRM interrupts waitpid when the next restart is due. It repeats in case it fires just before waitpid
+	//	is entered; Delay of zero disarms it
+	void	SetRestartAlarm(std::chrono::microseconds Delay)
+	{
+		struct itimerval Timer;
+		memset( &Timer, 0, sizeof(Timer) );
+		if ( Delay.count() > 0 )
+		{
+			Timer.it_value.tv_sec = static_cast<time_t>( Delay.count() / 1000000 );
+			Timer.it_value.tv_usec = static_cast<suseconds_t>( Delay.count() % 1000000 );
+			Timer.it_interval.tv_usec = 50 * 1000;
+		}
+		setitimer( ITIMER_REAL, &Timer, nullptr );
+	}
+}
+
+
+TWorkerSupervisor::TWorkerSupervisor(const TWorkerSupervisorParams& Params,TWorkerMain WorkerMain) :
+	mParams		( Params ),
+	mWorkerMain	( WorkerMain )
+{
+	int PortCount = std::max( 0, mParams.mLastPort - mParams.mFirstPort + 1 );
+	mWorkers.resize( std::min( mParams.mWorkerCount, PortCount ) );
+	for ( int w=0;	w<mWorkers.size();	w++ )
+	{
+		mWorkers[w].mPort = mParams.mFirstPort + w;
+		mWorkers[w].mRestartDelayMs = mParams.mRestartDelayMs;
+	}
+}
+
+
+void TWorkerSupervisor::SetAffinity(int Worker)
+{
+#if defined(__linux__)
+	int CoreCount = std::max<int>( 1, std::thread::hardware_concurrency() );
+	int CoresPerWorker = mParams.mCoresPerWorker > 0 ? mParams.mCoresPerWorker : std::max<int>( 1, CoreCount / mWorkers.size() );
+	cpu_set_t Cores;
+	CPU_ZERO( &Cores );
+	for ( int c=0;	c<CoresPerWorker;	c++ )
+		CPU_SET( ( Worker * CoresPerWorker + c ) % CoreCount, &Cores );
+	sched_setaffinity( 0, sizeof(Cores), &Cores );
+#endif
+}
+
+
+bool TWorkerSupervisor::Start(int Worker,std::stringstream& Error)
+{
+	auto& Process = mWorkers[Worker];
+	auto Pid = fork();
+	if ( Pid < 0 )
+	{
+		Error << "Failed to fork worker " << Worker << ": " << strerror( errno );
+		return false;
+	}
+
+	if ( Pid == 0 )
+	{
+		//	the supervisor's handlers and atexit work aren't the child's
+		signal( SIGINT, SIG_DFL );
+		signal( SIGTERM, SIG_DFL );
+#if defined(__linux__)
+		prctl( PR_SET_PDEATHSIG, SIGTERM );
+#endif
+		SetAffinity( Worker );
+		int ExitCode = mWorkerMain( Worker, Process.mPort );
+		_exit( ExitCode );
+	}
+
+	Process.mPid = Pid;
+	Process.mStarted = std::chrono::steady_clock::now();
+	std::Debug << "Worker " << Worker << " (pid " << Pid << ") serving port " << Process.mPort << std::endl;
+	return true;
+}
+
+
+void TWorkerSupervisor::StopWorkers()
+{
+	for ( auto& Process : mWorkers )
+	{
+		if ( Process.mPid > 0 )
+			kill( Process.mPid, SIGTERM );
+	}
+	for ( auto& Process : mWorkers )
+	{
+		if ( Process.mPid > 0 )
+			waitpid( Process.mPid, nullptr, 0 );
+		Process.mPid = -1;
+	}
+}
+
+
+bool TWorkerSupervisor::StartPending(bool& HasPending,std::chrono::steady_clock::time_point& NextRestart,std::stringstream& Error)
+{
+	auto Now = std::chrono::steady_clock::now();
+	HasPending = false;
+	for ( int w=0;	w<mWorkers.size();	w++ )
+	{
+		auto& Process = mWorkers[w];
+		if ( !Process.mRestartPending )
+			continue;
+		if ( Process.mRestartTime <= Now )
+		{
+			Process.mRestartPending = false;
+			if ( !Start( w, Error ) )
+				return false;
+			continue;
+		}
+		if ( !HasPending || Process.mRestartTime < NextRestart )
+			NextRestart = Process.mRestartTime;
+		HasPending = true;
+	}
+	return true;
+}
+
+
+void TWorkerSupervisor::OnExited(int WorkerIndex,int Status)
+{
+	auto& Process = mWorkers[WorkerIndex];
+	Process.mPid = -1;
+
+	if ( WIFEXITED( Status ) && WEXITSTATUS( Status ) == 0 )
+	{
+		std::Debug << "Worker " << WorkerIndex << " exited" << std::endl;
+		Process.mFinished = true;
+		return;
+	}
+
+	//	a worker that dies as soon as it starts (eg. port in use) backs off rather than spinning
+	auto Now = std::chrono::steady_clock::now();
+	auto UpMs = std::chrono::duration_cast<std::chrono::milliseconds>( Now - Process.mStarted ).count();
+	if ( UpMs < mParams.mMaxRestartDelayMs )
+		Process.mRestartDelayMs = std::min( Process.mRestartDelayMs * 2, mParams.mMaxRestartDelayMs );
+	else
+		Process.mRestartDelayMs = mParams.mRestartDelayMs;
+
+	if ( WIFSIGNALED( Status ) )
+		std::Debug << "Worker " << WorkerIndex << " killed by signal " << WTERMSIG( Status );
+	else
+		std::Debug << "Worker " << WorkerIndex << " exited with " << WEXITSTATUS( Status );
+	std::Debug << ", restart " << ++Process.mRestarts << " in " << Process.mRestartDelayMs << "ms" << std::endl;
+
+	//	the others are still reaped and restarted whilst this one waits
+	Process.mRestartPending = true;
+	Process.mRestartTime = Now + std::chrono::milliseconds( Process.mRestartDelayMs );
+}
+
+
+bool TWorkerSupervisor::Run(std::stringstream& Error)
+{
+	if ( mWorkers.empty() )
+	{
+		Error << "No workers to run";
+		return false;
+	}
+
+	//	no SA_RESTART, so a stop signal or the restart alarm interrupts waitpid
+	struct sigaction StopAction;
+	memset( &StopAction, 0, sizeof(StopAction) );
+	StopAction.sa_handler = WorkerSupervisor::OnStopSignal;
+	sigemptyset( &StopAction.sa_mask );
+	sigaction( SIGINT, &StopAction, nullptr );
+	sigaction( SIGTERM, &StopAction, nullptr );
+	struct sigaction AlarmAction = StopAction;
+	AlarmAction.sa_handler = WorkerSupervisor::OnAlarmSignal;
+	sigaction( SIGALRM, &AlarmAction, nullptr );
+
+	for ( int w=0;	w<mWorkers.size();	w++ )
+	{
+		if ( !Start( w, Error ) )
+		{
+			StopWorkers();
+			return false;
+		}
+	}
+
+	while ( true )
+	{
+		bool HasPending = false;
+		std::chrono::steady_clock::time_point NextRestart;
+		if ( !WorkerSupervisor::gStopSignal && !StartPending( HasPending, NextRestart, Error ) )
+		{
+			StopWorkers();
+			return false;
+		}
+
+		int Status = 0;
+		pid_t Pid = -1;
+		int WaitError = 0;
+		if ( !WorkerSupervisor::gStopSignal )
+		{
+			if ( HasPending )
+			{
+				auto Delay = std::chrono::duration_cast<std::chrono::microseconds>( NextRestart - std::chrono::steady_clock::now() );
+				WorkerSupervisor::SetRestartAlarm( std::max( Delay, std::chrono::microseconds(1) ) );
+			}
+			Pid = waitpid( -1, &Status, 0 );
+			WaitError = errno;
+			//	every worker is waiting to restart, so there's nothing to wait for but the alarm
+			if ( Pid < 0 && WaitError == ECHILD && HasPending )
+				pause();
+			if ( HasPending )
+				WorkerSupervisor::SetRestartAlarm( std::chrono::microseconds(0) );
+		}
+
+		if ( WorkerSupervisor::gStopSignal )
+		{
+			std::Debug << "Supervisor stopping workers" << std::endl;
+			StopWorkers();
+			return true;
+		}
+		if ( Pid < 0 )
+		{
+			if ( WaitError == EINTR || ( WaitError == ECHILD && HasPending ) )
+				continue;
+			Error << "Waiting for workers failed: " << strerror( WaitError );
+			StopWorkers();
+			return false;
+		}
+
+		auto Worker = std::find_if( mWorkers.begin(), mWorkers.end(), [Pid](const TWorkerProcess& Process)	{	return Process.mPid == Pid;	} );
+		if ( Worker == mWorkers.end() )
+			continue;
+		OnExited( static_cast<int>( Worker - mWorkers.begin() ), Status );
+
+		bool AllFinished = std::all_of( mWorkers.begin(), mWorkers.end(), [](const TWorkerProcess& p)	{	return p.mFinished;	} );
+		if ( AllFinished )
+			return true;
+	}
+}
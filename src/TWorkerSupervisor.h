@@ -0,0 +1,88 @@
+#pragma once
+
+#include <ofxSoylent.h>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+
+//	workers=N [firstport=8080] [corespergroup=n] [framestore=ring framestoreslots=n framestoresize=bytes]
+class TWorkerSupervisorParams
+{
+public:
+	TWorkerSupervisorParams() :
+		mWorkerCount		( 0 ),
+		mFirstPort			( 8080 ),
+		mLastPort			( 8090 ),
+		mCoresPerWorker		( 0 ),
+		mRestartDelayMs		( 500 ),
+		mMaxRestartDelayMs	( 30000 )
+	{
+	}
+
+public:
+	int		mWorkerCount;
+	int		mFirstPort;
+	int		mLastPort;			//	workers past the port range aren't started
+	int		mCoresPerWorker;	//	0 splits the cores evenly. Only linux pins workers
+	int		mRestartDelayMs;	//	doubles whilst a worker keeps crashing straight after starting
+	int		mMaxRestartDelayMs;
+};
+
+
+class TWorkerProcess
+{
+public:
+	TWorkerProcess() :
+		mPid			( -1 ),
+		mPort			( 0 ),
+		mRestarts		( 0 ),
+		mRestartDelayMs	( 0 ),
+		mRestartPending	( false ),
+		mFinished		( false )
+	{
+	}
+
+public:
+	pid_t									mPid;
+	int										mPort;
+	int										mRestarts;
+	int										mRestartDelayMs;
+	bool									mRestartPending;	//	crashed, restarts at mRestartTime
+	bool									mFinished;		//	exited cleanly (exit job), so isn't restarted
+	std::chrono::steady_clock::time_point	mStarted;
+	std::chrono::steady_clock::time_point	mRestartTime;
+};
+
+
+//	forks a server process per port so every core is used and a crash (eg. an opencv exception nobody caught)
+//	only takes down one worker, which is restarted. Anything the workers share (the frame store) must be made
+//	before Run so it's inherited
+class TWorkerSupervisor
+{
+public:
+	//	runs in the child; returns the process exit code, 0 means don't restart
+	typedef std::function<int(int Worker,int Port)>	TWorkerMain;
+
+public:
+	TWorkerSupervisor(const TWorkerSupervisorParams& Params,TWorkerMain WorkerMain);
+
+	//	blocks until every worker has exited cleanly, or the supervisor is sent SIGINT/SIGTERM which it passes on
+	bool			Run(std::stringstream& Error);
+
+private:
+	bool			Start(int Worker,std::stringstream& Error);
+	//	start the workers whose restart is due. NextRestart is the soonest of the rest, false if there are none
+	bool			StartPending(bool& HasPending,std::chrono::steady_clock::time_point& NextRestart,std::stringstream& Error);
+	void			OnExited(int Worker,int Status);
+	void			SetAffinity(int Worker);
+	void			StopWorkers();
+
+private:
+	TWorkerSupervisorParams			mParams;
+	TWorkerMain						mWorkerMain;
+	std::vector<TWorkerProcess>		mWorkers;
+};
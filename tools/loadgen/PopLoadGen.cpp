@@ -0,0 +1,584 @@
+//	load generator and soak test for the PopOpencv http channel.
+//	standalone (no SoyLib), build with
+//		c++ -std=c++11 -O2 -pthread PopLoadGen.cpp -o poploadgen
+//	usage
+//		poploadgen [-host 127.0.0.1] [-port 8080] [-connections 8] [-duration 60] [-interval 5]
+//		           [-mix mix.txt] [-pid <server pid>] [-csv report.csv] [-timeout 10]
+//	each request is a new connection; GET /command?params, or a POST of a file as the body when the mix line has one
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+class TRequestSpec
+{
+public:
+	TRequestSpec() :
+		mWeight	( 1 )
+	{
+	}
+
+public:
+	int			mWeight;
+	std::string	mCommand;
+	std::string	mQuery;			//	key=value&key=value
+	std::string	mBody;			//	posted if not empty
+	std::string	mContentType;
+};
+
+
+//	log-linear latency histogram; 32 sub buckets per power of two gives ~3% precision
+class TLatencyHistogram
+{
+public:
+	static const int	SubBucketBits = 5;
+	static const int	SubBuckets = 1 << SubBucketBits;
+	static const int	MaxPower = 40;		//	us, way beyond any timeout
+
+public:
+	TLatencyHistogram() :
+		mBuckets	( SubBuckets * MaxPower, 0 ),
+		mCount		( 0 ),
+		mMaxUs		( 0 )
+	{
+	}
+
+	void		Add(uint64_t Us)
+	{
+		mBuckets[ GetBucket( Us ) ]++;
+		mCount++;
+		mMaxUs = std::max( mMaxUs, Us );
+	}
+
+	void		Add(const TLatencyHistogram& That)
+	{
+		for ( size_t b=0;	b<mBuckets.size();	b++ )
+			mBuckets[b] += That.mBuckets[b];
+		mCount += That.mCount;
+		mMaxUs = std::max( mMaxUs, That.mMaxUs );
+	}
+
+	void		Clear()
+	{
+		std::fill( mBuckets.begin(), mBuckets.end(), 0 );
+		mCount = 0;
+		mMaxUs = 0;
+	}
+
+	uint64_t	GetCount() const	{	return mCount;	}
+	uint64_t	GetMaxUs() const	{	return mMaxUs;	}
+
+	//	upper bound of the bucket the percentile falls in
+	uint64_t	GetPercentileUs(double Percentile) const
+	{
+		if ( mCount == 0 )
+			return 0;
+		auto Target = static_cast<uint64_t>( std::ceil( Percentile * mCount ) );
+		Target = std::max<uint64_t>( 1, Target );
+		uint64_t Seen = 0;
+		for ( size_t b=0;	b<mBuckets.size();	b++ )
+		{
+			Seen += mBuckets[b];
+			if ( Seen >= Target )
+				return std::min( GetBucketMaxUs( static_cast<int>(b) ), mMaxUs );
+		}
+		return mMaxUs;
+	}
+
+private:
+	static int		GetBucket(uint64_t Us)
+	{
+		if ( Us < SubBuckets )
+			return static_cast<int>( Us );
+		int Power = 63 - __builtin_clzll( Us );
+		int Shift = Power - SubBucketBits;
+		int Sub = static_cast<int>( (Us >> Shift) & (SubBuckets-1) );
+		int Bucket = (Shift+1) * SubBuckets + Sub;
+		return std::min( Bucket, SubBuckets * MaxPower - 1 );
+	}
+
+	static uint64_t	GetBucketMaxUs(int Bucket)
+	{
+		if ( Bucket < SubBuckets )
+			return Bucket;
+		int Shift = Bucket / SubBuckets - 1;
+		uint64_t Sub = Bucket % SubBuckets;
+		return ( ( (SubBuckets + Sub + 1) << Shift ) - 1 );
+	}
+
+private:
+	std::vector<uint64_t>	mBuckets;
+	uint64_t				mCount;
+	uint64_t				mMaxUs;
+};
+
+
+class TCommandStats
+{
+public:
+	TCommandStats() :
+		mErrors	( 0 ),
+		mBytes	( 0 )
+	{
+	}
+
+	void		Add(const TCommandStats& That)
+	{
+		mLatency.Add( That.mLatency );
+		mErrors += That.mErrors;
+		mBytes += That.mBytes;
+	}
+
+	void		Clear()
+	{
+		mLatency.Clear();
+		mErrors = 0;
+		mBytes = 0;
+	}
+
+public:
+	TLatencyHistogram	mLatency;		//	successful requests
+	uint64_t			mErrors;		//	connect/send/recv failures, timeouts and non-2xx
+	uint64_t			mBytes;			//	received
+};
+
+
+class TParams
+{
+public:
+	TParams() :
+		mHost			( "127.0.0.1" ),
+		mPort			( 8080 ),
+		mConnections	( 8 ),
+		mDurationSecs	( 60 ),
+		mIntervalSecs	( 5 ),
+		mTimeoutSecs	( 10 ),
+		mServerPid		( 0 )
+	{
+	}
+
+public:
+	std::string		mHost;
+	int				mPort;
+	int				mConnections;
+	int				mDurationSecs;
+	int				mIntervalSecs;
+	int				mTimeoutSecs;
+	int				mServerPid;
+	std::string		mMixFilename;
+	std::string		mCsvFilename;
+};
+
+
+namespace LoadGen
+{
+	bool		ReadFile(const std::string& Filename,std::string& Contents);
+	bool		LoadMix(std::vector<TRequestSpec>& Mix,const std::string& Filename,std::ostream& Error);
+	void		GetDefaultMix(std::vector<TRequestSpec>& Mix);
+	std::string	GetRequest(const TParams& Params,const TRequestSpec& Spec);
+	bool		SendRequest(const TParams& Params,const sockaddr_in& Address,const std::string& Request,uint64_t& ReplyBytes,int& Status);
+	bool		SendAll(int Socket,const char* Data,size_t Size);
+	uint64_t	GetServerRssKb(int Pid);
+	std::string	GetContentType(const std::string& Filename);
+}
+
+
+bool LoadGen::ReadFile(const std::string& Filename,std::string& Contents)
+{
+	std::ifstream File( Filename, std::ios::in | std::ios::binary );
+	if ( !File.is_open() )
+		return false;
+	std::stringstream Buffer;
+	Buffer << File.rdbuf();
+	Contents = Buffer.str();
+	return true;
+}
+
+
+std::string LoadGen::GetContentType(const std::string& Filename)
+{
+	auto Dot = Filename.find_last_of('.');
+	std::string Extension = ( Dot == std::string::npos ) ? std::string() : Filename.substr( Dot+1 );
+	if ( Extension == "png" )					return "image/png";
+	if ( Extension == "jpg" || Extension == "jpeg" )	return "image/jpeg";
+	return "application/octet-stream";
+}
+
+
+//	a line per request type;
+//		weight command [params] [@file to post]
+//	params are a url query, eg. asbinary=1&minscore=0.9. # starts a comment
+bool LoadGen::LoadMix(std::vector<TRequestSpec>& Mix,const std::string& Filename,std::ostream& Error)
+{
+	std::ifstream File( Filename );
+	if ( !File.is_open() )
+	{
+		Error << "Failed to open mix " << Filename << std::endl;
+		return false;
+	}
+
+	std::string Line;
+	int LineNumber = 0;
+	while ( std::getline( File, Line ) )
+	{
+		LineNumber++;
+		auto Comment = Line.find('#');
+		if ( Comment != std::string::npos )
+			Line.resize( Comment );
+
+		std::stringstream LineStream( Line );
+		TRequestSpec Spec;
+		if ( !(LineStream >> Spec.mWeight >> Spec.mCommand) )
+			continue;
+
+		std::string Token;
+		while ( LineStream >> Token )
+		{
+			if ( Token[0] == '@' )
+			{
+				auto BodyFilename = Token.substr(1);
+				if ( !ReadFile( BodyFilename, Spec.mBody ) )
+				{
+					Error << Filename << ":" << LineNumber << " failed to read " << BodyFilename << std::endl;
+					return false;
+				}
+				Spec.mContentType = GetContentType( BodyFilename );
+			}
+			else
+			{
+				Spec.mQuery = Token;
+			}
+		}
+		if ( Spec.mWeight > 0 )
+			Mix.push_back( Spec );
+	}
+
+	if ( Mix.empty() )
+	{
+		Error << "No requests in mix " << Filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+//	jobs that need no image; use a mix file to include the image jobs
+void LoadGen::GetDefaultMix(std::vector<TRequestSpec>& Mix)
+{
+	TRequestSpec Homography;
+	Homography.mWeight = 4;
+	Homography.mCommand = "gethomography";
+	Homography.mQuery = "points2D=0.2311122x0.4221929,0.6946969x0.4212278,0.01516411x0.5610124,0.9345348x0.5757555&pointsuv=0x0,1x0,0x1,1x1";
+	Mix.push_back( Homography );
+
+	TRequestSpec Calibrate;
+	Calibrate.mWeight = 1;
+	Calibrate.mCommand = "calibratecamera";
+	Calibrate.mQuery = "points2D=0.2311122x0.4221929,0.6946969x0.4212278,0.01516411x0.5610124,0.9345348x0.5757555&points3D=-120x0x-68,120x0x-68,-120x0x68,120x0x68";
+	Mix.push_back( Calibrate );
+}
+
+
+std::string LoadGen::GetRequest(const TParams& Params,const TRequestSpec& Spec)
+{
+	std::stringstream Request;
+	Request << ( Spec.mBody.empty() ? "GET" : "POST" ) << " /" << Spec.mCommand;
+	if ( !Spec.mQuery.empty() )
+		Request << "?" << Spec.mQuery;
+	Request << " HTTP/1.1\r\n";
+	Request << "Host: " << Params.mHost << ":" << Params.mPort << "\r\n";
+	Request << "Connection: close\r\n";
+	if ( !Spec.mBody.empty() )
+	{
+		Request << "Content-Type: " << Spec.mContentType << "\r\n";
+		Request << "Content-Length: " << Spec.mBody.length() << "\r\n";
+	}
+	Request << "\r\n";
+	Request << Spec.mBody;
+	return Request.str();
+}
+
+
+bool LoadGen::SendAll(int Socket,const char* Data,size_t Size)
+{
+	while ( Size > 0 )
+	{
+		auto Sent = send( Socket, Data, Size, 0 );
+		if ( Sent <= 0 )
+			return false;
+		Data += Sent;
+		Size -= Sent;
+	}
+	return true;
+}
+
+
+//	true if we got a complete reply (the server closes the connection)
+bool LoadGen::SendRequest(const TParams& Params,const sockaddr_in& Address,const std::string& Request,uint64_t& ReplyBytes,int& Status)
+{
+	ReplyBytes = 0;
+	Status = 0;
+	int Socket = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( Socket < 0 )
+		return false;
+
+	timeval Timeout;
+	Timeout.tv_sec = Params.mTimeoutSecs;
+	Timeout.tv_usec = 0;
+	setsockopt( Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout) );
+	setsockopt( Socket, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout) );
+	int NoDelay = 1;
+	setsockopt( Socket, IPPROTO_TCP, TCP_NODELAY, &NoDelay, sizeof(NoDelay) );
+
+	bool Success = connect( Socket, reinterpret_cast<const sockaddr*>(&Address), sizeof(Address) ) == 0;
+	Success = Success && SendAll( Socket, Request.c_str(), Request.length() );
+
+	//	read to close; only the status line is parsed
+	std::string Head;
+	char Buffer[64*1024];
+	while ( Success )
+	{
+		auto Read = recv( Socket, Buffer, sizeof(Buffer), 0 );
+		if ( Read == 0 )
+			break;
+		if ( Read < 0 )
+		{
+			Success = false;
+			break;
+		}
+		if ( Head.length() < 32 )
+			Head.append( Buffer, std::min<size_t>( Read, 32 ) );
+		ReplyBytes += Read;
+	}
+	close( Socket );
+
+	//	HTTP/1.1 200 OK
+	auto Space = Head.find(' ');
+	if ( Space != std::string::npos )
+		Status = atoi( Head.c_str() + Space + 1 );
+	return Success && ReplyBytes > 0;
+}
+
+
+uint64_t LoadGen::GetServerRssKb(int Pid)
+{
+	if ( Pid <= 0 )
+		return 0;
+
+	//	linux
+	std::ifstream Status( "/proc/" + std::to_string(Pid) + "/status" );
+	std::string Line;
+	while ( Status.is_open() && std::getline( Status, Line ) )
+	{
+		if ( Line.compare( 0, 6, "VmRSS:" ) == 0 )
+			return strtoull( Line.c_str() + 6, nullptr, 10 );
+	}
+
+	//	osx, and anything else with ps
+	std::string Command = "ps -o rss= -p " + std::to_string(Pid);
+	auto* Pipe = popen( Command.c_str(), "r" );
+	if ( !Pipe )
+		return 0;
+	unsigned long long RssKb = 0;
+	if ( fscanf( Pipe, "%llu", &RssKb ) != 1 )
+		RssKb = 0;
+	pclose( Pipe );
+	return RssKb;
+}
+
+
+bool ParseArgs(TParams& Params,int argc,const char* argv[])
+{
+	for ( int a=1;	a<argc;	a++ )
+	{
+		std::string Arg = argv[a];
+		if ( a+1 >= argc )
+		{
+			std::cerr << "Missing value for " << Arg << std::endl;
+			return false;
+		}
+		std::string Value = argv[++a];
+		if ( Arg == "-host" )				Params.mHost = Value;
+		else if ( Arg == "-port" )			Params.mPort = atoi( Value.c_str() );
+		else if ( Arg == "-connections" )	Params.mConnections = std::max( 1, atoi( Value.c_str() ) );
+		else if ( Arg == "-duration" )		Params.mDurationSecs = atoi( Value.c_str() );
+		else if ( Arg == "-interval" )		Params.mIntervalSecs = std::max( 1, atoi( Value.c_str() ) );
+		else if ( Arg == "-timeout" )		Params.mTimeoutSecs = std::max( 1, atoi( Value.c_str() ) );
+		else if ( Arg == "-pid" )			Params.mServerPid = atoi( Value.c_str() );
+		else if ( Arg == "-mix" )			Params.mMixFilename = Value;
+		else if ( Arg == "-csv" )			Params.mCsvFilename = Value;
+		else
+		{
+			std::cerr << "Unknown arg " << Arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int main(int argc,const char* argv[])
+{
+	TParams Params;
+	if ( !ParseArgs( Params, argc, argv ) )
+		return 1;
+
+	std::vector<TRequestSpec> Mix;
+	if ( Params.mMixFilename.empty() )
+		LoadGen::GetDefaultMix( Mix );
+	else if ( !LoadGen::LoadMix( Mix, Params.mMixFilename, std::cerr ) )
+		return 1;
+
+	sockaddr_in Address;
+	memset( &Address, 0, sizeof(Address) );
+	Address.sin_family = AF_INET;
+	Address.sin_port = htons( Params.mPort );
+	if ( inet_pton( AF_INET, Params.mHost.c_str(), &Address.sin_addr ) != 1 )
+	{
+		auto* Host = gethostbyname( Params.mHost.c_str() );
+		if ( !Host || Host->h_addrtype != AF_INET )
+		{
+			std::cerr << "Failed to resolve " << Params.mHost << std::endl;
+			return 1;
+		}
+		memcpy( &Address.sin_addr, Host->h_addr_list[0], sizeof(Address.sin_addr) );
+	}
+
+	std::vector<std::string> Requests;
+	std::vector<int> Weights;
+	for ( auto& Spec : Mix )
+	{
+		Requests.push_back( LoadGen::GetRequest( Params, Spec ) );
+		Weights.push_back( Spec.mWeight );
+	}
+
+	//	each connection thread accumulates into its own stats, the reporter swaps them out each interval
+	std::mutex StatsLock;
+	std::vector<TCommandStats> IntervalStats( Mix.size() );
+	std::vector<TCommandStats> TotalStats( Mix.size() );
+	std::atomic<bool> Running( true );
+
+	auto ConnectionThread = [&](int Seed)
+	{
+		std::mt19937 Random( Seed );
+		std::discrete_distribution<int> Pick( Weights.begin(), Weights.end() );
+		while ( Running )
+		{
+			int r = Pick( Random );
+			uint64_t ReplyBytes = 0;
+			int Status = 0;
+			auto Start = std::chrono::steady_clock::now();
+			bool Success = LoadGen::SendRequest( Params, Address, Requests[r], ReplyBytes, Status );
+			auto Us = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - Start ).count();
+			Success = Success && Status >= 200 && Status < 300;
+
+			std::lock_guard<std::mutex> Lock( StatsLock );
+			auto& Stats = IntervalStats[r];
+			Stats.mBytes += ReplyBytes;
+			if ( Success )
+				Stats.mLatency.Add( Us );
+			else
+				Stats.mErrors++;
+		}
+	};
+
+	std::ofstream Csv;
+	if ( !Params.mCsvFilename.empty() )
+	{
+		Csv.open( Params.mCsvFilename );
+		Csv << "secs,command,requests,persec,errors,errorrate,p50ms,p90ms,p99ms,p999ms,maxms,rsskb" << std::endl;
+	}
+
+	auto PrintStats = [&](std::ostream& Output,double Secs,const std::string& Label,const TCommandStats& Stats,double IntervalSecs,uint64_t RssKb,bool AsCsv)
+	{
+		auto Requests = Stats.mLatency.GetCount() + Stats.mErrors;
+		double ErrorRate = Requests ? Stats.mErrors / static_cast<double>(Requests) : 0.0;
+		auto Ms = [&](double Percentile)	{	return Stats.mLatency.GetPercentileUs( Percentile ) / 1000.0;	};
+		char Line[512];
+		const char* Format = AsCsv ? "%.0f,%s,%llu,%.1f,%llu,%.4f,%.2f,%.2f,%.2f,%.2f,%.2f,%llu\n" : "%6.0fs %-24s %8llu req %8.1f/s %6llu err (%5.2f%%) p50 %8.2fms p90 %8.2fms p99 %8.2fms p99.9 %8.2fms max %8.2fms rss %llukb\n";
+		snprintf( Line, sizeof(Line), Format, Secs, Label.c_str(), static_cast<unsigned long long>(Requests), Requests / IntervalSecs,
+				 static_cast<unsigned long long>(Stats.mErrors), AsCsv ? ErrorRate : ErrorRate*100.0,
+				 Ms(0.5), Ms(0.9), Ms(0.99), Ms(0.999), Stats.mLatency.GetMaxUs() / 1000.0, static_cast<unsigned long long>(RssKb) );
+		Output << Line;
+	};
+
+	std::cout << "Load testing " << Params.mHost << ":" << Params.mPort << " with " << Params.mConnections << " connections for " << Params.mDurationSecs << "s" << std::endl;
+	auto RssAtStart = LoadGen::GetServerRssKb( Params.mServerPid );
+
+	std::vector<std::thread> Connections;
+	for ( int c=0;	c<Params.mConnections;	c++ )
+		Connections.push_back( std::thread( ConnectionThread, c+1 ) );
+
+	auto Start = std::chrono::steady_clock::now();
+	auto NextReport = Start;
+	uint64_t RssKb = RssAtStart;
+	while ( true )
+	{
+		NextReport += std::chrono::seconds( Params.mIntervalSecs );
+		auto End = Start + std::chrono::seconds( Params.mDurationSecs );
+		bool Last = Params.mDurationSecs > 0 && NextReport >= End;
+		std::this_thread::sleep_until( Last ? End : NextReport );
+		if ( Last )
+			Running = false;
+
+		std::vector<TCommandStats> Interval( Mix.size() );
+		{
+			std::lock_guard<std::mutex> Lock( StatsLock );
+			std::swap( Interval, IntervalStats );
+		}
+		auto Secs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - Start ).count() / 1000.0;
+		RssKb = LoadGen::GetServerRssKb( Params.mServerPid );
+		TCommandStats IntervalAll;
+		for ( size_t r=0;	r<Mix.size();	r++ )
+		{
+			IntervalAll.Add( Interval[r] );
+			TotalStats[r].Add( Interval[r] );
+			if ( Csv.is_open() )
+				PrintStats( Csv, Secs, Mix[r].mCommand, Interval[r], Params.mIntervalSecs, RssKb, true );
+		}
+		PrintStats( std::cout, Secs, "all", IntervalAll, Params.mIntervalSecs, RssKb, false );
+		if ( Last )
+			break;
+	}
+
+	for ( auto& Thread : Connections )
+		Thread.join();
+
+	//	requests still in flight at the end land here
+	for ( size_t r=0;	r<Mix.size();	r++ )
+		TotalStats[r].Add( IntervalStats[r] );
+
+	auto TotalSecs = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - Start ).count() / 1000.0;
+	std::cout << std::endl << "Totals" << std::endl;
+	TCommandStats All;
+	for ( size_t r=0;	r<Mix.size();	r++ )
+	{
+		All.Add( TotalStats[r] );
+		PrintStats( std::cout, TotalSecs, Mix[r].mCommand, TotalStats[r], TotalSecs, RssKb, false );
+	}
+	PrintStats( std::cout, TotalSecs, "all", All, TotalSecs, RssKb, false );
+	if ( Params.mServerPid > 0 )
+		std::cout << "Server rss " << RssAtStart << "kb -> " << RssKb << "kb" << std::endl;
+
+	return All.mErrors > 0 ? 2 : 0;
+}